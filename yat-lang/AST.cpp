@@ -16,6 +16,9 @@
 //
 #include "AST.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
 
 void AddTabs(size_t n)
 {
@@ -33,14 +36,14 @@ BinOp::BinOp()
 void BinOp::DebugPrint(size_t d)
 {
     AddTabs(d);
-    std::wcout << L"Binary operator " << oper.data << L" Operands:\n";
+    std::wcout << L"Binary operator " << oper.GetText() << L" Operands:\n";
     l->DebugPrint(d + 1);
     AddTabs(d);
     std::wcout << L"AND\n";
     r->DebugPrint(d + 1);
 }
 
-Keyword BinOp::GetTypeKW()
+void BinOp::Typify()
 {
     Keyword lr = l->GetTypeKW(), rr = r->GetTypeKW();
 
@@ -56,16 +59,72 @@ Keyword BinOp::GetTypeKW()
     case TokenType::OperLEqual:
     case TokenType::OperGEqual:
     {
-        return Keyword::kw_bool;
+        res_type = Keyword::kw_bool;
+        return;
+    }
+    }
+
+    res_type = GetTypeSize(lr) < GetTypeSize(rr) ? rr : lr;
+}
+
+// constant made by folding, with the text for the code generator and the value
+template<class T>
+static ConstLeaf* NewConst(T v, TokenType type)
+{
+    Token t(std::to_wstring(v), type, 0, 0);
+    if constexpr (std::is_signed<T>())
+    {
+        t.num.i = (int64_t)v;
+    }
+    else
+    {
+        t.num.u = (uint64_t)v;
     }
+    return new ConstLeaf(t);
+}
+
+// value of the constant sign- or zero-extended from its type to 64 bits
+static int64_t ToInt64(ConstLeaf::GetNumRes n, Keyword t)
+{
+    switch (t)
+    {
+    case Keyword::kw_i8:  return n.ib;
+    case Keyword::kw_u8:  return n.ub;
+    case Keyword::kw_i16: return n.iw;
+    case Keyword::kw_u16: return n.uw;
+    case Keyword::kw_i32: return n.id;
+    case Keyword::kw_u32: return n.ud;
+    default:              return n.iq;
     }
+}
 
-    if (GetTypeSize(lr) < GetTypeSize(rr))
+// constant of the integer type t made of the low bits of v,
+// nullptr if t isn't an integer type
+static ConstLeaf* IntConst(Keyword t, int64_t v)
+{
+    switch (t)
     {
-        return rr;
+    case Keyword::kw_i8:  return NewConst((int8_t)v,   TokenType::Int8L);
+    case Keyword::kw_u8:  return NewConst((uint8_t)v,  TokenType::Uint8L);
+    case Keyword::kw_i16: return NewConst((int16_t)v,  TokenType::Int16L);
+    case Keyword::kw_u16: return NewConst((uint16_t)v, TokenType::Uint16L);
+    case Keyword::kw_i32: return NewConst((int32_t)v,  TokenType::Int32L);
+    case Keyword::kw_u32: return NewConst((uint32_t)v, TokenType::Uint32L);
+    case Keyword::kw_i64: return NewConst((int64_t)v,  TokenType::Int64L);
+    case Keyword::kw_u64: return NewConst((uint64_t)v, TokenType::Uint64L);
     }
+    return nullptr;
+}
 
-    return lr;
+// the constant converted to the integer type t as it is done at run time,
+// nullptr if any of the types isn't an integer one
+static ConstLeaf* CastConst(ConstLeaf* c, Keyword t)
+{
+    if (!IsNumber(c->GetTypeKW()))
+    {
+        return nullptr;
+    }
+    return IntConst(t, c->GetInt());
 }
 
 ASTNode* BinOp::TryEval()
@@ -73,53 +132,53 @@ ASTNode* BinOp::TryEval()
     l = l->TryEval();
     r = r->TryEval();
 
-    if (l->type != NodeType::ConstLeaf || r->type != NodeType::ConstLeaf)
+    auto t = GetTypeKW();
+    if (l->type != NodeType::ConstLeaf || r->type != NodeType::ConstLeaf || !IsNumber(t))
     {
         return this;
     }
 
-    auto ln = ((ConstLeaf*)l)->GetNumber();
-    auto rn = ((ConstLeaf*)r)->GetNumber();
-    auto t = GetTypeKW();
-
-#define OPER_CASE(_op)\
-    switch (t)\
-    {\
-    case Keyword::kw_i8:  return new ConstLeaf(Token(std::to_wstring(ln.ib _op rn.ib), TokenType::Int8L  , 0, 0, 0));\
-    case Keyword::kw_u8:  return new ConstLeaf(Token(std::to_wstring(ln.ub _op rn.ub), TokenType::Uint8L , 0, 0, 0));\
-    case Keyword::kw_i16: return new ConstLeaf(Token(std::to_wstring(ln.iw _op rn.iw), TokenType::Int16L , 0, 0, 0));\
-    case Keyword::kw_u16: return new ConstLeaf(Token(std::to_wstring(ln.uw _op rn.uw), TokenType::Uint16L, 0, 0, 0));\
-    case Keyword::kw_i32: return new ConstLeaf(Token(std::to_wstring(ln.id _op rn.id), TokenType::Int32L , 0, 0, 0));\
-    case Keyword::kw_u32: return new ConstLeaf(Token(std::to_wstring(ln.ud _op rn.ud), TokenType::Uint32L, 0, 0, 0));\
-    case Keyword::kw_i64: return new ConstLeaf(Token(std::to_wstring(ln.iq _op rn.iq), TokenType::Int64L , 0, 0, 0));\
-    case Keyword::kw_u64: return new ConstLeaf(Token(std::to_wstring(ln.uq _op rn.uq), TokenType::Uint64L, 0, 0, 0));\
-    }
+    // the left operand of the expression is kept in r
+    int64_t a = ToInt64(((ConstLeaf*)r)->GetNumber(), t);
+    int64_t b = ToInt64(((ConstLeaf*)l)->GetNumber(), t);
+    // wrapping operations are done on unsigned values, only low bits are kept
+    uint64_t ua = a, ub = b;
+    int64_t res = 0;
 
     switch (oper.type)
     {
-        case TokenType::OperPlus:  OPER_CASE(+);
-        case TokenType::OperMin:   OPER_CASE(-);
-        case TokenType::OperMul:   OPER_CASE(*);
-        case TokenType::OperPow:
+    case TokenType::OperPlus:  res = ua + ub; break;
+    case TokenType::OperMin:   res = ua - ub; break;
+    case TokenType::OperMul:   res = ua * ub; break;
+    case TokenType::OperBWAnd: res = a & b;   break;
+    case TokenType::OperBWOr:  res = a | b;   break;
+    case TokenType::OperXor:   res = a ^ b;   break;
+    case TokenType::OperPow:
+        res = IsSigned(t)
+            ? (int64_t)std::pow(a, b)
+            : (int64_t)(uint64_t)std::pow(ua, ub);
+        break;
+    case TokenType::OperDiv:
+    case TokenType::OperPCent:
+        // division by zero and the overflow of division by -1 are left to run time
+        if (b == 0 || (IsSigned(t) && b == -1))
         {
-            switch (t)
-            {
-            case Keyword::kw_i8:  return new ConstLeaf(Token(std::to_wstring(std::pow(ln.ib, rn.ib)), TokenType::Int8L, 0, 0, 0));
-            case Keyword::kw_u8:  return new ConstLeaf(Token(std::to_wstring(std::pow(ln.ub, rn.ub)), TokenType::Uint8L, 0, 0, 0));
-            case Keyword::kw_i16: return new ConstLeaf(Token(std::to_wstring(std::pow(ln.iw, rn.iw)), TokenType::Int16L, 0, 0, 0));
-            case Keyword::kw_u16: return new ConstLeaf(Token(std::to_wstring(std::pow(ln.uw, rn.uw)), TokenType::Uint16L, 0, 0, 0));
-            case Keyword::kw_i32: return new ConstLeaf(Token(std::to_wstring(std::pow(ln.id, rn.id)), TokenType::Int32L, 0, 0, 0));
-            case Keyword::kw_u32: return new ConstLeaf(Token(std::to_wstring(std::pow(ln.ud, rn.ud)), TokenType::Uint32L, 0, 0, 0));
-            case Keyword::kw_i64: return new ConstLeaf(Token(std::to_wstring(std::pow(ln.iq, rn.iq)), TokenType::Int64L, 0, 0, 0));
-            case Keyword::kw_u64: return new ConstLeaf(Token(std::to_wstring(std::pow(ln.uq, rn.uq)), TokenType::Uint64L, 0, 0, 0));
-            }
+            return this;
         }
-        case TokenType::OperDiv:   OPER_CASE(/);
-        case TokenType::OperPCent: OPER_CASE(*);
-            break;
+        if (IsSigned(t))
+        {
+            res = oper.type == TokenType::OperDiv ? a / b : a % b;
+        }
+        else
+        {
+            res = oper.type == TokenType::OperDiv ? ua / ub : ua % ub;
+        }
+        break;
+    default:
+        return this;
     }
 
-    return this;
+    return IntConst(t, res);
 }
 
 bool BinOp::isConstEval()
@@ -148,6 +207,7 @@ void BinOp::AddTypeCvt()
                 ? Keyword::kw_i64
                 : Keyword::kw_u64);
         }
+        Typify();
         return;
     }
 
@@ -159,12 +219,14 @@ void BinOp::AddTypeCvt()
     {
         l = new Convert(l, r->GetTypeKW());
     }
+    Typify();
 }
 
 VarLeaf::VarLeaf(Var* data)
 {
     type = NodeType::VarLeaf;
     this->data = data;
+    Typify();
 }
 
 void VarLeaf::DebugPrint(size_t d)
@@ -174,13 +236,18 @@ void VarLeaf::DebugPrint(size_t d)
         << KeywordStr[(int)data->var_type] << L" " << data->name << L"\n";
 }
 
-Keyword VarLeaf::GetTypeKW()
+void VarLeaf::Typify()
 {
-    return data->GetTypeKW();
+    res_type = data->GetTypeKW();
 }
 
 ASTNode* VarLeaf::TryEval()
 {
+    if (data->value)
+    {
+        // every use gets its own node, folding changes constants in place
+        return new ConstLeaf(data->value->data);
+    }
     return this;
 }
 
@@ -197,17 +264,18 @@ ConstLeaf::ConstLeaf(const Token& data)
 {
     type = NodeType::ConstLeaf;
     this->data = data;
+    Typify();
 }
 
 void ConstLeaf::DebugPrint(size_t d)
 {
     AddTabs(d);
-    std::wcout << L"Constant: " << data.data << L"\n";
+    std::wcout << L"Constant: " << data.GetText() << L"\n";
 }
 
-Keyword ConstLeaf::GetTypeKW()
+void ConstLeaf::Typify()
 {
-    return TTypeToKeyword(data.type);
+    res_type = TTypeToKeyword(data.type);
 }
 
 ASTNode* ConstLeaf::TryEval()
@@ -222,23 +290,18 @@ bool ConstLeaf::isConstEval()
 
 ConstLeaf::GetNumRes ConstLeaf::GetNumber()
 {
+    // the value is parsed by the tokenizer,
+    // every member of the union reads its low bits
     GetNumRes res{};
-
-    switch (GetTypeKW())
-    {
-    case Keyword::kw_i8: res.ib = StringToNum<int8_t>(data.data);
-    case Keyword::kw_u8: res.ub = StringToNum<uint8_t>(data.data);
-    case Keyword::kw_i16: res.iw = StringToNum<int16_t>(data.data);
-    case Keyword::kw_u16: res.uw = StringToNum<uint16_t>(data.data);
-    case Keyword::kw_i32: res.id = StringToNum<int32_t>(data.data);
-    case Keyword::kw_u32: res.ud = StringToNum<uint32_t>(data.data);
-    case Keyword::kw_i64: res.iq = StringToNum<int64_t>(data.data);
-    case Keyword::kw_u64: res.uq = StringToNum<uint64_t>(data.data);
-    }
-
+    res.uq = data.num.u;
     return res;
 }
 
+int64_t ConstLeaf::GetInt()
+{
+    return ToInt64(GetNumber(), GetTypeKW());
+}
+
 void ConstLeaf::AddTypeCvt()
 {
 }
@@ -246,6 +309,7 @@ void ConstLeaf::AddTypeCvt()
 StatementBlock::StatementBlock()
 {
     type = NodeType::StBlock;
+    Typify();
 }
 
 void StatementBlock::DebugPrint(size_t d)
@@ -258,13 +322,17 @@ void StatementBlock::DebugPrint(size_t d)
     }
 }
 
-Keyword StatementBlock::GetTypeKW()
+void StatementBlock::Typify()
 {
-    return Keyword::Last;
+    res_type = Keyword::Last;
 }
 
 ASTNode* StatementBlock::TryEval()
 {
+    for (ASTNode*& node : children)
+    {
+        node = node->TryEval();
+    }
     return this;
 }
 
@@ -284,17 +352,22 @@ UnOp::UnOp()
 void UnOp::DebugPrint(size_t d)
 {
     AddTabs(d);
-    std::wcout << L"Unary operator " << oper.data << L" Operand:\n";
+    std::wcout << L"Unary operator " << oper.GetText() << L" Operand:\n";
     operand->DebugPrint(d + 1);
 }
 
-Keyword UnOp::GetTypeKW()
+void UnOp::Typify()
 {
-    return operand->GetTypeKW();
+    res_type = operand->GetTypeKW();
 }
 
 ASTNode* UnOp::TryEval()
 {
+    if (!operand)
+    {
+        return this;
+    }
+
     operand = operand->TryEval();
     if (oper.type == TokenType::OperMin)
     {
@@ -306,13 +379,23 @@ ASTNode* UnOp::TryEval()
                 throw Error(L"Unary operator '-' applied to unsigned type\n");
             }
 
-            if (v->data.data[0] == L'-')
+            if (IsNumber(v->data.type))
+            {
+                v->data.num.i = -v->data.num.i;
+            }
+            else
+            {
+                v->data.num.f = -v->data.num.f;
+            }
+
+            std::wstring_view num = v->data.GetText();
+            if (num[0] == L'-')
             {
-                v->data.data = v->data.data.substr(1);
+                v->data.SetText(num.substr(1));
             }
             else
             {
-                v->data.data = L'-' + v->data.data;
+                v->data.SetOwnText(L'-' + String(num));
             }
             return v;
         }
@@ -328,11 +411,13 @@ bool UnOp::isConstEval()
 void UnOp::AddTypeCvt()
 {
     operand->AddTypeCvt();
+    Typify();
 }
 
 Lambda::Lambda()
 {
     type = NodeType::Func;
+    Typify();
 }
 
 void Lambda::DebugPrint(size_t d)
@@ -351,13 +436,59 @@ void Lambda::DebugPrint(size_t d)
     def->DebugPrint(d + 1);
 }
 
-Keyword Lambda::GetTypeKW()
+// TRUE if there is inline assembly in the code, nested functions aside
+static bool ContainsAsm(ASTNode* node)
 {
-    return Keyword::kw_fn;
+    if (!node)
+    {
+        return false;
+    }
+
+    switch (node->type)
+    {
+    case NodeType::UnOper:
+    {
+        UnOp* op = (UnOp*)node;
+        return (op->oper.type == TokenType::Keyword && op->oper.kw_type == Keyword::kw_asm)
+            || ContainsAsm(op->operand);
+    }
+    case NodeType::BinOper:
+        return ContainsAsm(((BinOp*)node)->l) || ContainsAsm(((BinOp*)node)->r);
+    case NodeType::Call:
+        return std::any_of(((FnCall*)node)->params.begin(), ((FnCall*)node)->params.end(), ContainsAsm);
+    case NodeType::StBlock:
+        return std::any_of(((StatementBlock*)node)->children.begin(), ((StatementBlock*)node)->children.end(), ContainsAsm);
+    case NodeType::Var:
+        return ContainsAsm(((Var*)node)->initial);
+    case NodeType::IfSt:
+    {
+        IfStatement* st = (IfStatement*)node;
+        return ContainsAsm(st->condition) || ContainsAsm(st->then_b) || ContainsAsm(st->else_b);
+    }
+    case NodeType::WhileLoop:
+        return ContainsAsm(((WhileLoop*)node)->condition) || ContainsAsm(((WhileLoop*)node)->body);
+    case NodeType::Cvt:
+        return ContainsAsm(((Convert*)node)->value);
+    case NodeType::ArrayLeaf:
+        return ContainsAsm(((ArrayLeaf*)node)->idx);
+    default:
+        return false;
+    }
+}
+
+bool Lambda::HasAsm() const
+{
+    return !def || ContainsAsm(def);
+}
+
+void Lambda::Typify()
+{
+    res_type = Keyword::kw_fn;
 }
 
 ASTNode* Lambda::TryEval()
 {
+    def->TryEval();
     return this;
 }
 
@@ -374,20 +505,24 @@ FnCall::FnCall()
 void FnCall::DebugPrint(size_t d)
 {
     AddTabs(d);
-    std::wcout << L"Calling function " << FnName.data << L" with params:\n";
+    std::wcout << L"Calling function " << FnName.GetText() << L" with params:\n";
     for (ASTNode* n : params)
     {
         n->DebugPrint(d + 1);
     }
 }
 
-Keyword FnCall::GetTypeKW()
+void FnCall::Typify()
 {
-    return func->ret_type;
+    res_type = func->ret_type;
 }
 
 ASTNode* FnCall::TryEval()
 {
+    for (ASTNode*& p : params)
+    {
+        p = p->TryEval();
+    }
     return this;
 }
 
@@ -405,15 +540,18 @@ void FnCall::AddTypeCvt()
 Var::Var()
 {
     type = NodeType::Var;
+    Typify();
 }
 
 Var::Var(String n, Keyword t, bool m, Range* a)
 {
     type = NodeType::Var;
     name = n;
+    sym = InternSymbol(name);
     var_type = t;
     mut = m;
     arr = a;
+    Typify();
 }
 
 void Var::DebugPrint(size_t d)
@@ -438,16 +576,37 @@ void Var::DebugPrint(size_t d)
     }
 }
 
-Keyword Var::GetTypeKW()
+void Var::Typify()
 {
-    return var_type;
+    res_type = var_type;
 }
 
 ASTNode* Var::TryEval()
 {
+    if (!initial)
+    {
+        return this;
+    }
+
+    initial = initial->TryEval();
+    // an immutable variable which nothing changes keeps its initial value
+    if (!mut && !changed && !is_arr && initial->type == NodeType::ConstLeaf)
+    {
+        value = CastConst((ConstLeaf*)initial, var_type);
+    }
     return this;
 }
 
+Lambda* Var::DirectFn()
+{
+    if (var_type != Keyword::kw_fn || mut || !initial || initial->type != NodeType::Func)
+    {
+        return nullptr;
+    }
+    Lambda* fn = (Lambda*)initial;
+    return fn->label != NoSymbol ? fn : nullptr;
+}
+
 void Var::AddTypeCvt()
 {
     if (!initial) return;
@@ -460,6 +619,14 @@ void Var::AddTypeCvt()
     }
 }
 
+AST::~AST()
+{
+    for (Namespace* ns : prog)
+    {
+        delete ns;
+    }
+}
+
 void AST::DebugPrint()
 {
     std::wcout << L"Printing AST namespaces:\n";
@@ -483,6 +650,7 @@ Range::Range()
 {
     type = NodeType::Range;
     l = r = nullptr;
+    Typify();
 }
 
 Range::Range(ConstLeaf* start, ConstLeaf* end, uint8_t flags)
@@ -491,6 +659,7 @@ Range::Range(ConstLeaf* start, ConstLeaf* end, uint8_t flags)
     l = start;
     r = end;
     this->flags = flags;
+    Typify();
 }
 
 void Range::DebugPrint(size_t d)
@@ -510,9 +679,9 @@ void Range::DebugPrint(size_t d)
     std::wcout << (flags & RightInclusive ? L"(Inclusive)" : L"(Exclusive)") << L"\n";
 }
 
-Keyword Range::GetTypeKW()
+void Range::Typify()
 {
-    return Keyword::kw_rng;
+    res_type = Keyword::kw_rng;
 }
 
 ASTNode* Range::TryEval()
@@ -550,21 +719,113 @@ bool ASTNode::isConstEval()
     return false;
 }
 
+void* ASTNode::operator new(size_t n)
+{
+    return NodeArena::New(n);
+}
+
+void ASTNode::operator delete(void* p)
+{
+    NodeArena::Delete(p);
+}
+
+thread_local NodeArena* NodeArena::s_current = nullptr;
+
+NodeArena::~NodeArena()
+{
+    for (ASTNode* n : m_nodes)
+    {
+        if (n)
+        {
+            n->~ASTNode();
+        }
+    }
+
+    for (char* b : m_blocks)
+    {
+        ::operator delete(b);
+    }
+}
+
+void* NodeArena::Alloc(size_t n)
+{
+    constexpr size_t align = alignof(std::max_align_t);
+    n = sizeof(Header) + ((n + align - 1) & ~(align - 1));
+
+    if (n > m_left)
+    {
+        size_t size = std::max(n, BlockSize);
+        m_cur = static_cast<char*>(::operator new(size));
+        m_blocks.push_back(m_cur);
+        m_left = size;
+    }
+
+    Header* h = reinterpret_cast<Header*>(m_cur);
+    h->arena = this;
+    h->index = m_nodes.size();
+    m_cur += n;
+    m_left -= n;
+    m_nodes.push_back(reinterpret_cast<ASTNode*>(h + 1));
+    return h + 1;
+}
+
+void* NodeArena::New(size_t n)
+{
+    if (s_current)
+    {
+        return s_current->Alloc(n);
+    }
+
+    Header* h = static_cast<Header*>(::operator new(sizeof(Header) + n));
+    h->arena = nullptr;
+    return h + 1;
+}
+
+void NodeArena::Delete(void* p)
+{
+    Header* h = static_cast<Header*>(p) - 1;
+    if (h->arena)
+    {
+        h->arena->m_nodes[h->index] = nullptr;
+    }
+    else
+    {
+        ::operator delete(h);
+    }
+}
+
+NodeArena* NodeArena::Current()
+{
+    return s_current;
+}
+
+NodeArena::Use::Use(NodeArena& a)
+{
+    m_prev = s_current;
+    s_current = &a;
+}
+
+NodeArena::Use::~Use()
+{
+    s_current = m_prev;
+}
+
 StrLeaf::StrLeaf(const Token& data)
 {
     type = NodeType::String;
     this->data = data;
+    Typify();
 }
 
 void StrLeaf::DebugPrint(size_t d)
 {
     AddTabs(d);
-    std::wcout << L"String literal: " << data.data << L"\n";
+    std::wcout << L"String literal: " << data.GetText() << L"\n";
 }
 
-Keyword StrLeaf::GetTypeKW()
+void StrLeaf::Typify()
 {
-    return Keyword::kw_str16;
+    res_type = Keyword::kw_str16;
 }
 
 ASTNode* StrLeaf::TryEval()
@@ -584,6 +845,7 @@ void StrLeaf::AddTypeCvt()
 IfStatement::IfStatement()
 {
     type = NodeType::IfSt;
+    Typify();
 }
 
 void IfStatement::DebugPrint(size_t d)
@@ -602,13 +864,19 @@ void IfStatement::DebugPrint(size_t d)
     }
 }
 
-Keyword IfStatement::GetTypeKW()
+void IfStatement::Typify()
 {
-    return Keyword::Last;
+    res_type = Keyword::Last;
 }
 
 ASTNode* IfStatement::TryEval()
 {
+    condition = condition->TryEval();
+    then_b->TryEval();
+    if (else_b)
+    {
+        else_b->TryEval();
+    }
     return this;
 }
 
@@ -630,6 +898,7 @@ void IfStatement::AddTypeCvt()
 WhileLoop::WhileLoop()
 {
     type = NodeType::WhileLoop;
+    Typify();
 }
 
 void WhileLoop::DebugPrint(size_t d)
@@ -642,13 +911,15 @@ void WhileLoop::DebugPrint(size_t d)
     body->DebugPrint(d + 1);
 }
 
-Keyword WhileLoop::GetTypeKW()
+void WhileLoop::Typify()
 {
-    return Keyword::Last;
+    res_type = Keyword::Last;
 }
 
 ASTNode* WhileLoop::TryEval()
 {
+    condition = condition->TryEval();
+    body->TryEval();
     return this;
 }
 
@@ -672,6 +943,7 @@ Convert::Convert(Keyword t)
 {
     type = NodeType::Cvt;
     to = t;
+    Typify();
 }
 
 Convert::Convert(ASTNode* v, Keyword t)
@@ -679,6 +951,7 @@ Convert::Convert(ASTNode* v, Keyword t)
     type = NodeType::Cvt;
     to = t;
     value = v;
+    Typify();
 }
 
 bool Convert::isConstEval()
@@ -696,12 +969,20 @@ void Convert::DebugPrint(size_t d)
 ASTNode* Convert::TryEval()
 {
     value = value->TryEval();
+    if (value->type == NodeType::ConstLeaf)
+    {
+        ConstLeaf* c = CastConst((ConstLeaf*)value, to);
+        if (c)
+        {
+            return c;
+        }
+    }
     return this;
 }
 
-Keyword Convert::GetTypeKW()
+void Convert::Typify()
 {
-    return to;
+    res_type = to;
 }
 
 void Convert::AddTypeCvt()
@@ -718,6 +999,7 @@ ArrayLeaf::ArrayLeaf(Var* a, ASTNode* i)
     arr = new VarLeaf(a);
     idx = i;
     type = NodeType::ArrayLeaf;
+    Typify();
 }
 
 void ArrayLeaf::DebugPrint(size_t d)
@@ -732,14 +1014,13 @@ void ArrayLeaf::DebugPrint(size_t d)
 
 ASTNode* ArrayLeaf::TryEval()
 {
-    idx->TryEval();
-    arr->TryEval();
+    idx = idx->TryEval();
     return this;
 }
 
-Keyword ArrayLeaf::GetTypeKW()
+void ArrayLeaf::Typify()
 {
-    return arr->GetTypeKW();
+    res_type = arr->GetTypeKW();
 }
 
 void ArrayLeaf::AddTypeCvt()
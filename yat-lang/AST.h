@@ -16,6 +16,7 @@
 //
 #pragma once
 #include "Tokens.h"
+#include <cstddef>
 #include <vector>
 #include <functional>
 
@@ -52,14 +53,81 @@ enum class NodeType
     WhileLoop
 };
 
+class ASTNode;
+
+// Owns the memory of AST nodes. Nodes are placed one after another in big
+// blocks, so the nodes parsed together (e.g. of one function) sit next to each
+// other, and all of them are destroyed and freed together with the arena.
+// `new` of any node takes memory from the arena made current by NodeArena::Use,
+// without one the nodes come from the heap and are never freed. A node deleted
+// before its arena is only marked dead, its memory is reclaimed with the arena.
+class NodeArena
+{
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    // placed before every node, arena is null for the nodes from the heap
+    struct alignas(std::max_align_t) Header
+    {
+        NodeArena* arena;
+        // index in m_nodes
+        size_t index;
+    };
+
+    std::vector<char*> m_blocks;
+    char* m_cur = nullptr;
+    size_t m_left = 0;
+    // all nodes in the order of allocation, null for the dead ones
+    std::vector<ASTNode*> m_nodes;
+
+    static thread_local NodeArena* s_current;
+
+    void* Alloc(size_t n);
+
+public:
+    NodeArena() = default;
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+    ~NodeArena();
+
+    // memory of a node, from the current arena if there is one
+    static void* New(size_t n);
+    // the destructor of the node has run already
+    static void Delete(void* p);
+
+    static NodeArena* Current();
+
+    // the arena is current while this object lives
+    class Use
+    {
+        NodeArena* m_prev;
+    public:
+        Use(NodeArena& a);
+        Use(const Use&) = delete;
+        Use& operator=(const Use&) = delete;
+        ~Use();
+    };
+};
+
 class ASTNode
 {
 public:
     NodeType type = NodeType::None;
+    virtual ~ASTNode() = default;
+    static void* operator new(size_t n);
+    static void operator delete(void* p);
     virtual bool isConstEval();
     virtual void DebugPrint(size_t d) = 0;
     virtual ASTNode* TryEval() = 0;
-    virtual Keyword GetTypeKW() = 0;
+    // type of the node's value, cached by Typify
+    Keyword res_type = Keyword::Last;
+    Keyword GetTypeKW() const
+    {
+        return res_type;
+    }
+    // sets res_type from the node's data and the cached types of its children,
+    // so a tree is typed bottom-up with one call per node; nodes built at once
+    // are typed by their constructors, the others by the code which builds them
+    virtual void Typify() = 0;
     virtual void AddTypeCvt() = 0;
 };
 
@@ -74,7 +142,7 @@ public:
     virtual bool isConstEval();
     virtual void DebugPrint(size_t d);
     virtual ASTNode* TryEval();
-    virtual Keyword GetTypeKW();
+    virtual void Typify();
     virtual void AddTypeCvt();
 };
 
@@ -95,7 +163,7 @@ public:
     uint8_t flags = 0;
 
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     int64_t GetSize();
     int64_t GetStart();
@@ -120,10 +188,12 @@ public:
     Token data;
     ConstLeaf(const Token& data);
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual bool isConstEval();
     GetNumRes GetNumber();
+    // the value sign- or zero-extended to 64 bits by its type
+    int64_t GetInt();
     virtual void AddTypeCvt();
 };
 
@@ -133,7 +203,7 @@ public:
     Token data;
     StrLeaf(const Token& data);
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual bool isConstEval();
     virtual void AddTypeCvt();
@@ -147,7 +217,7 @@ public:
     Token oper;
     UnOp();
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual bool isConstEval();
     virtual void AddTypeCvt();
@@ -162,7 +232,7 @@ public:
     Token oper;
     BinOp();
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual bool isConstEval();
     virtual void AddTypeCvt();
@@ -177,7 +247,7 @@ public:
     std::vector<ASTNode*> children;
     bool is_fn = false;
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual void AddTypeCvt();
 };
@@ -191,8 +261,21 @@ public:
     StatementBlock* def = nullptr;
     std::vector<Var*> params;
     Keyword ret_type{};
+    // asked by #!(inline)! or #!(noinline)! before the function
+    enum class InlineHint : uint8_t
+    {
+        none,
+        always,
+        never
+    } inline_hint = InlineHint::none;
+    // label of the code if the function is called directly,
+    // not through the variable it is bound to
+    Symbol label = NoSymbol;
+    // TRUE if the body has inline assembly (or there is no body), nested
+    // functions aside
+    bool HasAsm() const;
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual void AddTypeCvt();
 };
@@ -206,7 +289,7 @@ public:
     std::vector<ASTNode*> params;
     virtual void DebugPrint(size_t d) override;
     // TODO: func may be nullptr
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual void AddTypeCvt();
 };
@@ -218,14 +301,22 @@ public:
     Var();
     Var(String n, Keyword t, bool m = false, Range* a = nullptr);
     String name;
+    // symbol of the name, variables are looked up by it
+    Symbol sym = NoSymbol;
     Keyword var_type = Keyword::Last;
     std::vector<Keyword> type_params;
     bool mut = false, is_arr = false, is_param = false;
     Range* arr = nullptr;
     ASTNode* initial = nullptr;
+    // the variable is changed after its declaration, found by constant propagation
+    bool changed = false;
+    // value known at compile time, every use of the variable is replaced by it
+    ConstLeaf* value = nullptr;
 
+    // the function if the variable is an immutable binding which is called directly
+    Lambda* DirectFn();
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual void AddTypeCvt();
 };
@@ -237,7 +328,7 @@ public:
     Var* data{};
     VarLeaf(Var* data);
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual bool isConstEval();
     virtual void AddTypeCvt();
@@ -252,7 +343,7 @@ public:
     StatementBlock* else_b{};
     IfStatement();
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual bool isConstEval();
     virtual void AddTypeCvt();
@@ -266,7 +357,7 @@ public:
     StatementBlock* body{};
     WhileLoop();
     virtual void DebugPrint(size_t d) override;
-    virtual Keyword GetTypeKW() override;
+    virtual void Typify() override;
     virtual ASTNode* TryEval() override;
     virtual bool isConstEval();
     virtual void AddTypeCvt();
@@ -282,7 +373,7 @@ public:
 
     virtual void DebugPrint(size_t d);
     virtual ASTNode* TryEval();
-    virtual Keyword GetTypeKW();
+    virtual void Typify();
     virtual void AddTypeCvt();
 };
 
@@ -290,8 +381,9 @@ class Namespace
 {
 public:
     String name;
+    Symbol sym = NoSymbol;
     // all using statements
-    std::vector<String> uses;
+    std::vector<Symbol> uses;
     // block of all statements of the namespace
     StatementBlock* block;
     void DebugPrint(size_t d);
@@ -300,9 +392,16 @@ public:
 class AST
 {
 public:
+    // memory of all nodes of the program,
+    // it must be made current while parsing and generating code
+    NodeArena nodes;
     // The whole program
     // Vector contains all namespaces
     std::vector<Namespace*> prog;
+    AST() = default;
+    AST(const AST&) = delete;
+    AST& operator=(const AST&) = delete;
+    ~AST();
     void DebugPrint();
 };
 
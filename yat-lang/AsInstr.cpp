@@ -24,6 +24,8 @@ const String AsInstr::SuffixStr[]{
     L"ng",  L"nl", L"ne",
     L"nge", L"nle",
     L"z",   L"s",
+    L"b",   L"a",
+    L"be",  L"ae",
     L""
 };
 
@@ -53,6 +55,8 @@ const String AsInstr::InstrStr[]{
     L"not",
     L"xor",
     L"neg",
+    L"sar",
+    L"set",
     L""
 };
 
@@ -95,18 +99,24 @@ AsInstr::Instr TTypeToInstr(TokenType type, bool sign)
     }
 }
 
-AsInstr::AsInstr(const String& inl, bool lab)
+AsInstr::AsInstr(const String& inl)
 {
-    l1 = inl;
+    text = inl;
     instr = Instr::Last;
-    isLabel = lab;
+}
+
+AsInstr::AsInstr(Symbol label)
+{
+    l1 = label;
+    instr = Instr::Last;
+    isLabel = true;
 }
 
 String AsInstr::GenText(int opt)
 {
     if (instr == Instr::Last)
     {
-        return l1;
+        return isLabel ? String(SymbolText(l1)) : text;
     }
 
     String res = L"";
@@ -129,7 +139,7 @@ String AsInstr::GenText(int opt)
         switch (oper1)
         {
         case AsInstr::Operands::Addr:
-            res += l1;
+            res += SymbolText(l1);
             res += L"(, ";
             res += L"%";
             res += RegisterStr[(size_t)reg1];
@@ -148,11 +158,11 @@ String AsInstr::GenText(int opt)
             res += L")";
             break;
         case AsInstr::Operands::Label:
-            res += l1;
+            res += SymbolText(l1);
             break;
         case AsInstr::Operands::Const:
             res += L"$";
-            res += l1;
+            res += SymbolText(l1);
             break;
         }
     }
@@ -163,7 +173,7 @@ String AsInstr::GenText(int opt)
         {
         case AsInstr::Operands::Addr:
             res += L", ";
-            res += l2;
+            res += SymbolText(l2);
             res += L"(, ";
             res += L"%";
             res += RegisterStr[(size_t)reg2];
@@ -184,12 +194,12 @@ String AsInstr::GenText(int opt)
             break;
         case AsInstr::Operands::Label:
             res += L", ";
-            res += l2;
+            res += SymbolText(l2);
             break;
         case AsInstr::Operands::Const:
             res += L", ";
             res += L"$";
-            res += l2;
+            res += SymbolText(l2);
             break;
         }
     }
@@ -231,3 +241,109 @@ void AsInstr::SwapOperands()
     std::swap(mem1, mem2);
 }
 
+
+String ExpandAsm(std::wstring_view inl, const std::function<int64_t(const String& name)>& lvar)
+{
+    std::wstringstream asm_res;
+
+    wchar_t c = 0;
+    for (size_t i = 0; i < inl.length(); ++i)
+    {
+        c = inl[i];
+        if (c == L'@')
+        {
+            c = inl[++i];
+            String cmd;
+            while (IsAlpha(c))
+            {
+                cmd += c;
+                c = inl[++i];
+            }
+
+            if (cmd == L"LVAR")
+            {
+                if (inl[i++] != L'(')
+                {
+                    throw Error(L"Invalid inline assembly macro LVAR\n");
+                }
+
+                cmd = L"";
+                c = inl[i];
+                while (c != L')')
+                {
+                    cmd += c;
+                    c = inl[++i];
+                }
+                AsInstr addr;
+                addr.mem1 = lvar(cmd);
+                addr.oper1 = AsInstr::Operands::Stack;
+                asm_res << addr.GenText(1);
+            }
+        }
+        else
+        {
+            asm_res << c;
+        }
+    }
+
+    return asm_res.str();
+}
+
+static AsInstr RegMove(Register from, Register to)
+{
+    AsInstr in;
+    in.instr = AsInstr::Instr::as_mov;
+    in.SetSizeSuffix(8);
+    in.oper1 = in.oper2 = AsInstr::Operands::Reg;
+    in.reg1 = from;
+    in.reg2 = to;
+    return in;
+}
+
+void ParallelMove(std::vector<std::pair<Register, Register>> moves, Register scratch, std::vector<AsInstr>& res)
+{
+    for (auto& m : moves)
+    {
+        m.first = CvtReg(m.first, 8);
+        m.second = CvtReg(m.second, 8);
+    }
+
+    while (!moves.empty())
+    {
+        // a move whose target no other move reads
+        size_t i = 0;
+        for (; i < moves.size(); ++i)
+        {
+            bool read = false;
+            for (size_t j = 0; j < moves.size(); ++j)
+            {
+                read = read || (j != i && moves[j].first == moves[i].second);
+            }
+            if (!read)
+            {
+                break;
+            }
+        }
+
+        if (i == moves.size())
+        {
+            // every target is read by another move, one source is kept aside
+            res.push_back(RegMove(moves[0].first, scratch));
+            for (size_t j = 1; j < moves.size(); ++j)
+            {
+                if (moves[j].first == moves[0].first)
+                {
+                    moves[j].first = scratch;
+                }
+            }
+            moves[0].first = scratch;
+            continue;
+        }
+
+        if (moves[i].first != moves[i].second)
+        {
+            res.push_back(RegMove(moves[i].first, moves[i].second));
+        }
+        moves.erase(moves.begin() + i);
+    }
+}
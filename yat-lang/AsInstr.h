@@ -18,6 +18,7 @@
 #include "Utils.h"
 #include "Register.h"
 #include "Tokens.h"
+#include <functional>
 // assembly instruction
 struct AsInstr
 {
@@ -43,6 +44,11 @@ struct AsInstr
         x_z,   // zero extend
         x_s,   // signed extend
 
+        c_b,   // below (unsigned less)
+        c_a,   // above (unsigned greater)
+        c_be,  // below or equal
+        c_ae,  // above or equal
+
         Last
     } suf = InstrSuffix::Last, suf0 = InstrSuffix::Last, suf1 = InstrSuffix::Last;
 
@@ -76,6 +82,8 @@ struct AsInstr
         as_not,
         as_xor,
         as_neg,
+        as_sar,  // arithmetic shift right
+        as_set,  // set a byte by the condition (use with generated suffixes)
         Last
     } instr = Instr::as_nop;
 
@@ -94,11 +102,15 @@ struct AsInstr
 
     Register reg1{}, reg2{}, stackReg = Register::rbp;
     int64_t mem1{}, mem2{};
-    String l1, l2;
+    // labels and constants of the operands, or the label itself
+    Symbol l1 = NoSymbol, l2 = NoSymbol;
+    // instruction written as it is
+    String text;
     bool isLabel = false;
 
     AsInstr() = default;
-    AsInstr(const String& inl, bool lab = false);
+    AsInstr(const String& inl);
+    AsInstr(Symbol label);
 
     // opt = 0: entire instruction
     // opt = 1: oper1
@@ -110,3 +122,11 @@ struct AsInstr
 
 AsInstr::Instr TTypeToInstr(TokenType type, bool sign = true);
 
+// text of inline assembly with its macros expanded: @LVAR(name) is replaced
+// by the operand at the offset from %rbp `lvar` returns for the local variable
+String ExpandAsm(std::wstring_view text, const std::function<int64_t(const String& name)>& lvar);
+
+// 64-bit moves between registers (from, to) as if they were done at once:
+// no register is written before it is read, cycles go through the scratch
+void ParallelMove(std::vector<std::pair<Register, Register>> moves, Register scratch, std::vector<AsInstr>& res);
+
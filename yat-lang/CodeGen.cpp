@@ -17,12 +17,15 @@
 #include "CodeGen.h"
 #include <algorithm>
 #include "ErrorChecking.h"
+#include "IRBuilder.h"
+#include "IRLowering.h"
+#include "Mem2Reg.h"
 
-inline Register CodeGen::TryAllocRegister(bool fp, size_t bytes)
+inline Register CodeGen::TryAllocRegister(bool fp, size_t bytes, std::vector<AsInstr>& res)
 {
     if (!fp)
     {
-        if (RegisterState.RegB)
+        if (RegisterState.RegB && !has_asm)
         {
             RegisterState.RegB = false;
             switch (bytes)
@@ -36,9 +39,12 @@ inline Register CodeGen::TryAllocRegister(bool fp, size_t bytes)
             }
         }
 
-        for (int i = 0; i < 8; ++i)
+        // r12 - r15 first, the calls keep them (the ones in use are stored around
+        // calls which may reach inline assembly), inline assembly may return
+        // without their restores, so its function gets only r8 - r11
+        for (int i : { 4, 5, 6, 7, 2, 3, 0, 1 })
         {
-            if (RegisterState.RegRx[i])
+            if (RegisterState.RegRx[i] && !(has_asm && i >= 4))
             {
                 RegisterState.RegRx[i] = false;
 
@@ -66,7 +72,48 @@ inline Register CodeGen::TryAllocRegister(bool fp, size_t bytes)
         }
     }
 
-    return Register::Last;
+    if (fp)
+    {
+        return Register::Last;
+    }
+
+    // out of registers: the oldest result waiting in one of them goes to the frame
+    for (VisitRes* p : pending)
+    {
+        Register r = CvtReg(p->rData, 8);
+        if (p->type != VisitRes::reg || !(r == Register::rbx || (r >= Register::r8 && r <= Register::r15)))
+        {
+            continue;
+        }
+
+        locals[locals.size() - 1].stack_offset -= 8;
+        LocalVar slot;
+        slot.offset = locals[locals.size() - 1].stack_offset;
+        res.push_back(MakeMov(r, slot, 8));
+        *p = VisitRes(slot);
+        return TryAllocRegister(fp, bytes, res);
+    }
+    throw Error(L"Compiler Error: out of registers\n");
+}
+
+// the callee-saved register the register is part of, or Register::Last
+static Register CalleeSavedOf(Register r)
+{
+    switch (r)
+    {
+    case Register::bl: case Register::bx: case Register::ebx: case Register::rbx:
+        return Register::rbx;
+    case Register::r12b: case Register::r12w: case Register::r12d: case Register::r12:
+        return Register::r12;
+    case Register::r13b: case Register::r13w: case Register::r13d: case Register::r13:
+        return Register::r13;
+    case Register::r14b: case Register::r14w: case Register::r14d: case Register::r14:
+        return Register::r14;
+    case Register::r15b: case Register::r15w: case Register::r15d: case Register::r15:
+        return Register::r15;
+    default:
+        return Register::Last;
+    }
 }
 
 inline void CodeGen::FreeRegister(Register r)
@@ -155,10 +202,58 @@ inline void CodeGen::FreeRegister(Register r)
     }
 }
 
-String CodeGen::GenLabel()
+std::vector<Register> CodeGen::CalleeSavedInUse() const
+{
+    std::vector<Register> res;
+    if (!RegisterState.RegB)
+    {
+        res.push_back(Register::rbx);
+    }
+    for (int i = 4; i < 8; ++i)
+    {
+        if (!RegisterState.RegRx[i])
+        {
+            res.push_back((Register)((int)Register::r8 + i));
+        }
+    }
+    return res;
+}
+
+std::vector<Register> CodeGen::CallerSavedInUse() const
+{
+    std::vector<Register> res;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!RegisterState.RegRx[i])
+        {
+            res.push_back((Register)((int)Register::r8 + i));
+        }
+    }
+    return res;
+}
+
+Symbol CodeGen::GenLabel()
 {
     static size_t count = 0;
-    return L".L" + std::to_wstring(count++);
+    return InternSymbol(L".L" + std::to_wstring(count++));
+}
+
+std::vector<Register> CodeGen::ArgRegisters(const std::vector<Keyword>& types)
+{
+    std::vector<Register> res;
+    size_t ints = 0, floats = 0;
+    for (Keyword t : types)
+    {
+        if (t == Keyword::kw_f32 || t == Keyword::kw_f64)
+        {
+            res.push_back(floats < std::size(FloatArgRegs) ? FloatArgRegs[floats++] : Register::Last);
+        }
+        else
+        {
+            res.push_back(ints < std::size(IntArgRegs) ? IntArgRegs[ints++] : Register::Last);
+        }
+    }
+    return res;
 }
 
 CodeGen::LocalVar CodeGen::GetLocal(Var* v)
@@ -167,7 +262,7 @@ CodeGen::LocalVar CodeGen::GetLocal(Var* v)
     {
         for (LocalVar& loc : f.vars)
         {
-            if (loc.data == v || loc.data->name == v->name)
+            if (loc.data == v || loc.data->sym == v->sym)
             {
                 return loc;
             }
@@ -201,7 +296,7 @@ inline void CodeGen::SolveCondition(ASTNode* cond, std::vector<AsInstr>& res, co
 
     if (op->oper.type == TokenType::OperLAnd)
     {
-        AsInstr next_l(GenLabel(), true);
+        AsInstr next_l(GenLabel());
         SolveCondition(op->r, res, next_l, jumpf);
         res.push_back(next_l);
         SolveCondition(op->l, res, jumpt, jumpf);
@@ -210,7 +305,7 @@ inline void CodeGen::SolveCondition(ASTNode* cond, std::vector<AsInstr>& res, co
 
     if (op->oper.type == TokenType::OperLOr)
     {
-        AsInstr next_l(GenLabel(), true);
+        AsInstr next_l(GenLabel());
         SolveCondition(op->r, res, jumpt, next_l);
         res.push_back(next_l);
         SolveCondition(op->l, res, jumpt, jumpf);
@@ -277,13 +372,13 @@ inline AsInstr CodeGen::MakeMov(const VisitRes& from, const VisitRes& to, const
             mov_in.instr = AsInstr::Instr::as_lea;
         }
         mov_in.oper1 = AsInstr::Operands::Label;
-        mov_in.l1 = from.gData->name;
+        mov_in.l1 = from.gData->sym;
         break;
     }
     case VisitRes::arr:
     {
         mov_in.oper1 = AsInstr::Operands::Addr;
-        mov_in.l1 = from.aData->gData->name;
+        mov_in.l1 = from.aData->gData->sym;
         mov_in.reg1 = from.iData->rData;
         mov_in.mem1 = op_size;
         break;
@@ -312,7 +407,7 @@ inline AsInstr CodeGen::MakeMov(const VisitRes& from, const VisitRes& to, const
     case VisitRes::cnst:
     {
         mov_in.oper1 = AsInstr::Operands::Const;
-        mov_in.l1 = from.cData->data.data;
+        mov_in.l1 = InternSymbol(from.cData->data.GetText());
         break;
     }
     }
@@ -322,13 +417,13 @@ inline AsInstr CodeGen::MakeMov(const VisitRes& from, const VisitRes& to, const
     case VisitRes::glob:
     {
         mov_in.oper2 = AsInstr::Operands::Label;
-        mov_in.l2 = to.gData->name;
+        mov_in.l2 = to.gData->sym;
         break;
     }
     case VisitRes::arr:
     {
         mov_in.oper2 = AsInstr::Operands::Addr;
-        mov_in.l2 = to.aData->gData->name;
+        mov_in.l2 = to.aData->gData->sym;
         mov_in.reg2 = to.iData->rData;
         mov_in.mem2 = op_size;
         break;
@@ -360,7 +455,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     {
         Convert* cvt = (Convert*)node;
         VisitRes vr = VisitNode(cvt->value, glob, res);
-        Register temp = TryAllocRegister(false, GetTypeSize(cvt->value->GetTypeKW()));
+        Register temp = TryAllocRegister(false, GetTypeSize(cvt->value->GetTypeKW()), res);
 
         AsInstr mov_in = MakeMov(vr, temp, GetTypeSize(cvt->value->GetTypeKW()));
 
@@ -399,7 +494,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         }
 
         inst.oper2 = AsInstr::Operands::Reg;
-        inst.reg2 = TryAllocRegister(false, GetTypeSize(cvt->GetTypeKW()));
+        inst.reg2 = TryAllocRegister(false, GetTypeSize(cvt->GetTypeKW()), res);
 
         FreeRegister(temp);
 
@@ -411,10 +506,10 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     case NodeType::WhileLoop:
     {
         WhileLoop* lp = (WhileLoop*)node;
-        AsInstr start_l(GenLabel(), true), end_l(GenLabel(), true), endc_l(GenLabel(), true);
+        AsInstr start_l(GenLabel()), end_l(GenLabel()), endc_l(GenLabel());
         start_l.isLabel = end_l.isLabel = true;
 
-        res.push_back(AsInstr(L"#while start\n", false));
+        res.push_back(AsInstr(L"#while start\n"));
         res.push_back(start_l);
 
         // m_cond = true;
@@ -433,7 +528,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         jmp_start.oper1 = AsInstr::Operands::Label;
         res.push_back(jmp_start);
 
-        res.push_back(AsInstr(L"#while end\n", false));
+        res.push_back(AsInstr(L"#while end\n"));
         res.push_back(end_l);
 
         break;
@@ -442,7 +537,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     {
         IfStatement* is = (IfStatement*)node;
 
-        AsInstr end_then(GenLabel(), true), s_then(GenLabel(), true);
+        AsInstr end_then(GenLabel()), s_then(GenLabel());
         end_then.isLabel = true;
 
         // m_cond = true;
@@ -457,7 +552,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
 
         if (is->else_b)
         {
-            String end_else = GenLabel();
+            Symbol end_else = GenLabel();
 
             AsInstr cj;
             cj.suf = AsInstr::InstrSuffix::Last;
@@ -472,7 +567,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
 
             VisitBlock(is->else_b, false, res);
 
-            res.push_back(AsInstr(end_else, true));
+            res.push_back(AsInstr(end_else));
             res.push_back(AsInstr(L"#if-else end\n"));
         }
         else
@@ -487,88 +582,151 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     {
         FnCall* v = (FnCall*)node;
 
-        int64_t param_bytes = 0;
-
-        // push all parameters in reversed order
-        for (auto iter = v->params.crbegin(); iter != v->params.crend(); ++iter)
+        std::vector<Keyword> types;
+        for (ASTNode* param : v->params)
+        {
+            types.push_back(param->GetTypeKW());
+        }
+        std::vector<Register> arg_regs = ArgRegisters(types);
+
+        // the arguments are computed from the first to the last into the registers
+        // of TryAllocRegister, which the calls among them keep (see `kept' below),
+        // constants and functions are written when all are computed
+        std::vector<VisitRes> args;
+        args.reserve(v->params.size());
+        for (ASTNode* param : v->params)
         {
-            ASTNode* param = *iter;
             VisitRes vr = VisitNode(param, false, res);
-
-            param_bytes += GetTypeSize(param->GetTypeKW());
-
-            AsInstr mov_in;
-            mov_in.instr = AsInstr::Instr::as_mov;
-            mov_in.SetSizeSuffix(GetTypeSize(param->GetTypeKW()));
-
-            mov_in.oper2 = AsInstr::Operands::Reg;
-            mov_in.reg2 = TryAllocRegister(false, GetTypeSize(param->GetTypeKW()));
-
-            AsInstr push_in;
-            push_in.SetSizeSuffix(GetTypeSize(param->GetTypeKW()));
-            push_in.instr = AsInstr::Instr::as_mov;
-            push_in.oper1 = AsInstr::Operands::Reg;
-            push_in.reg1 = mov_in.reg2;
-
-            push_in.mem2 = -param_bytes;
-            push_in.stackReg = Register::rsp;
-            push_in.oper2 = AsInstr::Operands::Stack;
-
-            switch (vr.type)
-            {
-            case VisitRes::glob:
+            size_t size = GetTypeSize(param->GetTypeKW());
+            bool scratch = vr.type == VisitRes::reg && (CvtReg(vr.rData, 8) == Register::rax
+                || CvtReg(vr.rData, 8) == Register::rcx || CvtReg(vr.rData, 8) == Register::rdx);
+            if (scratch || (vr.type != VisitRes::reg && vr.type != VisitRes::cnst && vr.type != VisitRes::func))
             {
-                if (vr.gData->var_type == Keyword::kw_str16)
+                Register temp = TryAllocRegister(false, size, res);
+                res.push_back(MakeMov(vr, temp, size));
+                if (vr.type == VisitRes::arr)
                 {
-                    mov_in.instr = AsInstr::Instr::as_lea;
+                    FreeRegister(vr.iData->rData);
                 }
-                mov_in.oper1 = AsInstr::Operands::Label;
-                mov_in.l1 = vr.gData->name;
-                break;
+                vr = VisitRes(temp);
             }
-            case VisitRes::loc:
+            args.push_back(vr);
+            pending.push_back(&args.back());
+        }
+        pending.resize(pending.size() - args.size());
+
+        // registers of the arguments are written by the moves, the other ones
+        // the callee may change are kept in the frame: the callee-saved ones too
+        // if the callee is unknown or has inline assembly, which may return
+        // without restoring them
+        std::vector<Register> kept = CallerSavedInUse();
+        if (!v->func || v->func->HasAsm())
+        {
+            std::vector<Register> callee = CalleeSavedInUse();
+            kept.insert(kept.end(), callee.begin(), callee.end());
+        }
+        for (const VisitRes& vr : args)
+        {
+            if (vr.type == VisitRes::reg)
             {
-                mov_in.oper1 = AsInstr::Operands::Stack;
-                mov_in.mem1 = vr.lData.offset;
-                break;
+                kept.erase(std::remove(kept.begin(), kept.end(), CvtReg(vr.rData, 8)), kept.end());
             }
-            case VisitRes::reg:
+        }
+        std::vector<int64_t> kept_at;
+        for (Register r : kept)
+        {
+            locals[locals.size() - 1].stack_offset -= 8;
+            kept_at.push_back(locals[locals.size() - 1].stack_offset);
+            AsInstr save;
+            save.instr = AsInstr::Instr::as_mov;
+            save.SetSizeSuffix(8);
+            save.oper1 = AsInstr::Operands::Reg;
+            save.reg1 = r;
+            save.oper2 = AsInstr::Operands::Stack;
+            save.mem2 = kept_at.back();
+            res.push_back(save);
+        }
+
+        // arguments on the stack and in xmm registers go through rax,
+        // then the general-purpose registers are written at once
+        int64_t stack_bytes = 0;
+        std::vector<std::pair<Register, Register>> moves;
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            size_t size = GetTypeSize(types[i]);
+            Register to = arg_regs[i];
+            if (to != Register::Last && to < Register::xmm0)
             {
-                FreeRegister(vr.rData);
-                mov_in.oper1 = AsInstr::Operands::Reg;
-                mov_in.reg1 = vr.rData;
-                break;
+                if (args[i].type == VisitRes::reg)
+                {
+                    moves.emplace_back(args[i].rData, to);
+                    FreeRegister(args[i].rData);
+                }
+                continue;
             }
-            case VisitRes::func:
+
+            Register from = Register::Last;
+            if (args[i].type == VisitRes::reg)
             {
-                // change instruction to 'lea' cause we want pointer to be copied
-                mov_in.instr = AsInstr::Instr::as_lea;
-                mov_in.oper1 = AsInstr::Operands::Label;
-                mov_in.l1 = vr.fData;
-                break;
+                from = args[i].rData;
+                FreeRegister(from);
             }
-            case VisitRes::cnst:
+            else
             {
-                mov_in.oper1 = AsInstr::Operands::Const;
-                mov_in.l1 = vr.cData->data.data;
-                break;
-            }
+                from = CvtReg(Register::rax, size);
+                res.push_back(MakeMov(args[i], from, size));
             }
 
-            res.push_back(mov_in);
-            res.push_back(push_in);
-            FreeRegister(mov_in.reg2);
+            if (to == Register::Last)
+            {
+                AsInstr store;
+                store.instr = AsInstr::Instr::as_mov;
+                store.SetSizeSuffix(size);
+                store.oper1 = AsInstr::Operands::Reg;
+                store.reg1 = from;
+                store.oper2 = AsInstr::Operands::Stack;
+                store.stackReg = Register::rsp;
+                store.mem2 = stack_bytes;
+                res.push_back(store);
+                stack_bytes += 8;
+            }
+            else
+            {
+                res.push_back(AsInstr((size == 4 ? L"movd      %" : L"movq      %")
+                    + RegisterStr[(int)CvtReg(from, size == 4 ? 4 : 8)] + L", %" + RegisterStr[(int)to] + L"\n"));
+            }
         }
+        out_bytes = std::max(out_bytes, stack_bytes);
 
-        String instr = v->FnName.data;
+        ParallelMove(moves, Register::rax, res);
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            if (arg_regs[i] != Register::Last && arg_regs[i] < Register::xmm0 && args[i].type != VisitRes::reg)
+            {
+                size_t size = GetTypeSize(types[i]);
+                res.push_back(MakeMov(args[i], CvtReg(arg_regs[i], size), size));
+            }
+        }
 
-        res.push_back(L"subq      $" + std::to_wstring(param_bytes) + L", %rsp\n");
+        String instr = String(v->FnName.GetText());
 
-        AsInstr call_in(L"call      *(" + instr + L")\n");
+        AsInstr call_in(v->func && v->func->label != NoSymbol
+            ? L"call      " + String(SymbolText(v->func->label)) + L"\n"
+            : L"call      *(" + instr + L")\n");
 
         res.push_back(call_in);
 
-        res.push_back(L"addq      $" + std::to_wstring(param_bytes) + L", %rsp\n");
+        for (size_t i = 0; i < kept.size(); ++i)
+        {
+            AsInstr restore;
+            restore.instr = AsInstr::Instr::as_mov;
+            restore.SetSizeSuffix(8);
+            restore.oper1 = AsInstr::Operands::Stack;
+            restore.mem1 = kept_at[i];
+            restore.oper2 = AsInstr::Operands::Reg;
+            restore.reg2 = kept[i];
+            res.push_back(restore);
+        }
 
         if (v->func->ret_type != Keyword::kw_null)
         {
@@ -576,7 +734,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
             switch (GetTypeSize(v->func->ret_type))
             {
             case 1:
-                ret_r = Register::ah;
+                ret_r = Register::al;
                 break;
             case 2:
                 ret_r = Register::ax;
@@ -595,10 +753,10 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     }
     case NodeType::String:
     {
-        String label = GenLabel();
-        Var* v = new Var(label, Keyword::kw_str16);
+        Symbol label = GenLabel();
+        Var* v = new Var(String(SymbolText(label)), Keyword::kw_str16);
 
-        strings.push_back(std::make_pair(label, ((StrLeaf*)node)->data.data));
+        strings.push_back(std::make_pair(label, String(((StrLeaf*)node)->data.GetText())));
 
         return VisitRes(v);
     }
@@ -609,6 +767,14 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     case NodeType::Var:
     {
         Var* v = (Var*)node;
+        // the code of a direct function is written under its name,
+        // there is no variable to keep the pointer in
+        if (glob && v->DirectFn())
+        {
+            VisitNode(v->initial, glob, res);
+            return VisitRes();
+        }
+
         if (glob)
         {
             globals.push_back(v);
@@ -623,7 +789,8 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
             BinOp* init_op = new BinOp();
             init_op->l = new VarLeaf(v);
             init_op->r = v->initial;
-            init_op->oper = Token(L"=", TokenType::Assign, 0, 0, 0);
+            init_op->oper = Token(L"=", TokenType::Assign, 0, 0);
+            init_op->Typify();
 
             VisitRes ivr = VisitNode(init_op, glob, res);
             if (ivr.type == VisitRes::reg)
@@ -637,6 +804,11 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     case NodeType::VarLeaf:
     {
         VarLeaf* v = (VarLeaf*)node;
+        if (Lambda* fn = v->data->DirectFn())
+        {
+            return VisitRes(fn->label);
+        }
+
         LocalVar lv = GetLocal(v->data);
 
         if (lv.data)
@@ -656,51 +828,9 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
             if (op->oper.kw_type == Keyword::kw_asm)
             {
                 ConstLeaf* asm_text = (ConstLeaf*)op->operand;
-                const String& inl = asm_text->data.data;
-                std::wstringstream asm_res;
-
-                wchar_t c = 0;
-                for (size_t i = 0; i < inl.length(); ++i)
-                {
-                    c = inl[i];
-                    if (c == L'@')
-                    {
-                        c = inl[++i];
-                        String cmd;
-                        while (IsAlpha(c))
-                        {
-                            cmd += c;
-                            c = inl[++i];
-                        }
-
-                        if (cmd == L"LVAR")
-                        {
-                            if (inl[i++] != L'(')
-                            {
-                                throw Error(L"Invalid inline assembly macro LVAR\n");
-                            }
-
-                            cmd = L"";
-                            c = inl[i];
-                            while (c != L')')
-                            {
-                                cmd += c;
-                                c = inl[++i];
-                            }
-                            auto var = GetLocal(new Var(cmd, Keyword::Last));
-                            AsInstr addr;
-                            addr.mem1 = var.offset;
-                            addr.oper1 = AsInstr::Operands::Stack;
-                            asm_res << addr.GenText(1);
-                        }
-                    }
-                    else
-                    {
-                        asm_res << c;
-                    }
-                }
-
-                res.push_back(AsInstr(asm_res.str()));
+                res.push_back(AsInstr(ExpandAsm(asm_text->data.GetText(), [this](const String& name) {
+                    return GetLocal(new Var(name, Keyword::Last)).offset;
+                })));
                 return VisitRes();
             }
 
@@ -713,7 +843,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
                 switch (GetTypeSize(op->GetTypeKW()))
                 {
                 case 1:
-                    reg = Register::ah;
+                    reg = Register::al;
                     break;
                 case 2:
                     reg = Register::ax;
@@ -744,7 +874,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         case TokenType::OperDec: // decrement
         {
             uint64_t size = GetTypeSize(op->GetTypeKW());
-            Register temp = TryAllocRegister(false, size);
+            Register temp = TryAllocRegister(false, size, res);
 
 
         }
@@ -755,7 +885,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     {
         BinOp* op = (BinOp*)node;
 
-        Token noper(L"", TokenType::EoF, 0, 0, 0);
+        Token noper(L"", TokenType::EoF, 0, 0);
         switch (op->oper.type)
         {
         case TokenType::AssignPlus:
@@ -806,15 +936,19 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         if (noper.type != TokenType::EoF)
         {
             op->oper = noper;
+            op->Typify();
             BinOp* assign = new BinOp();
-            assign->oper = Token(L"=", TokenType::Assign, 0, 0, 0);
+            assign->oper = Token(L"=", TokenType::Assign, 0, 0);
             assign->r = op;
             assign->l = op->r;
+            assign->Typify();
 
             return VisitNode(assign, glob, res);
         }
 
+        // the left operand waits while the right one is computed
         VisitRes left_vis = VisitNode(op->l, glob, res);
+        pending.push_back(&left_vis);
         VisitRes right_vis = VisitNode(op->r, glob, res);
 
         size_t op_size = std::max(
@@ -841,7 +975,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         if (right_vis.type != VisitRes::reg || op->oper.type == TokenType::OperDiv ||
             (op->oper.type == TokenType::OperMul && !IsSigned(op->GetTypeKW())))
         {
-            temp = TryAllocRegister(false, op_size);
+            temp = TryAllocRegister(false, op_size, res);
 
             mov_in = MakeMov(right_vis, temp, op_size);
         }
@@ -849,6 +983,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         {
             temp = right_vis.rData;
         }
+        pending.pop_back();
 
         AsInstr inst;
         if (op->GetTypeKW() != Keyword::kw_bool)
@@ -862,7 +997,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         case VisitRes::glob:
         {
             inst.oper1 = AsInstr::Operands::Label;
-            inst.l1 = left_vis.gData->name;
+            inst.l1 = left_vis.gData->sym;
             break;
         }
         case VisitRes::loc:
@@ -881,13 +1016,13 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         case VisitRes::cnst:
         {
             inst.oper1 = AsInstr::Operands::Const;
-            inst.l1 = left_vis.cData->data.data;
+            inst.l1 = InternSymbol(left_vis.cData->data.GetText());
             break;
         }
         case VisitRes::arr:
         {
             inst.oper1 = AsInstr::Operands::Addr;
-            inst.l1 = left_vis.aData->gData->name;
+            inst.l1 = left_vis.aData->gData->sym;
             inst.reg1 = left_vis.iData->rData;
             inst.mem1 = op_size;
             break;
@@ -905,6 +1040,8 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
                 res.push_back(mov_in);
             res.push_back(inst);
 
+            // the flags hold the result
+            FreeRegister(temp);
             return VisitRes(bool_t);
         }
 
@@ -963,27 +1100,73 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     {
         Lambda* v = (Lambda*)node;
 
-        size_t param_bytes = 0;
-        for (Var* p : v->params)
+        if (m_passes && m_passes->IsOn("ssa"))
         {
-            param_bytes += GetTypeSize(p->GetTypeKW());
+            if (auto ir = IRBuilder::Build(v))
+            {
+                if (m_passes->IsOn("mem2reg"))
+                {
+                    Mem2Reg::Run(*ir);
+                }
+                RegAssignment regs;
+                if (m_passes->IsOn("regalloc-graph"))
+                {
+                    regs = GraphColoring::Run(*ir);
+                }
+                else if (m_passes->IsOn("regalloc"))
+                {
+                    regs = LinearScan::Run(*ir);
+                }
+                Symbol label = v->label != NoSymbol ? v->label : GenLabel();
+                if (m_passes->report && !regs.regs.empty())
+                {
+                    std::wcout << L"regalloc: " << SymbolText(label) << L": " << regs.coalesced
+                        << L" moves coalesced, " << regs.spilled << L" values spilled\n";
+                }
+                func.push_back(std::make_pair(label, IRLowering(*ir, strings, regs).Lower()));
+                return VisitRes(label);
+            }
         }
 
-        locals.push_back(StackFrame(param_bytes)); // push param list
+        int64_t outer_out_bytes = out_bytes;
+        out_bytes = 0;
+        bool outer_has_asm = has_asm;
+        has_asm = v->HasAsm();
+
+        std::vector<Keyword> types;
         for (Var* p : v->params)
         {
+            types.push_back(p->GetTypeKW());
+        }
+        std::vector<Register> arg_regs = ArgRegisters(types);
+
+        // parameters passed in registers are stored in the frame as locals,
+        // the other ones are above the return address
+        locals.push_back(StackFrame()); // push param list
+        int64_t stack_param = 16;
+        for (size_t i = 0; i < v->params.size(); ++i)
+        {
+            Var* p = v->params[i];
             p->is_param = true;
-            locals[locals.size() - 1].AddVar(p);
+            if (arg_regs[i] == Register::Last)
+            {
+                locals[locals.size() - 1].AddParam(p, stack_param);
+                stack_param += 8;
+            }
+            else
+            {
+                locals[locals.size() - 1].AddVar(p);
+            }
         }
 
-        String label = GenLabel();
+        Symbol label = v->label != NoSymbol ? v->label : GenLabel();
         func.push_back(std::make_pair(label, std::vector<AsInstr>()));
 
         /*
         Stack frame enter instructions:
             pushq   %rbp
             movq    %rsp, %rbp
-            subq    $<size of all locals of the function (in bytes)>, %rsp
+            subq    $<size of the frame (in bytes), known when the body is written>, %rsp
         */
         AsInstr enter_in[3];
 
@@ -997,8 +1180,6 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         enter_in[2].instr = AsInstr::Instr::as_sub;
         enter_in[2].SetSizeSuffix(8);
         enter_in[2].oper1 = AsInstr::Operands::Const;
-        // we add 32, because program segfaults if allocated stack is less
-        enter_in[2].l1 = std::to_wstring(v->def->bytes + 32);
         enter_in[2].oper2 = AsInstr::Operands::Reg;
         enter_in[2].reg2 = Register::rsp;
 
@@ -1007,6 +1188,32 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
             func[func.size() - 1].second.push_back(enter_in[i]);
         }
 
+        for (size_t i = 0; i < v->params.size(); ++i)
+        {
+            if (arg_regs[i] == Register::Last)
+            {
+                continue;
+            }
+
+            size_t size = GetTypeSize(types[i]);
+            AsInstr store;
+            store.instr = AsInstr::Instr::as_mov;
+            store.SetSizeSuffix(size);
+            store.oper2 = AsInstr::Operands::Stack;
+            store.mem2 = GetLocal(v->params[i]).offset;
+            if (arg_regs[i] >= Register::xmm0)
+            {
+                store = AsInstr((size == 4 ? L"movss     %" : L"movsd     %")
+                    + RegisterStr[(int)arg_regs[i]] + store.GenText(2) + L"\n");
+            }
+            else
+            {
+                store.oper1 = AsInstr::Operands::Reg;
+                store.reg1 = CvtReg(arg_regs[i], size);
+            }
+            func[func.size() - 1].second.push_back(store);
+        }
+
         VisitBlock(v->def, false, func[func.size() - 1].second);
 
         if (v->ret_type == Keyword::kw_null)
@@ -1014,6 +1221,91 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
             func[func.size() - 1].second.push_back(AsInstr(L"leave\n\tret\n"));
         }
 
+        // callee-saved registers the function changes are kept below the locals,
+        // inline assembly changes the ones it names
+        std::vector<AsInstr>& body = func[func.size() - 1].second;
+        std::vector<Register> saved;
+        for (const AsInstr& in : body)
+        {
+            if (in.instr == AsInstr::Instr::Last && !in.isLabel)
+            {
+                for (Register r : { Register::rbx, Register::r12, Register::r13, Register::r14, Register::r15 })
+                {
+                    bool named = false;
+                    for (size_t size : { 1, 2, 4, 8 })
+                    {
+                        named = named || in.text.find(L"%" + RegisterStr[(int)CvtReg(r, size)]) != String::npos;
+                    }
+                    if (named && std::find(saved.begin(), saved.end(), r) == saved.end())
+                    {
+                        saved.push_back(r);
+                    }
+                }
+                continue;
+            }
+
+            for (Register r : { in.oper1 == AsInstr::Operands::Reg || in.oper1 == AsInstr::Operands::Addr
+                                    ? CalleeSavedOf(in.reg1) : Register::Last,
+                                in.oper2 == AsInstr::Operands::Reg || in.oper2 == AsInstr::Operands::Addr
+                                    ? CalleeSavedOf(in.reg2) : Register::Last })
+            {
+                if (r != Register::Last && std::find(saved.begin(), saved.end(), r) == saved.end())
+                {
+                    saved.push_back(r);
+                }
+            }
+        }
+
+        int64_t locals_bytes = std::max<int64_t>(v->def->bytes, -locals[locals.size() - 1].stack_offset);
+        // the stack arguments of the calls are at the bottom, at least 32 bytes
+        // are left there for the functions called from inline assembly
+        int64_t frame = locals_bytes + 8 * (int64_t)saved.size() + std::max<int64_t>(out_bytes, 32);
+        body[2].l1 = InternSymbol(std::to_wstring((frame + 15) / 16 * 16));
+        out_bytes = outer_out_bytes;
+        has_asm = outer_has_asm;
+
+        if (!saved.empty())
+        {
+            auto save = [&](size_t i, bool store) {
+                AsInstr in;
+                in.instr = AsInstr::Instr::as_mov;
+                in.SetSizeSuffix(8);
+                if (store)
+                {
+                    in.oper1 = AsInstr::Operands::Reg;
+                    in.reg1 = saved[i];
+                    in.oper2 = AsInstr::Operands::Stack;
+                    in.mem2 = -locals_bytes - 8 * (int64_t)(i + 1);
+                }
+                else
+                {
+                    in.oper1 = AsInstr::Operands::Stack;
+                    in.mem1 = -locals_bytes - 8 * (int64_t)(i + 1);
+                    in.oper2 = AsInstr::Operands::Reg;
+                    in.reg2 = saved[i];
+                }
+                return in;
+            };
+
+            std::vector<AsInstr> res(body.begin(), body.begin() + 3);
+            for (size_t i = 0; i < saved.size(); ++i)
+            {
+                res.push_back(save(i, true));
+            }
+            for (size_t j = 3; j < body.size(); ++j)
+            {
+                if (body[j].text.compare(0, 5, L"leave") == 0)
+                {
+                    for (size_t i = 0; i < saved.size(); ++i)
+                    {
+                        res.push_back(save(i, false));
+                    }
+                }
+                res.push_back(body[j]);
+            }
+            body = std::move(res);
+        }
+
         locals.pop_back(); // pop param list
         return VisitRes(label);
     }
@@ -1023,7 +1315,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
         auto idx_vis = VisitNode(arr->idx, glob, res);
         if (idx_vis.type != VisitRes::reg)
         {
-            Register temp = TryAllocRegister(false, 8);
+            Register temp = TryAllocRegister(false, 8, res);
             res.push_back(MakeMov(idx_vis, temp, 8));
             idx_vis = temp;
         }
@@ -1039,7 +1331,7 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
             sub_in.reg2 = idx_vis.rData;
 
             sub_in.oper1 = AsInstr::Operands::Const;
-            sub_in.l1 = std::to_wstring(start);
+            sub_in.l1 = InternSymbol(std::to_wstring(start));
             res.push_back(sub_in);
         }
 
@@ -1053,9 +1345,10 @@ CodeGen::VisitRes CodeGen::VisitNode(ASTNode* node, bool glob, std::vector<AsIns
     return VisitRes();
 }
 
-CodeGen::CodeGen(AST& ast)
+CodeGen::CodeGen(AST& ast, const PassManager* passes)
 {
     m_ast = &ast;
+    m_passes = passes;
 }
 
 void CodeGen::WriteCode(const String& path)
@@ -1072,13 +1365,47 @@ void CodeGen::WriteCode(const String& path)
         RegisterState.RegRx[i] = true;
     }
 
+    // functions bound to immutable global variables are called by their names,
+    // the labels must be known before any call is written
+    Symbol main_fn = InternSymbol(L"program.main");
+    bool direct_main = false;
+    for (Namespace* ns : m_ast->prog)
+    {
+        for (ASTNode* node : ns->block->children)
+        {
+            Var* v = (Var*)node;
+            if (node->type == NodeType::Var && v->var_type == Keyword::kw_fn && !v->mut
+                && v->initial && v->initial->type == NodeType::Func)
+            {
+                ((Lambda*)v->initial)->label = v->sym;
+                direct_main |= v->sym == main_fn;
+            }
+        }
+    }
+
+    // main has a frame for the calls of the initialization code
+    locals.push_back(StackFrame());
+    out_bytes = 0;
     for (Namespace* ns : m_ast->prog)
     {
         VisitNSpace(ns);
     }
+    int64_t main_frame = -locals[0].stack_offset + std::max<int64_t>(out_bytes, 32);
+    locals.pop_back();
+
+    if (m_passes)
+    {
+        m_passes->RunMachine(init, L"main");
+        for (auto& fn : func)
+        {
+            m_passes->RunMachine(fn.second, String(SymbolText(fn.first)));
+        }
+    }
 
     stream << L".text\n\t.globl main\n";
     stream << L"main:\n";
+    stream << L"\tpushq     %rbp\n\tmovq      %rsp, %rbp\n";
+    stream << L"\tsubq      $" << (main_frame + 15) / 16 * 16 << L", %rsp\n";
 
     for (AsInstr& instr : init)
     {
@@ -1092,14 +1419,14 @@ void CodeGen::WriteCode(const String& path)
         }
     }
     stream
-        << L"\tcall      *(program.main)\n"
-        << L"\tret\n\n";
+        << (direct_main ? L"\tcall      program.main\n" : L"\tcall      *(program.main)\n")
+        << L"\tleave\n\tret\n\n";
 
     stream << L".data\n";
 
     for (auto& pair : strings)
     {
-        stream << pair.first << L":\n\t.hword ";
+        stream << SymbolText(pair.first) << L":\n\t.hword ";
         for (wchar_t c : pair.second)
         {
             stream << (int)c << L", ";
@@ -1127,7 +1454,7 @@ void CodeGen::WriteCode(const String& path)
 
     for (auto& fn : func)
     {
-        stream << fn.first << L":\n";
+        stream << SymbolText(fn.first) << L":\n";
         for (auto& instr : fn.second)
         {
             if (instr.isLabel)
@@ -1155,10 +1482,14 @@ void CodeGen::StackFrame::AddVar(Var* v)
     var.data = v;
     stack_offset -= GetTypeSize(v->var_type);
     var.offset = stack_offset;
-    if (v->is_param)
-    {
-        var.offset += 16;
-    }
+    vars.push_back(var);
+}
+
+void CodeGen::StackFrame::AddParam(Var* v, int64_t offset)
+{
+    LocalVar var;
+    var.data = v;
+    var.offset = offset;
     vars.push_back(var);
 }
 
@@ -1191,7 +1522,7 @@ CodeGen::VisitRes::VisitRes(const LocalVar& l)
     type = loc;
 }
 
-CodeGen::VisitRes::VisitRes(const String& f)
+CodeGen::VisitRes::VisitRes(Symbol f)
 {
     fData = f;
     type = func;
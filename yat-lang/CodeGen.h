@@ -19,6 +19,7 @@
 #include "Utils.h"
 #include "Register.h"
 #include "AsInstr.h"
+#include "PassManager.h"
 
 class CodeGen
 {
@@ -37,9 +38,14 @@ class CodeGen
         StackFrame(int64_t off);
 
         inline void AddVar(Var* v);
+        // parameter passed on the stack, at the offset from %rbp
+        inline void AddParam(Var* v, int64_t offset);
     };
 
     std::vector<StackFrame> locals;
+    // bytes of the stack arguments of the calls written in the current
+    // function, they are stored at the bottom of its frame
+    int64_t out_bytes = 0;
 
     // initialization instructions
     // there we have to pass initial values to the
@@ -50,13 +56,14 @@ class CodeGen
     // all string literals
     // PAIRS:
     // Label : literal
-    std::vector<std::pair<String, String>> strings;
+    std::vector<std::pair<Symbol, String>> strings;
     // definitions of all functions (lambdas)
     // PAIRS:
     // Label : vector of instructions
-    std::vector<std::pair<String, std::vector<AsInstr>>> func;
+    std::vector<std::pair<Symbol, std::vector<AsInstr>>> func;
 
     AST* m_ast = nullptr;
+    const PassManager* m_passes = nullptr;
     std::wofstream stream;
     Namespace* cur_ns = nullptr;
 
@@ -93,7 +100,7 @@ class CodeGen
         // local
         VisitRes(const LocalVar& l);
         // function
-        VisitRes(const String& f);
+        VisitRes(Symbol f);
         // boolean
         VisitRes(const TokenType b);
         // global array
@@ -105,7 +112,7 @@ class CodeGen
         Var* gData{};
         ConstLeaf* cData{};
         LocalVar lData{};
-        String fData{};
+        Symbol fData = NoSymbol;
         TokenType bData{};
         VisitRes *iData{}, *aData{};
     };
@@ -123,10 +130,22 @@ class CodeGen
         bool RegRx[8]{};    // TRUE if the register is free (r8 - r15)
     } RegisterState;
 
-    inline Register TryAllocRegister(bool fp, size_t bytes);
+    // the function being written has inline assembly
+    bool has_asm = false;
+
+    // results computed but not used yet, the oldest first, TryAllocRegister
+    // moves them to the frame when it runs out of registers
+    std::vector<VisitRes*> pending;
+
+    // a free register, or one freed by moving a pending result to the frame,
+    // which is written to res
+    inline Register TryAllocRegister(bool fp, size_t bytes, std::vector<AsInstr>& res);
     inline void FreeRegister(Register r);
+    // the caller-saved registers kept by TryAllocRegister, the calls change them
+    std::vector<Register> CallerSavedInUse() const;
+    // the callee-saved registers kept by TryAllocRegister
+    std::vector<Register> CalleeSavedInUse() const;
 
-    inline String GenLabel();
     inline LocalVar GetLocal(Var* v);
 
     inline void SolveCondition(ASTNode* cond, std::vector<AsInstr>& res, const AsInstr& jumpt, const AsInstr& jumpf);
@@ -137,7 +156,13 @@ class CodeGen
     VisitRes VisitNode(ASTNode* node,  bool glob, std::vector<AsInstr>& res);
 
 public:
-    CodeGen(AST& ast);
+    // the machine passes are run on the code of every function
+    CodeGen(AST& ast, const PassManager* passes = nullptr);
+    // new label, unique in the program
+    static Symbol GenLabel();
+    // registers the arguments of the types are passed in, Register::Last for
+    // the ones passed on the stack, 8 bytes each in the order of the arguments
+    static std::vector<Register> ArgRegisters(const std::vector<Keyword>& types);
     void WriteCode(const String& path);
 };
 
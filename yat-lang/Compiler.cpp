@@ -15,28 +15,26 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 //
 #include <chrono>
-#include <filesystem>
+#include <memory>
 #include "Compiler.h"
-#include "Tokenizer.h"
+#include "Module.h"
+#include "ModuleCache.h"
 #include "Parser.h"
 #include "CodeGen.h"
 
-Compiler::Compiler(const String& inp, const String& outp, bool as, int opt)
+Compiler::Compiler(const String& inp, const String& outp, bool as, const PassManager& passes, unsigned jobs)
 {
     m_input = inp;
     m_output = outp;
     m_as_outp = as;
-    m_opt_level = opt;
+    m_passes = passes;
+    m_jobs = jobs;
 }
 
 bool Compiler::Run()
 {
     try
     {
-        Tokenizer* tok = new Tokenizer({ m_input });
-
-        std::vector<String> imports;
-        Token t = tok->Next();
         String lib_path = GetEnvVar("YatLibDir");
         if (lib_path == L"")
         {
@@ -48,52 +46,48 @@ bool Compiler::Run()
             lib_path += L"\\";
         }
 
-        while (t.type != TokenType::EoF)
+        // parsed imports are kept in the folder for the next compilations
+        String cache_path = GetEnvVar("YatCacheDir");
+        std::unique_ptr<ModuleCache> cache;
+        if (cache_path != L"")
         {
-            // parsing imports to include folders from standard library to the project
-            if (t.type == TokenType::Name && t.data == L"import")
-            {
-                t = tok->Next();
-                if (t.type == TokenType::String)
-                {
-                    String path = lib_path + t.data;
-                    for (const auto& entry : std::filesystem::directory_iterator(path))
-                        imports.push_back(entry.path().wstring());
-                }
-                else
-                {
-                    tok->UnexpToken(L"invalid token in import statement\n", &t);
-                }
-            }
-            try
-            {
-                t = tok->Next();
-            }
-            catch (...) // catch eny error the tokenizer can throw
+            cache = std::make_unique<ModuleCache>(cache_path);
+        }
+
+        // every file is lexed once, the imports are found while lexing
+        ModuleLoader loader(lib_path, m_jobs, cache.get());
+        const std::vector<Module*>& modules = loader.LoadAll(m_input);
+
+        auto st = std::chrono::high_resolution_clock::now();
+
+        Parser parser(modules[0]->tok, &modules[0]->toks);
+        AST tree;
+        // all nodes, including the ones made by the code generator, are freed with the tree
+        NodeArena::Use use_nodes(tree.nodes);
+        for (Module* m : modules)
+        {
+            if (cache && cache->Load(*m, parser, tree))
             {
+                continue;
             }
 
-            if (t.type == TokenType::Semi)
+            loader.LexNow(m);
+            size_t first = tree.prog.size();
+            parser.SetSource(m->tok, &m->toks);
+            parser.Parse(tree);
+
+            if (cache)
             {
-                t = tok->Next();
+                cache->Store(*m, std::vector<Namespace*>(tree.prog.begin() + first, tree.prog.end()));
             }
         }
 
-        imports.push_back(m_input);
-
-        delete tok;
-        tok = new Tokenizer(imports);
-
-        auto st = std::chrono::high_resolution_clock::now();
-
-        Parser parser(tok);
-        AST tree;
-        parser.Parse(tree);
+        m_passes.RunTree(tree);
 
         // tree.DebugPrint();
         // return true;
 
-        CodeGen cg(tree);
+        CodeGen cg(tree, &m_passes);
         // if (m_as_outp)
         // {
         cg.WriteCode(m_output + L".s");
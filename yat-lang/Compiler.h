@@ -19,14 +19,16 @@
 #include <vector>
 #include <string>
 #include "Utils.h"
+#include "PassManager.h"
 
 class Compiler
 {
     String m_output, m_input, m_error;
     bool m_as_outp;
-    int m_opt_level;
+    PassManager m_passes;
+    unsigned m_jobs;
 public:
-    Compiler(const String& inp, const String& outp, bool as, int opt);
+    Compiler(const String& inp, const String& outp, bool as, const PassManager& passes, unsigned jobs = 0);
     bool Run();
     String GetError();
 };
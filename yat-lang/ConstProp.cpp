@@ -0,0 +1,192 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "ConstProp.h"
+#include "AsInstr.h"
+
+ConstPropagation::ConstPropagation(AST& tree) : m_tree(tree)
+{
+}
+
+void ConstPropagation::Run()
+{
+    for (Namespace* ns : m_tree.prog)
+    {
+        Scan(ns->block);
+    }
+
+    // the variables assembly refers to may be changed by it
+    for (Var* v : m_vars)
+    {
+        if (m_asm.count(v->sym))
+        {
+            v->changed = true;
+        }
+    }
+
+    for (Namespace* ns : m_tree.prog)
+    {
+        ns->block->TryEval();
+    }
+
+    // a use may come before the declaration is folded,
+    // the store is dropped only if no use of the variable is left
+    m_vars.clear();
+    m_asm.clear();
+    m_reads.clear();
+    for (Namespace* ns : m_tree.prog)
+    {
+        Scan(ns->block);
+    }
+
+    for (Var* v : m_vars)
+    {
+        if (v->value && !m_reads[v] && !m_asm.count(v->sym))
+        {
+            v->initial = nullptr;
+        }
+    }
+}
+
+void ConstPropagation::Write(ASTNode* dest)
+{
+    if (dest->type == NodeType::VarLeaf)
+    {
+        ((VarLeaf*)dest)->data->changed = true;
+    }
+}
+
+void ConstPropagation::Scan(ASTNode* node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    switch (node->type)
+    {
+    case NodeType::Var:
+    {
+        Var* v = (Var*)node;
+        m_vars.push_back(v);
+        Scan(v->initial);
+        break;
+    }
+    case NodeType::VarLeaf:
+    {
+        ++m_reads[((VarLeaf*)node)->data];
+        break;
+    }
+    case NodeType::ArrayLeaf:
+    {
+        Scan(((ArrayLeaf*)node)->idx);
+        break;
+    }
+    case NodeType::UnOper:
+    {
+        UnOp* op = (UnOp*)node;
+        if (op->oper.type == TokenType::Keyword && op->oper.kw_type == Keyword::kw_asm)
+        {
+            // the names are resolved as CodeGen does
+            ExpandAsm(((ConstLeaf*)op->operand)->data.GetText(), [this](const String& name)
+            {
+                m_asm.insert(InternSymbol(name));
+                return (int64_t)0;
+            });
+            break;
+        }
+        if (op->oper.type == TokenType::OperInc || op->oper.type == TokenType::OperDec)
+        {
+            Write(op->operand);
+        }
+        Scan(op->operand);
+        break;
+    }
+    case NodeType::BinOper:
+    {
+        BinOp* op = (BinOp*)node;
+        switch (op->oper.type)
+        {
+        case TokenType::Assign:
+            // the destination of an assignment isn't read
+            Write(op->l);
+            if (op->l->type == NodeType::ArrayLeaf)
+            {
+                Scan(op->l);
+            }
+            Scan(op->r);
+            return;
+        case TokenType::AssignPlus:
+        case TokenType::AssignMin:
+        case TokenType::AssignMul:
+        case TokenType::AssignPow:
+        case TokenType::AssignDiv:
+        case TokenType::AssignPCent:
+        case TokenType::AssignLShift:
+        case TokenType::AssignRShift:
+        case TokenType::AssignBWAnd:
+        case TokenType::AssignBWOr:
+        case TokenType::AssignXor:
+            Write(op->r);
+            break;
+        }
+        Scan(op->l);
+        Scan(op->r);
+        break;
+    }
+    case NodeType::Cvt:
+    {
+        Scan(((Convert*)node)->value);
+        break;
+    }
+    case NodeType::Call:
+    {
+        for (ASTNode* p : ((FnCall*)node)->params)
+        {
+            Scan(p);
+        }
+        break;
+    }
+    case NodeType::Func:
+    {
+        Scan(((Lambda*)node)->def);
+        break;
+    }
+    case NodeType::StBlock:
+    {
+        for (ASTNode* n : ((StatementBlock*)node)->children)
+        {
+            Scan(n);
+        }
+        break;
+    }
+    case NodeType::IfSt:
+    {
+        IfStatement* st = (IfStatement*)node;
+        Scan(st->condition);
+        Scan(st->then_b);
+        Scan(st->else_b);
+        break;
+    }
+    case NodeType::WhileLoop:
+    {
+        WhileLoop* lp = (WhileLoop*)node;
+        Scan(lp->condition);
+        Scan(lp->body);
+        break;
+    }
+    }
+}
@@ -0,0 +1,43 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "AST.h"
+
+// Replaces the uses of immutable variables initialized with constants by
+// their values and folds the expressions which become constant. Variables
+// changed by assignments or named in inline assembly are kept. Stores into
+// variables which have no uses left are dropped.
+class ConstPropagation
+{
+    AST& m_tree;
+    std::vector<Var*> m_vars;
+    // variables named by @LVAR in inline assembly
+    std::unordered_set<Symbol> m_asm;
+    // number of reads of every variable
+    std::unordered_map<Var*, size_t> m_reads;
+
+    // finds declarations, reads and writes of variables in the subtree
+    void Scan(ASTNode* node);
+    void Write(ASTNode* dest);
+
+public:
+    ConstPropagation(AST& tree);
+    void Run();
+};
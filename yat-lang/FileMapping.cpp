@@ -0,0 +1,268 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "FileMapping.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define YAT_SSE2
+#endif
+
+FileMapping::FileMapping(const String& path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    m_file = file;
+
+    LARGE_INTEGER size{};
+    if (!GetFileSizeEx(file, &size))
+    {
+        Close();
+        return;
+    }
+
+    m_open = true;
+    m_size = (size_t)size.QuadPart;
+    if (m_size == 0) return; // empty files cannot be mapped
+
+    m_map = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_map)
+    {
+        m_data = (const char*)MapViewOfFile(m_map, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    std::string npath;
+    W2S(path, npath);
+
+    int fd = open(npath.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return;
+    }
+
+    m_open = true;
+    m_size = (size_t)st.st_size;
+    if (m_size != 0)
+    {
+        void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            madvise(p, m_size, MADV_SEQUENTIAL);
+            m_data = (const char*)p;
+        }
+    }
+    close(fd); // the mapping stays valid after the descriptor is closed
+#endif
+
+    if (m_size != 0 && !m_data)
+    {
+        Close();
+    }
+}
+
+FileMapping::FileMapping(FileMapping&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+FileMapping& FileMapping::operator=(FileMapping&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        m_data = other.m_data;
+        m_size = other.m_size;
+        m_open = other.m_open;
+#ifdef _WIN32
+        m_file = other.m_file;
+        m_map = other.m_map;
+        other.m_file = other.m_map = nullptr;
+#endif
+        other.m_data = nullptr;
+        other.m_size = 0;
+        other.m_open = false;
+    }
+    return *this;
+}
+
+FileMapping::~FileMapping()
+{
+    Close();
+}
+
+void FileMapping::Close()
+{
+#ifdef _WIN32
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_map) CloseHandle(m_map);
+    if (m_file) CloseHandle(m_file);
+    m_map = m_file = nullptr;
+#else
+    if (m_data) munmap((void*)m_data, m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+// store one code point, splitting it into surrogates where wchar_t is 16-bit
+static inline wchar_t* PutCodePoint(uint32_t cp, wchar_t* dst)
+{
+    if constexpr (sizeof(wchar_t) == 2)
+    {
+        if (cp >= 0x10000)
+        {
+            cp -= 0x10000;
+            *dst++ = (wchar_t)(0xD800 + (cp >> 10));
+            *dst++ = (wchar_t)(0xDC00 + (cp & 0x3FF));
+            return dst;
+        }
+    }
+    *dst++ = (wchar_t)cp;
+    return dst;
+}
+
+#ifdef YAT_SSE2
+// widen 16 ASCII bytes to wide characters
+static inline void WidenASCII(__m128i v, wchar_t* dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+    if constexpr (sizeof(wchar_t) == 2)
+    {
+        _mm_storeu_si128((__m128i*)dst, lo);
+        _mm_storeu_si128((__m128i*)(dst + 8), hi);
+    }
+    else
+    {
+        _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*)(dst + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*)(dst + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+}
+#endif
+
+size_t DecodeUTF8(const char* src, size_t n, wchar_t* dst)
+{
+    const uint8_t* s = (const uint8_t*)src;
+    const uint8_t* e = s + n;
+    wchar_t* d = dst;
+
+    // skip byte order mark
+    if (n >= 3 && s[0] == 0xEF && s[1] == 0xBB && s[2] == 0xBF)
+    {
+        s += 3;
+    }
+
+    while (s < e)
+    {
+#ifdef YAT_SSE2
+        // fast path: 16 characters at once while there are only ASCII
+        // characters without carriage returns
+        const __m128i cr = _mm_set1_epi8('\r');
+        while (e - s >= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)s);
+            if (_mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, cr))) != 0)
+            {
+                break;
+            }
+            WidenASCII(v, d);
+            s += 16;
+            d += 16;
+        }
+        if (s >= e) break;
+#endif
+        uint32_t c = *s;
+
+        if (c < 0x80)
+        {
+            ++s;
+            if (c == '\r' && s < e && *s == '\n') continue;
+            *d++ = (wchar_t)c;
+            continue;
+        }
+
+        uint32_t cp = 0xFFFD;
+        size_t len = 1;
+        if ((c & 0xE0) == 0xC0)
+        {
+            len = 2;
+            cp = c & 0x1F;
+        }
+        else if ((c & 0xF0) == 0xE0)
+        {
+            len = 3;
+            cp = c & 0x0F;
+        }
+        else if ((c & 0xF8) == 0xF0)
+        {
+            len = 4;
+            cp = c & 0x07;
+        }
+
+        if (len == 1 || (size_t)(e - s) < len)
+        {
+            // invalid leading byte or truncated sequence
+            d = PutCodePoint(0xFFFD, d);
+            ++s;
+            continue;
+        }
+
+        bool valid = true;
+        for (size_t i = 1; i < len; ++i)
+        {
+            if ((s[i] & 0xC0) != 0x80)
+            {
+                valid = false;
+                break;
+            }
+            cp = (cp << 6) | (s[i] & 0x3F);
+        }
+
+        if (!valid)
+        {
+            d = PutCodePoint(0xFFFD, d);
+            ++s;
+            continue;
+        }
+
+        d = PutCodePoint(cp, d);
+        s += len;
+    }
+
+    return d - dst;
+}
@@ -0,0 +1,54 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <cstdint>
+#include "Utils.h"
+
+// read-only view of a whole file mapped into memory
+class FileMapping
+{
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_map = nullptr;
+#endif
+
+    void Close();
+
+public:
+    FileMapping() = default;
+    FileMapping(const String& path);
+    FileMapping(const FileMapping&) = delete;
+    FileMapping(FileMapping&& other) noexcept;
+    FileMapping& operator=(const FileMapping&) = delete;
+    FileMapping& operator=(FileMapping&& other) noexcept;
+    ~FileMapping();
+
+    // FALSE if the file doesn't exist or cannot be mapped
+    bool IsOpen() const { return m_open; }
+    const char* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+};
+
+// decode UTF-8 text to the wide characters buffer
+// dst must have room for at least n characters
+// "\r\n" pairs are stored as a single '\n' and the BOM is skipped
+// returns number of characters written
+size_t DecodeUTF8(const char* src, size_t n, wchar_t* dst);
@@ -0,0 +1,221 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "IR.h"
+#include <algorithm>
+
+static const wchar_t* IROpStr[]{
+    L"const",
+    L"str",
+    L"func",
+    L"param",
+    L"load",
+    L"store",
+    L"load_elem",
+    L"store_elem",
+    L"add",
+    L"sub",
+    L"mul",
+    L"div",
+    L"rem",
+    L"shl",
+    L"shr",
+    L"and",
+    L"or",
+    L"xor",
+    L"neg",
+    L"not",
+    L"cmp",
+    L"cvt",
+    L"copy",
+    L"phi",
+    L"call",
+    L"asm",
+    L"ret",
+    L"jmp",
+    L"br"
+};
+
+static const wchar_t* CondStr(TokenType cond)
+{
+    switch (cond)
+    {
+    case TokenType::OperLess:    return L"<";
+    case TokenType::OperGreater: return L">";
+    case TokenType::OperEqual:   return L"==";
+    case TokenType::OperNEqual:  return L"!=";
+    case TokenType::OperLEqual:  return L"<=";
+    case TokenType::OperGEqual:  return L">=";
+    }
+    return L"?";
+}
+
+bool IRInstr::HasValue() const
+{
+    return type != Keyword::kw_null;
+}
+
+bool IRInstr::IsTerminator() const
+{
+    return op == IROp::Ret || op == IROp::Jmp || op == IROp::Br;
+}
+
+IRFunction::IRFunction(Lambda* src)
+{
+    this->src = src;
+}
+
+IRBlock* IRFunction::NewBlock()
+{
+    m_blocks.push_back(std::make_unique<IRBlock>());
+    return m_blocks.back().get();
+}
+
+IRInstr* IRFunction::NewInstr(IROp op, Keyword type)
+{
+    m_instrs.push_back(std::make_unique<IRInstr>());
+    IRInstr* in = m_instrs.back().get();
+    in->op = op;
+    in->type = type;
+    in->id = (unsigned)m_instrs.size() - 1;
+    return in;
+}
+
+unsigned IRFunction::InstrCount() const
+{
+    return (unsigned)m_instrs.size();
+}
+
+void IRFunction::RemoveUnreachable()
+{
+    std::vector<IRBlock*> stack{ blocks[0] };
+    std::vector<bool> reached(m_blocks.size());
+    auto index = [this](IRBlock* b) {
+        for (size_t i = 0; i < m_blocks.size(); ++i)
+        {
+            if (m_blocks[i].get() == b)
+            {
+                return i;
+            }
+        }
+        return m_blocks.size();
+    };
+
+    reached[index(blocks[0])] = true;
+    while (!stack.empty())
+    {
+        IRBlock* b = stack.back();
+        stack.pop_back();
+        for (IRBlock* s : b->succs)
+        {
+            size_t i = index(s);
+            if (!reached[i])
+            {
+                reached[i] = true;
+                stack.push_back(s);
+            }
+        }
+    }
+
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&](IRBlock* b) {
+        return !reached[index(b)];
+    }), blocks.end());
+
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        blocks[i]->id = (unsigned)i;
+        blocks[i]->preds.clear();
+    }
+    for (IRBlock* b : blocks)
+    {
+        for (IRBlock* s : b->succs)
+        {
+            s->preds.push_back(b);
+        }
+    }
+}
+
+void IRFunction::Dump(std::wostream& out) const
+{
+    out << L"fn " << KeywordStr[(size_t)src->ret_type] << L" (";
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        out << (i ? L", " : L"") << KeywordStr[(size_t)params[i]->var_type] << L" " << params[i]->name;
+    }
+    out << L")\n";
+
+    for (IRBlock* b : blocks)
+    {
+        out << L"b" << b->id << L":";
+        if (!b->preds.empty())
+        {
+            out << L"  ; preds";
+            for (IRBlock* p : b->preds)
+            {
+                out << L" b" << p->id;
+            }
+        }
+        out << L"\n";
+
+        for (IRInstr* in : b->instrs)
+        {
+            out << L"    ";
+            if (in->HasValue())
+            {
+                out << L"%" << in->id << L" = ";
+            }
+            out << IROpStr[(size_t)in->op];
+            if (in->HasValue())
+            {
+                out << L" " << KeywordStr[(size_t)in->type];
+            }
+
+            switch (in->op)
+            {
+            case IROp::Const:
+                out << L" " << in->imm;
+                break;
+            case IROp::Str:
+            case IROp::Asm:
+                out << L" \"" << in->text << L"\"";
+                break;
+            case IROp::Func:
+            case IROp::Call:
+                out << L" " << SymbolText(in->sym);
+                break;
+            case IROp::Cmp:
+                out << L" " << CondStr(in->cond);
+                break;
+            }
+            if (in->var)
+            {
+                out << L" " << in->var->name;
+            }
+            for (size_t i = 0; i < in->args.size(); ++i)
+            {
+                out << (i || in->var ? L", %" : L" %") << in->args[i]->id;
+            }
+            if (in->IsTerminator())
+            {
+                for (IRBlock* s : b->succs)
+                {
+                    out << L" b" << s->id;
+                }
+            }
+            out << L"\n";
+        }
+    }
+}
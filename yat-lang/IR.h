@@ -0,0 +1,135 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "AST.h"
+
+struct IRBlock;
+
+enum class IROp
+{
+    // integer constant imm
+    Const,
+    // address of the string literal text
+    Str,
+    // address of the code of the function sym
+    Func,
+    // value of the parameter var as it is passed, imm is its index
+    Param,
+    // value of the variable var, kept in memory
+    Load,
+    // args[0] is written to the variable var
+    Store,
+    // element args[0] of the global array var
+    LoadElem,
+    // args[1] is written to the element args[0] of the global array var
+    StoreElem,
+
+    // args[0] <operator> args[1]
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Rem,
+    Shl,
+    Shr,
+    And,
+    Or,
+    Xor,
+    // <operator> args[0]
+    Neg,
+    Not,
+    // bool result of args[0] <cond> args[1]
+    Cmp,
+    // args[0] converted to the type
+    Cvt,
+    // args[0] itself
+    Copy,
+    // args[i] if the control comes from block->preds[i]
+    Phi,
+    // call of the function sym with args, directly if the callee has a label
+    Call,
+    // inline assembly text
+    Asm,
+
+    // the last instruction of every block is one of the following
+
+    // returns args[0], if there is any
+    Ret,
+    // jumps to block->succs[0]
+    Jmp,
+    // jumps to block->succs[0] if args[0] is true, to block->succs[1] otherwise
+    Br
+};
+
+// instruction, and the value it defines if its type isn't kw_null
+struct IRInstr
+{
+    IROp op = IROp::Const;
+    Keyword type = Keyword::kw_null;
+    std::vector<IRInstr*> args;
+    IRBlock* block = nullptr;
+    // number of the value, unique in the function
+    unsigned id = 0;
+
+    int64_t imm = 0;
+    Symbol sym = NoSymbol;
+    Var* var = nullptr;
+    TokenType cond = TokenType::EoF;
+    std::wstring_view text;
+    Lambda* callee = nullptr;
+
+    bool HasValue() const;
+    bool IsTerminator() const;
+};
+
+struct IRBlock
+{
+    // index of the block in IRFunction::blocks
+    unsigned id = 0;
+    std::vector<IRInstr*> instrs;
+    std::vector<IRBlock*> preds, succs;
+};
+
+// function in SSA form, it owns all its blocks and instructions
+class IRFunction
+{
+    std::vector<std::unique_ptr<IRBlock>> m_blocks;
+    std::vector<std::unique_ptr<IRInstr>> m_instrs;
+
+public:
+    Lambda* src = nullptr;
+    // blocks in the order they are written, the first one is the entry
+    std::vector<IRBlock*> blocks;
+    // variables kept in memory
+    std::vector<Var*> params, locals;
+
+    IRFunction(Lambda* src);
+
+    // the block isn't in the function until it is added to blocks
+    IRBlock* NewBlock();
+    IRInstr* NewInstr(IROp op, Keyword type);
+    // number of instructions ever made, all ids are less than it
+    unsigned InstrCount() const;
+
+    // removes the blocks which cannot be reached from the entry,
+    // renumbers the rest and finds their predecessors
+    void RemoveUnreachable();
+    void Dump(std::wostream& out) const;
+};
@@ -0,0 +1,522 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "IRBuilder.h"
+
+// types of the values the IR can keep
+static bool IsScalar(Keyword t)
+{
+    return IsNumber(t)
+        || t == Keyword::kw_bool
+        || t == Keyword::kw_str16
+        || t == Keyword::kw_fn;
+}
+
+// operation of an arithmetic or a compound assignment operator,
+// FALSE if there is none
+static bool ArithOp(TokenType t, IROp& op)
+{
+    switch (t)
+    {
+    case TokenType::OperPlus:
+    case TokenType::AssignPlus:   op = IROp::Add; return true;
+    case TokenType::OperMin:
+    case TokenType::AssignMin:    op = IROp::Sub; return true;
+    case TokenType::OperMul:
+    case TokenType::AssignMul:    op = IROp::Mul; return true;
+    case TokenType::OperDiv:
+    case TokenType::AssignDiv:    op = IROp::Div; return true;
+    case TokenType::OperPCent:
+    case TokenType::AssignPCent:  op = IROp::Rem; return true;
+    case TokenType::OperLShift:
+    case TokenType::AssignLShift: op = IROp::Shl; return true;
+    case TokenType::OperRShift:
+    case TokenType::AssignRShift: op = IROp::Shr; return true;
+    case TokenType::OperBWAnd:
+    case TokenType::AssignBWAnd:  op = IROp::And; return true;
+    case TokenType::OperBWOr:
+    case TokenType::AssignBWOr:   op = IROp::Or;  return true;
+    case TokenType::OperXor:
+    case TokenType::AssignXor:    op = IROp::Xor; return true;
+    }
+    return false;
+}
+
+IRBuilder::IRBuilder(IRFunction* fn)
+{
+    m_fn = fn;
+}
+
+std::unique_ptr<IRFunction> IRBuilder::Build(Lambda* fn)
+{
+    auto res = std::make_unique<IRFunction>(fn);
+    IRBuilder b(res.get());
+
+    if (fn->ret_type != Keyword::kw_null && !IsScalar(fn->ret_type))
+    {
+        return nullptr;
+    }
+
+    for (Var* p : fn->params)
+    {
+        if (!IsScalar(p->var_type))
+        {
+            return nullptr;
+        }
+        res->params.push_back(p);
+        b.m_locals.insert(p);
+    }
+
+    b.SetBlock(res->NewBlock());
+    b.BuildBlock(fn->def);
+    if (b.m_failed)
+    {
+        return nullptr;
+    }
+
+    // the end of the function
+    if (b.m_cur->instrs.empty() || !b.m_cur->instrs.back()->IsTerminator())
+    {
+        b.Emit(IROp::Ret, Keyword::kw_null);
+    }
+
+    res->RemoveUnreachable();
+    return res;
+}
+
+IRInstr* IRBuilder::Emit(IROp op, Keyword type, const std::vector<IRInstr*>& args)
+{
+    // code after a jump or a return can't be reached
+    if (!m_cur->instrs.empty() && m_cur->instrs.back()->IsTerminator())
+    {
+        SetBlock(m_fn->NewBlock());
+    }
+
+    IRInstr* in = m_fn->NewInstr(op, type);
+    in->args = args;
+    in->block = m_cur;
+    m_cur->instrs.push_back(in);
+    return in;
+}
+
+IRInstr* IRBuilder::Const(int64_t v, Keyword type)
+{
+    IRInstr* c = Emit(IROp::Const, type);
+    c->imm = v;
+    return c;
+}
+
+IRInstr* IRBuilder::Cast(IRInstr* v, Keyword type)
+{
+    if (!v->HasValue())
+    {
+        return Fail();
+    }
+    // values of the same size differ only by the way they are read
+    if (GetTypeSize(v->type) == GetTypeSize(type))
+    {
+        return v;
+    }
+    return Emit(IROp::Cvt, type, { v });
+}
+
+IRInstr* IRBuilder::Fail()
+{
+    m_failed = true;
+    return Const(0, Keyword::kw_i64);
+}
+
+void IRBuilder::SetBlock(IRBlock* b)
+{
+    m_cur = b;
+    m_fn->blocks.push_back(b);
+}
+
+void IRBuilder::Jump(IRBlock* to)
+{
+    if (!m_cur->instrs.empty() && m_cur->instrs.back()->IsTerminator())
+    {
+        return;
+    }
+    Emit(IROp::Jmp, Keyword::kw_null);
+    m_cur->succs = { to };
+}
+
+void IRBuilder::Branch(IRInstr* cond, IRBlock* t, IRBlock* f)
+{
+    Emit(IROp::Br, Keyword::kw_null, { cond });
+    m_cur->succs = { t, f };
+}
+
+void IRBuilder::BuildBlock(StatementBlock* b)
+{
+    for (ASTNode* node : b->children)
+    {
+        BuildStatement(node);
+        if (m_failed)
+        {
+            return;
+        }
+    }
+}
+
+void IRBuilder::BuildStatement(ASTNode* node)
+{
+    switch (node->type)
+    {
+    case NodeType::Var:
+    {
+        Var* v = (Var*)node;
+        if (v->is_arr || !IsScalar(v->var_type))
+        {
+            Fail();
+            return;
+        }
+
+        m_locals.insert(v);
+        m_fn->locals.push_back(v);
+        if (v->initial)
+        {
+            IRInstr* st = Emit(IROp::Store, Keyword::kw_null, { Cast(BuildExpr(v->initial), v->var_type) });
+            st->var = v;
+        }
+        return;
+    }
+    case NodeType::StBlock:
+    {
+        BuildBlock((StatementBlock*)node);
+        return;
+    }
+    case NodeType::IfSt:
+    {
+        IfStatement* st = (IfStatement*)node;
+        IRBlock* then_b = m_fn->NewBlock();
+        IRBlock* end = m_fn->NewBlock();
+        IRBlock* else_b = st->else_b ? m_fn->NewBlock() : end;
+
+        BuildCond(st->condition, then_b, else_b);
+
+        SetBlock(then_b);
+        BuildBlock(st->then_b);
+        Jump(end);
+
+        if (st->else_b)
+        {
+            SetBlock(else_b);
+            BuildBlock(st->else_b);
+            Jump(end);
+        }
+
+        SetBlock(end);
+        return;
+    }
+    case NodeType::WhileLoop:
+    {
+        WhileLoop* lp = (WhileLoop*)node;
+        IRBlock* head = m_fn->NewBlock();
+        IRBlock* body = m_fn->NewBlock();
+        IRBlock* end = m_fn->NewBlock();
+
+        Jump(head);
+        SetBlock(head);
+        BuildCond(lp->condition, body, end);
+
+        SetBlock(body);
+        BuildBlock(lp->body);
+        Jump(head);
+
+        SetBlock(end);
+        return;
+    }
+    case NodeType::UnOper:
+    {
+        UnOp* op = (UnOp*)node;
+        if (op->oper.type != TokenType::Keyword)
+        {
+            break;
+        }
+
+        if (op->oper.kw_type == Keyword::kw_asm)
+        {
+            IRInstr* in = Emit(IROp::Asm, Keyword::kw_null);
+            in->text = ((ConstLeaf*)op->operand)->data.GetText();
+            return;
+        }
+
+        if (op->oper.kw_type == Keyword::kw_ret)
+        {
+            // the last statement of a function is returned even if it has no value
+            Keyword ret_type = m_fn->src->ret_type;
+            ASTNode* v = op->operand;
+            if (v->type == NodeType::Var || v->type == NodeType::StBlock
+                || v->type == NodeType::IfSt || v->type == NodeType::WhileLoop
+                || (v->type == NodeType::UnOper && ((UnOp*)v)->oper.type == TokenType::Keyword))
+            {
+                BuildStatement(v);
+                Emit(IROp::Ret, Keyword::kw_null);
+            }
+            else if (ret_type == Keyword::kw_null)
+            {
+                BuildExpr(v);
+                Emit(IROp::Ret, Keyword::kw_null);
+            }
+            else
+            {
+                Emit(IROp::Ret, Keyword::kw_null, { Cast(BuildExpr(v), ret_type) });
+            }
+            return;
+        }
+        break;
+    }
+    }
+
+    BuildExpr(node);
+}
+
+IRInstr* IRBuilder::BuildExpr(ASTNode* node)
+{
+    switch (node->type)
+    {
+    case NodeType::ConstLeaf:
+    {
+        ConstLeaf* c = (ConstLeaf*)node;
+        if (!IsNumber(c->GetTypeKW()))
+        {
+            return Fail();
+        }
+        return Const(c->GetInt(), c->GetTypeKW());
+    }
+    case NodeType::String:
+    {
+        IRInstr* s = Emit(IROp::Str, Keyword::kw_str16);
+        s->text = ((StrLeaf*)node)->data.GetText();
+        return s;
+    }
+    case NodeType::VarLeaf:
+    {
+        Var* v = ((VarLeaf*)node)->data;
+        if (v->is_arr || !IsScalar(v->var_type))
+        {
+            return Fail();
+        }
+        if (Lambda* fn = v->DirectFn())
+        {
+            IRInstr* f = Emit(IROp::Func, Keyword::kw_fn);
+            f->sym = fn->label;
+            return f;
+        }
+        IRInstr* ld = Emit(IROp::Load, v->var_type);
+        ld->var = v;
+        return ld;
+    }
+    case NodeType::ArrayLeaf:
+    {
+        ArrayLeaf* a = (ArrayLeaf*)node;
+        Var* v = a->arr->data;
+        if (m_locals.count(v) || !IsScalar(v->var_type))
+        {
+            return Fail();
+        }
+        IRInstr* ld = Emit(IROp::LoadElem, v->var_type, { Cast(BuildExpr(a->idx), Keyword::kw_i64) });
+        ld->var = v;
+        return ld;
+    }
+    case NodeType::Cvt:
+    {
+        Convert* cvt = (Convert*)node;
+        if (!IsScalar(cvt->to))
+        {
+            return Fail();
+        }
+        return Cast(BuildExpr(cvt->value), cvt->to);
+    }
+    case NodeType::UnOper:
+    {
+        UnOp* op = (UnOp*)node;
+        IRInstr* v = nullptr;
+        switch (op->oper.type)
+        {
+        case TokenType::OperMin:
+        case TokenType::OperNot:
+            v = BuildExpr(op->operand);
+            if (!IsNumber(v->type))
+            {
+                return Fail();
+            }
+            return Emit(op->oper.type == TokenType::OperMin ? IROp::Neg : IROp::Not, v->type, { v });
+        case TokenType::OperInc:
+            return BuildAssign(TokenType::AssignPlus, op->operand, nullptr);
+        case TokenType::OperDec:
+            return BuildAssign(TokenType::AssignMin, op->operand, nullptr);
+        }
+        return Fail();
+    }
+    case NodeType::BinOper:
+    {
+        BinOp* op = (BinOp*)node;
+        if (op->oper.type == TokenType::Assign)
+        {
+            return BuildAssign(op->oper.type, op->l, op->r);
+        }
+        // compound assignments have the destination in r
+        if (op->oper.type >= TokenType::AssignPlus && op->oper.type <= TokenType::AssignXor)
+        {
+            return BuildAssign(op->oper.type, op->r, op->l);
+        }
+
+        IROp ir_op;
+        bool cmp = NegateLOp(op->oper.type) != TokenType::EoF;
+        if (!cmp && !ArithOp(op->oper.type, ir_op))
+        {
+            return Fail();
+        }
+
+        // the left operand is kept in r, the right one is evaluated first
+        IRInstr* b = BuildExpr(op->l);
+        IRInstr* a = BuildExpr(op->r);
+        if (!a->HasValue() || !b->HasValue())
+        {
+            return Fail();
+        }
+
+        if (cmp)
+        {
+            IRInstr* c = Emit(IROp::Cmp, Keyword::kw_bool, { a, Cast(b, a->type) });
+            c->cond = op->oper.type;
+            return c;
+        }
+
+        Keyword t = op->GetTypeKW();
+        if (!IsNumber(t))
+        {
+            return Fail();
+        }
+        return Emit(ir_op, t, { Cast(a, t), Cast(b, t) });
+    }
+    case NodeType::Call:
+    {
+        FnCall* call = (FnCall*)node;
+        Lambda* fn = call->func;
+        if (!fn || (fn->ret_type != Keyword::kw_null && !IsScalar(fn->ret_type)))
+        {
+            return Fail();
+        }
+
+        std::vector<IRInstr*> args;
+        for (size_t i = 0; i < call->params.size(); ++i)
+        {
+            args.push_back(Cast(BuildExpr(call->params[i]), fn->params[i]->var_type));
+        }
+
+        IRInstr* in = Emit(IROp::Call, fn->ret_type, args);
+        in->sym = InternSymbol(call->FnName.GetText());
+        in->callee = fn;
+        return in;
+    }
+    }
+
+    return Fail();
+}
+
+IRInstr* IRBuilder::BuildAssign(TokenType oper, ASTNode* dest, ASTNode* src)
+{
+    bool compound = oper != TokenType::Assign;
+    if (dest->type != NodeType::VarLeaf && dest->type != NodeType::ArrayLeaf)
+    {
+        return Fail();
+    }
+
+    Var* v = dest->type == NodeType::VarLeaf
+        ? ((VarLeaf*)dest)->data
+        : ((ArrayLeaf*)dest)->arr->data;
+    if (!IsScalar(v->var_type) || (dest->type == NodeType::ArrayLeaf && m_locals.count(v)))
+    {
+        return Fail();
+    }
+
+    IRInstr* idx = nullptr;
+    if (dest->type == NodeType::ArrayLeaf)
+    {
+        idx = Cast(BuildExpr(((ArrayLeaf*)dest)->idx), Keyword::kw_i64);
+    }
+
+    // increments have no source, they add one
+    IRInstr* val = src ? BuildExpr(src) : Const(1, v->var_type);
+    if (compound)
+    {
+        IROp ir_op;
+        if (!ArithOp(oper, ir_op) || !IsNumber(v->var_type))
+        {
+            return Fail();
+        }
+
+        IRInstr* old = idx
+            ? Emit(IROp::LoadElem, v->var_type, { idx })
+            : Emit(IROp::Load, v->var_type);
+        old->var = v;
+        val = Emit(ir_op, v->var_type, { old, Cast(val, v->var_type) });
+    }
+    val = Cast(val, v->var_type);
+
+    IRInstr* st = idx
+        ? Emit(IROp::StoreElem, Keyword::kw_null, { idx, val })
+        : Emit(IROp::Store, Keyword::kw_null, { val });
+    st->var = v;
+    return val;
+}
+
+void IRBuilder::BuildCond(ASTNode* cond, IRBlock* t, IRBlock* f)
+{
+    if (cond->type == NodeType::BinOper)
+    {
+        BinOp* op = (BinOp*)cond;
+        if (op->oper.type == TokenType::OperLAnd || op->oper.type == TokenType::OperLOr)
+        {
+            IRBlock* next = m_fn->NewBlock();
+            if (op->oper.type == TokenType::OperLAnd)
+            {
+                BuildCond(op->r, next, f);
+            }
+            else
+            {
+                BuildCond(op->r, t, next);
+            }
+            SetBlock(next);
+            BuildCond(op->l, t, f);
+            return;
+        }
+    }
+
+    if (cond->type == NodeType::UnOper && ((UnOp*)cond)->oper.type == TokenType::OperLNot)
+    {
+        BuildCond(((UnOp*)cond)->operand, f, t);
+        return;
+    }
+
+    IRInstr* c = BuildExpr(cond);
+    if (c->op != IROp::Cmp)
+    {
+        if (!c->HasValue())
+        {
+            Fail();
+            return;
+        }
+        IRInstr* cmp = Emit(IROp::Cmp, Keyword::kw_bool, { c, Const(0, c->type) });
+        cmp->cond = TokenType::OperNEqual;
+        c = cmp;
+    }
+    Branch(c, t, f);
+}
@@ -0,0 +1,55 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <memory>
+#include <unordered_set>
+#include "IR.h"
+
+// Builds the IR of a function from its AST. Parameters and local variables
+// are kept in memory and accessed by Load and Store, the values of
+// expressions are SSA values. Conditions of if-statements and loops become
+// branches, && and || are evaluated by short-circuit jumps.
+class IRBuilder
+{
+    IRFunction* m_fn = nullptr;
+    IRBlock* m_cur = nullptr;
+    std::unordered_set<Var*> m_locals;
+    // set when the function uses something the IR has no form for
+    bool m_failed = false;
+
+    IRBuilder(IRFunction* fn);
+
+    IRInstr* Emit(IROp op, Keyword type, const std::vector<IRInstr*>& args = {});
+    IRInstr* Const(int64_t v, Keyword type);
+    IRInstr* Cast(IRInstr* v, Keyword type);
+    IRInstr* Fail();
+    // makes the block current and adds it to the function
+    void SetBlock(IRBlock* b);
+    void Jump(IRBlock* to);
+    void Branch(IRInstr* cond, IRBlock* t, IRBlock* f);
+
+    void BuildBlock(StatementBlock* b);
+    void BuildStatement(ASTNode* node);
+    IRInstr* BuildExpr(ASTNode* node);
+    // dest = src, or dest <oper>= src for compound assignments
+    IRInstr* BuildAssign(TokenType oper, ASTNode* dest, ASTNode* src);
+    void BuildCond(ASTNode* cond, IRBlock* t, IRBlock* f);
+
+public:
+    // nullptr if the function uses a construction the IR has no form for
+    static std::unique_ptr<IRFunction> Build(Lambda* fn);
+};
@@ -0,0 +1,822 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "IRLowering.h"
+#include "CodeGen.h"
+#include <unordered_set>
+
+IRLowering::Operand IRLowering::Reg(Register r, size_t size)
+{
+    Operand o;
+    o.kind = AsInstr::Operands::Reg;
+    o.reg = CvtReg(r, size);
+    return o;
+}
+
+IRLowering::Operand IRLowering::Stack(int64_t offset, Register base)
+{
+    Operand o;
+    o.kind = AsInstr::Operands::Stack;
+    o.mem = offset;
+    o.base = base;
+    return o;
+}
+
+IRLowering::Operand IRLowering::Label(Symbol s)
+{
+    Operand o;
+    o.kind = AsInstr::Operands::Label;
+    o.sym = s;
+    return o;
+}
+
+IRLowering::Operand IRLowering::Imm(int64_t v)
+{
+    Operand o;
+    o.kind = AsInstr::Operands::Const;
+    o.sym = InternSymbol(std::to_wstring(v));
+    return o;
+}
+
+IRLowering::Operand IRLowering::Elem(Symbol arr, Register idx, size_t size)
+{
+    Operand o;
+    o.kind = AsInstr::Operands::Addr;
+    o.sym = arr;
+    o.reg = idx;
+    o.mem = size;
+    return o;
+}
+
+AsInstr::InstrSuffix IRLowering::CondSuffix(TokenType cond, bool sign)
+{
+    switch (cond)
+    {
+    case TokenType::OperEqual:   return AsInstr::InstrSuffix::c_e;
+    case TokenType::OperNEqual:  return AsInstr::InstrSuffix::c_ne;
+    case TokenType::OperLess:    return sign ? AsInstr::InstrSuffix::c_l : AsInstr::InstrSuffix::c_b;
+    case TokenType::OperGreater: return sign ? AsInstr::InstrSuffix::c_g : AsInstr::InstrSuffix::c_a;
+    case TokenType::OperLEqual:  return sign ? AsInstr::InstrSuffix::c_le : AsInstr::InstrSuffix::c_be;
+    case TokenType::OperGEqual:  return sign ? AsInstr::InstrSuffix::c_ge : AsInstr::InstrSuffix::c_ae;
+    }
+    throw Error(L"Compiler Error: unknown comparison in the IR\n");
+}
+
+IRLowering::IRLowering(IRFunction& fn, std::vector<std::pair<Symbol, String>>& strings, const RegAssignment& regs)
+    : m_fn(fn), m_strings(strings), m_regs(regs)
+{
+    if (m_regs.regs.empty())
+    {
+        m_regs.regs.assign(m_fn.InstrCount(), Register::Last);
+    }
+}
+
+void IRLowering::Put(AsInstr::Instr instr, size_t size, const Operand& a)
+{
+    Put(instr, size, a, Operand());
+}
+
+void IRLowering::Put(AsInstr::Instr instr, size_t size, const Operand& a, const Operand& b)
+{
+    AsInstr in;
+    in.instr = instr;
+    if (size)
+    {
+        in.SetSizeSuffix(size);
+    }
+
+    in.oper1 = a.kind;
+    in.reg1 = a.reg;
+    in.mem1 = a.mem;
+    in.l1 = a.sym;
+
+    in.oper2 = b.kind;
+    in.reg2 = b.reg;
+    in.mem2 = b.mem;
+    in.l2 = b.sym;
+
+    in.stackReg = b.kind == AsInstr::Operands::Stack ? b.base : a.base;
+    m_res.push_back(in);
+}
+
+void IRLowering::PutJump(AsInstr::InstrSuffix suf, IRBlock* to)
+{
+    AsInstr in;
+    in.instr = suf == AsInstr::InstrSuffix::Last ? AsInstr::Instr::as_jmp : AsInstr::Instr::as_j;
+    in.suf = suf;
+    in.oper1 = AsInstr::Operands::Label;
+    in.l1 = m_labels[to->id];
+    m_res.push_back(in);
+}
+
+IRLowering::Operand IRLowering::Val(IRInstr* v)
+{
+    if (v->op == IROp::Const)
+    {
+        return Imm(v->imm);
+    }
+    if (m_regs.regs[v->id] != Register::Last)
+    {
+        return Reg(m_regs.regs[v->id], GetTypeSize(v->type));
+    }
+    return Stack(m_slots[v->id]);
+}
+
+IRLowering::Operand IRLowering::VarOperand(Var* v)
+{
+    auto it = m_vars.find(v);
+    if (it != m_vars.end())
+    {
+        return Stack(it->second);
+    }
+    return Label(v->sym);
+}
+
+IRLowering::Operand IRLowering::Load(IRInstr* v, Register r)
+{
+    size_t size = GetTypeSize(v->type);
+    Operand res = Reg(r, size);
+    if (m_regs.regs[v->id] != r || v->op == IROp::Const)
+    {
+        Put(AsInstr::Instr::as_mov, size, Val(v), res);
+    }
+    return res;
+}
+
+IRLowering::Operand IRLowering::Src(IRInstr* v, Register r)
+{
+    // immediate operands of instructions other than mov are 32 bits long
+    if (v->op == IROp::Const && (v->imm < INT32_MIN || v->imm > INT32_MAX))
+    {
+        return Load(v, r);
+    }
+    return Val(v);
+}
+
+IRLowering::Operand IRLowering::RegOrImm(IRInstr* v, Register r)
+{
+    Operand res = Src(v, r);
+    return res.kind == AsInstr::Operands::Stack ? Load(v, r) : res;
+}
+
+Register IRLowering::Dest(IRInstr* in)
+{
+    Register home = m_regs.regs[in->id];
+    if (home == Register::Last)
+    {
+        return Register::rax;
+    }
+    // the result is written before the other operands are read
+    for (size_t i = 1; i < in->args.size(); ++i)
+    {
+        if (m_regs.regs[in->args[i]->id] == home && in->args[i]->op != IROp::Const)
+        {
+            return Register::rax;
+        }
+    }
+    return home;
+}
+
+IRLowering::Operand IRLowering::Extend(IRInstr* v, Register r, size_t size)
+{
+    size_t from = GetTypeSize(v->type);
+    // constants are already extended by their type
+    if (v->op == IROp::Const)
+    {
+        Operand res = Reg(r, size);
+        Put(AsInstr::Instr::as_mov, size, Val(v), res);
+        return res;
+    }
+    if (from == size)
+    {
+        return Load(v, r);
+    }
+
+    // writing a 32-bit register clears the upper half, the register may also
+    // be the one of the value when it has been narrowed from 64 bits in place
+    if (from == 4 && !IsSigned(v->type))
+    {
+        Put(AsInstr::Instr::as_mov, 4, Val(v), Reg(r, 4));
+        return Reg(r, size);
+    }
+
+    Operand src = Val(v);
+    AsInstr in;
+    in.instr = AsInstr::Instr::as_mov;
+    in.suf = IsSigned(v->type) ? AsInstr::InstrSuffix::x_s : AsInstr::InstrSuffix::x_z;
+    in.SetSizeSuffix(from);
+    in.SetSizeSuffix(size);
+    in.oper1 = src.kind;
+    in.reg1 = src.reg;
+    in.mem1 = src.mem;
+    in.oper2 = AsInstr::Operands::Reg;
+    in.reg2 = CvtReg(r, size);
+    m_res.push_back(in);
+    return Reg(r, size);
+}
+
+void IRLowering::LoadIndex(IRInstr* idx, Var* arr)
+{
+    Operand r = Extend(idx, Register::r11, 8);
+    int64_t start = arr->arr->GetStart();
+    if (start)
+    {
+        Put(AsInstr::Instr::as_sub, 8, Imm(start), r);
+    }
+}
+
+void IRLowering::Def(IRInstr* in, Register r)
+{
+    if (m_regs.regs[in->id] == r)
+    {
+        return;
+    }
+    size_t size = GetTypeSize(in->type);
+    Put(AsInstr::Instr::as_mov, size, Reg(r, size), Val(in));
+}
+
+void IRLowering::Compare(IRInstr* cmp)
+{
+    IRInstr* a = cmp->args[0];
+    size_t size = GetTypeSize(a->type);
+    Operand ra = Val(a);
+    if (ra.kind != AsInstr::Operands::Reg)
+    {
+        ra = Load(a, Register::rax);
+    }
+    Put(AsInstr::Instr::as_cmp, size, Src(cmp->args[1], Register::rcx), ra);
+}
+
+void IRLowering::Branch(TokenType cond, bool sign, IRBlock* t, IRBlock* f)
+{
+    if (t == m_next)
+    {
+        PutJump(CondSuffix(NegateLOp(cond), sign), f);
+        return;
+    }
+
+    PutJump(CondSuffix(cond, sign), t);
+    if (f != m_next)
+    {
+        PutJump(AsInstr::InstrSuffix::Last, f);
+    }
+}
+
+void IRLowering::PhiCopies(IRBlock* b)
+{
+    struct Move
+    {
+        Operand dst, src;
+        size_t size;
+        // the constant when the source is an immediate operand
+        IRInstr* imm;
+    };
+    auto same = [](const Operand& a, const Operand& b) {
+        return a.kind == b.kind && (a.kind == AsInstr::Operands::Reg ? CvtReg(a.reg, 8) == CvtReg(b.reg, 8)
+            : a.kind == AsInstr::Operands::Stack && a.mem == b.mem);
+    };
+
+    IRBlock* s = b->succs[0];
+    size_t k = std::find(s->preds.begin(), s->preds.end(), b) - s->preds.begin();
+    std::vector<Move> moves;
+    for (IRInstr* in : s->instrs)
+    {
+        if (in->op == IROp::Phi && m_uses[in->id])
+        {
+            Move m{ Val(in), Val(in->args[k]), GetTypeSize(in->type), nullptr };
+            if (in->args[k]->op == IROp::Const)
+            {
+                m.imm = in->args[k];
+            }
+            if (!same(m.dst, m.src))
+            {
+                moves.push_back(m);
+            }
+        }
+    }
+
+    while (!moves.empty())
+    {
+        // a move whose destination isn't read by the other ones
+        size_t i = 0;
+        for (; i < moves.size(); ++i)
+        {
+            bool read = false;
+            for (const Move& m : moves)
+            {
+                read = read || same(m.src, moves[i].dst);
+            }
+            if (!read)
+            {
+                break;
+            }
+        }
+
+        // all the moves are in cycles, one of the destinations is kept in rcx
+        if (i == moves.size())
+        {
+            Operand d = moves[0].dst;
+            Operand rcx = Reg(Register::rcx, 8);
+            Put(AsInstr::Instr::as_mov, 8, d.kind == AsInstr::Operands::Reg ? Reg(d.reg, 8) : d, rcx);
+            for (Move& m : moves)
+            {
+                if (same(m.src, d))
+                {
+                    m.src = Reg(Register::rcx, m.size);
+                }
+            }
+            continue;
+        }
+
+        Move m = moves[i];
+        moves.erase(moves.begin() + i);
+        bool wide = m.imm && (m.imm->imm < INT32_MIN || m.imm->imm > INT32_MAX);
+        if (m.dst.kind == AsInstr::Operands::Stack && (m.src.kind == AsInstr::Operands::Stack || wide))
+        {
+            Put(AsInstr::Instr::as_mov, m.size, m.src, Reg(Register::rax, m.size));
+            m.src = Reg(Register::rax, m.size);
+        }
+        Put(AsInstr::Instr::as_mov, m.size, m.src, m.dst);
+    }
+}
+
+bool IRLowering::IsFused(IRInstr* cmp, size_t pos)
+{
+    const std::vector<IRInstr*>& instrs = cmp->block->instrs;
+    return cmp->op == IROp::Cmp && m_uses[cmp->id] == 1 && pos + 1 < instrs.size()
+        && instrs[pos + 1]->op == IROp::Br && instrs[pos + 1]->args[0] == cmp;
+}
+
+void IRLowering::LowerInstr(IRInstr* in)
+{
+    size_t size = in->HasValue() ? GetTypeSize(in->type) : 0;
+    switch (in->op)
+    {
+    case IROp::Const:
+        // constants are written as immediate operands
+        return;
+    case IROp::Str:
+    {
+        Symbol label = CodeGen::GenLabel();
+        m_strings.push_back(std::make_pair(label, String(in->text)));
+        Put(AsInstr::Instr::as_lea, 8, Label(label), Reg(Register::rax, 8));
+        Def(in, Register::rax);
+        return;
+    }
+    case IROp::Func:
+        Put(AsInstr::Instr::as_lea, 8, Label(in->sym), Reg(Register::rax, 8));
+        Def(in, Register::rax);
+        return;
+    case IROp::Param:
+        // the ones passed in registers are taken by the prologue
+        if (m_arg_regs[in->imm] != Register::Last)
+        {
+            return;
+        }
+        [[fallthrough]];
+    case IROp::Load:
+    {
+        Register r = Dest(in);
+        Put(AsInstr::Instr::as_mov, size, VarOperand(in->var), Reg(r, size));
+        Def(in, r);
+        return;
+    }
+    case IROp::Store:
+    {
+        IRInstr* v = in->args[0];
+        Put(AsInstr::Instr::as_mov, GetTypeSize(v->type), RegOrImm(v, Register::rax), VarOperand(in->var));
+        return;
+    }
+    case IROp::LoadElem:
+    {
+        Register r = Dest(in);
+        LoadIndex(in->args[0], in->var);
+        Put(AsInstr::Instr::as_mov, size, Elem(in->var->sym, Register::r11, size), Reg(r, size));
+        Def(in, r);
+        return;
+    }
+    case IROp::StoreElem:
+    {
+        IRInstr* v = in->args[1];
+        size_t vsize = GetTypeSize(v->type);
+        LoadIndex(in->args[0], in->var);
+        Put(AsInstr::Instr::as_mov, vsize, RegOrImm(v, Register::rax), Elem(in->var->sym, Register::r11, vsize));
+        return;
+    }
+    case IROp::Add:
+    case IROp::Sub:
+    case IROp::And:
+    case IROp::Or:
+    case IROp::Xor:
+    {
+        static const AsInstr::Instr ops[] = {
+            AsInstr::Instr::as_add, AsInstr::Instr::as_sub,
+            AsInstr::Instr::as_and, AsInstr::Instr::as_or, AsInstr::Instr::as_xor
+        };
+        size_t i = in->op == IROp::Add ? 0 : in->op == IROp::Sub ? 1
+            : in->op == IROp::And ? 2 : in->op == IROp::Or ? 3 : 4;
+
+        Register r = Dest(in);
+        Operand a = Load(in->args[0], r);
+        Put(ops[i], size, Src(in->args[1], Register::rcx), a);
+        Def(in, r);
+        return;
+    }
+    case IROp::Mul:
+    {
+        // there is no two-operand imul of bytes
+        if (size == 1)
+        {
+            Extend(in->args[0], Register::rax, 4);
+            Extend(in->args[1], Register::rcx, 4);
+            Put(AsInstr::Instr::as_imul, 4, Reg(Register::rcx, 4), Reg(Register::rax, 4));
+            Def(in, Register::rax);
+        }
+        else
+        {
+            Register r = Dest(in);
+            Operand a = Load(in->args[0], r);
+            Put(AsInstr::Instr::as_imul, size, Src(in->args[1], Register::rcx), a);
+            Def(in, r);
+        }
+        return;
+    }
+    case IROp::Div:
+    case IROp::Rem:
+    {
+        // operands are extended to 64 bits, so the quotient has the right sign
+        Extend(in->args[0], Register::rax, 8);
+        Extend(in->args[1], Register::rcx, 8);
+        if (IsSigned(in->type))
+        {
+            m_res.push_back(AsInstr(L"cqto\n"));
+            Put(AsInstr::Instr::as_idiv, 8, Reg(Register::rcx, 8));
+        }
+        else
+        {
+            Put(AsInstr::Instr::as_xor, 8, Reg(Register::rdx, 8), Reg(Register::rdx, 8));
+            Put(AsInstr::Instr::as_div, 8, Reg(Register::rcx, 8));
+        }
+        Def(in, in->op == IROp::Div ? Register::rax : Register::rdx);
+        return;
+    }
+    case IROp::Shl:
+    case IROp::Shr:
+    {
+        AsInstr::Instr op = in->op == IROp::Shl ? AsInstr::Instr::as_shl
+            : IsSigned(in->type) ? AsInstr::Instr::as_sar : AsInstr::Instr::as_shr;
+        Register r = Dest(in);
+        Operand a = Load(in->args[0], r);
+        Load(in->args[1], Register::rcx);
+        Put(op, size, Reg(Register::rcx, 1), a);
+        Def(in, r);
+        return;
+    }
+    case IROp::Neg:
+    case IROp::Not:
+    {
+        Register r = Dest(in);
+        Operand a = Load(in->args[0], r);
+        Put(in->op == IROp::Neg ? AsInstr::Instr::as_neg : AsInstr::Instr::as_not, size, a);
+        Def(in, r);
+        return;
+    }
+    case IROp::Cmp:
+    {
+        Compare(in);
+        AsInstr set;
+        set.instr = AsInstr::Instr::as_set;
+        set.suf = CondSuffix(in->cond, IsSigned(in->args[0]->type));
+        set.oper1 = AsInstr::Operands::Reg;
+        set.reg1 = Register::al;
+        m_res.push_back(set);
+        Def(in, Register::rax);
+        return;
+    }
+    case IROp::Cvt:
+    {
+        IRInstr* v = in->args[0];
+        Register r = Dest(in);
+        // narrowing keeps the lower part of the register
+        if (size <= GetTypeSize(v->type))
+        {
+            Load(v, r);
+        }
+        else
+        {
+            Extend(v, r, size);
+        }
+        Def(in, r);
+        return;
+    }
+    case IROp::Copy:
+    {
+        Register r = Dest(in);
+        Load(in->args[0], r);
+        Def(in, r);
+        return;
+    }
+    case IROp::Phi:
+        // written by the predecessors
+        return;
+    case IROp::Call:
+    {
+        std::vector<Keyword> types;
+        for (IRInstr* arg : in->args)
+        {
+            types.push_back(arg->type);
+        }
+        std::vector<Register> regs = CodeGen::ArgRegisters(types);
+
+        // the stack arguments are written first, they are read from the
+        // registers the moves to the argument registers may change
+        int64_t bytes = 0;
+        std::vector<std::pair<Register, Register>> moves;
+        for (size_t i = 0; i < in->args.size(); ++i)
+        {
+            IRInstr* arg = in->args[i];
+            if (regs[i] == Register::Last)
+            {
+                Put(AsInstr::Instr::as_mov, GetTypeSize(arg->type), RegOrImm(arg, Register::rax), Stack(bytes, Register::rsp));
+                bytes += 8;
+            }
+            else if (m_regs.regs[arg->id] != Register::Last)
+            {
+                moves.emplace_back(m_regs.regs[arg->id], regs[i]);
+            }
+        }
+        m_out_bytes = std::max(m_out_bytes, bytes);
+
+        ParallelMove(moves, Register::rax, m_res);
+        for (size_t i = 0; i < in->args.size(); ++i)
+        {
+            if (regs[i] != Register::Last && m_regs.regs[in->args[i]->id] == Register::Last)
+            {
+                Load(in->args[i], regs[i]);
+            }
+        }
+
+        m_res.push_back(in->callee->label != NoSymbol
+            ? AsInstr(L"call      " + String(SymbolText(in->callee->label)) + L"\n")
+            : AsInstr(L"call      *(" + String(SymbolText(in->sym)) + L")\n"));
+
+        if (in->HasValue())
+        {
+            Def(in, Register::rax);
+        }
+        return;
+    }
+    case IROp::Asm:
+    {
+        m_res.push_back(AsInstr(ExpandAsm(in->text, [this](const String& name)
+        {
+            Symbol s = InternSymbol(name);
+            for (auto& v : m_vars)
+            {
+                if (v.first->sym == s)
+                {
+                    return v.second;
+                }
+            }
+            throw Error(L"Unknown variable " + name + L" in inline assembly\n");
+        })));
+        return;
+    }
+    case IROp::Ret:
+    {
+        if (!in->args.empty())
+        {
+            Load(in->args[0], Register::rax);
+        }
+        for (size_t i = 0; i < m_regs.saved.size(); ++i)
+        {
+            Put(AsInstr::Instr::as_mov, 8, Stack(m_saved_at - 8 * (int64_t)i), Reg(m_regs.saved[i], 8));
+        }
+        m_res.push_back(AsInstr(L"leave\n"));
+        AsInstr ret_in;
+        ret_in.instr = AsInstr::Instr::as_ret;
+        m_res.push_back(ret_in);
+        return;
+    }
+    case IROp::Jmp:
+        PhiCopies(in->block);
+        if (in->block->succs[0] != m_next)
+        {
+            PutJump(AsInstr::InstrSuffix::Last, in->block->succs[0]);
+        }
+        return;
+    case IROp::Br:
+    {
+        IRInstr* c = in->args[0];
+        IRBlock* b = in->block;
+        size_t pos = b->instrs.size() - 2;
+        if (b->instrs.size() >= 2 && b->instrs[pos] == c && IsFused(c, pos))
+        {
+            Compare(c);
+            Branch(c->cond, IsSigned(c->args[0]->type), b->succs[0], b->succs[1]);
+        }
+        else
+        {
+            Put(AsInstr::Instr::as_cmp, 1, Imm(0), Val(c));
+            Branch(TokenType::OperNEqual, false, b->succs[0], b->succs[1]);
+        }
+        return;
+    }
+    }
+}
+
+std::vector<AsInstr> IRLowering::Lower()
+{
+    m_uses.assign(m_fn.InstrCount(), 0);
+    for (IRBlock* b : m_fn.blocks)
+    {
+        for (IRInstr* in : b->instrs)
+        {
+            for (IRInstr* arg : in->args)
+            {
+                ++m_uses[arg->id];
+            }
+        }
+    }
+
+    // parameters are above the return address or in registers, as CodeGen
+    // passes them; the ones in registers get a home in the frame only if they
+    // are loaded, stored or named by inline assembly, the promoted ones are
+    // Param values
+    std::unordered_set<Symbol> homes;
+    for (IRBlock* b : m_fn.blocks)
+    {
+        for (IRInstr* in : b->instrs)
+        {
+            if (in->op == IROp::Load || in->op == IROp::Store)
+            {
+                homes.insert(in->var->sym);
+            }
+            else if (in->op == IROp::Asm)
+            {
+                ExpandAsm(in->text, [&homes](const String& name)
+                {
+                    homes.insert(InternSymbol(name));
+                    return (int64_t)0;
+                });
+            }
+        }
+    }
+
+    std::vector<Keyword> types;
+    for (Var* p : m_fn.params)
+    {
+        types.push_back(p->var_type);
+    }
+    m_arg_regs = CodeGen::ArgRegisters(types);
+    int64_t stack_param = 16;
+    for (size_t i = 0; i < m_fn.params.size(); ++i)
+    {
+        Var* p = m_fn.params[i];
+        if (m_arg_regs[i] == Register::Last)
+        {
+            m_vars[p] = stack_param;
+            stack_param += 8;
+        }
+        else if (homes.count(p->sym))
+        {
+            m_frame += GetTypeSize(p->var_type);
+            m_vars[p] = -m_frame;
+        }
+    }
+
+    for (Var* v : m_fn.locals)
+    {
+        m_frame += GetTypeSize(v->var_type);
+        m_vars[v] = -m_frame;
+    }
+
+    // inline assembly changes the callee-saved registers it names
+    for (IRBlock* b : m_fn.blocks)
+    {
+        for (IRInstr* in : b->instrs)
+        {
+            if (in->op != IROp::Asm)
+            {
+                continue;
+            }
+            for (Register r : CalleeSaved)
+            {
+                bool named = false;
+                for (size_t size : { 1, 2, 4, 8 })
+                {
+                    named = named || in->text.find(L"%" + RegisterStr[(int)CvtReg(r, size)]) != std::wstring_view::npos;
+                }
+                if (named && std::find(m_regs.saved.begin(), m_regs.saved.end(), r) == m_regs.saved.end())
+                {
+                    m_regs.saved.push_back(r);
+                }
+            }
+        }
+    }
+
+    m_frame = (m_frame + 7) / 8 * 8;
+    m_slots.assign(m_fn.InstrCount(), 0);
+    for (IRBlock* b : m_fn.blocks)
+    {
+        for (IRInstr* in : b->instrs)
+        {
+            if (in->HasValue() && in->op != IROp::Const && m_regs.regs[in->id] == Register::Last)
+            {
+                m_frame += 8;
+                m_slots[in->id] = -m_frame;
+            }
+        }
+    }
+    m_saved_at = -(m_frame + 8);
+    m_frame += 8 * m_regs.saved.size();
+    m_frame = (m_frame + 15) / 16 * 16;
+
+    m_labels.resize(m_fn.blocks.size());
+    for (size_t i = 1; i < m_fn.blocks.size(); ++i)
+    {
+        m_labels[i] = CodeGen::GenLabel();
+    }
+
+    Operand rbp, rsp;
+    rbp.kind = rsp.kind = AsInstr::Operands::Reg;
+    rbp.reg = Register::rbp;
+    rsp.reg = Register::rsp;
+    Put(AsInstr::Instr::as_push, 8, rbp);
+    Put(AsInstr::Instr::as_mov, 8, rsp, rbp);
+    // the size is known when the calls are written
+    size_t sub_at = m_res.size();
+    Put(AsInstr::Instr::as_sub, 8, Imm(0), rsp);
+    for (size_t i = 0; i < m_regs.saved.size(); ++i)
+    {
+        Put(AsInstr::Instr::as_mov, 8, Reg(m_regs.saved[i], 8), Stack(m_saved_at - 8 * (int64_t)i));
+    }
+    for (size_t i = 0; i < m_fn.params.size(); ++i)
+    {
+        if (m_arg_regs[i] != Register::Last && m_vars.count(m_fn.params[i]))
+        {
+            size_t size = GetTypeSize(types[i]);
+            Put(AsInstr::Instr::as_mov, size, Reg(m_arg_regs[i], size), Stack(m_vars[m_fn.params[i]]));
+        }
+    }
+
+    // the parameters passed in registers are taken from them as one parallel
+    // copy, before any instruction changes them
+    std::vector<std::pair<Register, Register>> moves;
+    for (IRInstr* in : m_fn.blocks[0]->instrs)
+    {
+        if (in->op != IROp::Param || !m_uses[in->id] || m_arg_regs[in->imm] == Register::Last)
+        {
+            continue;
+        }
+
+        size_t size = GetTypeSize(in->type);
+        if (m_regs.regs[in->id] != Register::Last)
+        {
+            moves.emplace_back(m_arg_regs[in->imm], m_regs.regs[in->id]);
+        }
+        else
+        {
+            Put(AsInstr::Instr::as_mov, size, Reg(m_arg_regs[in->imm], size), Val(in));
+        }
+    }
+    ParallelMove(moves, Register::rax, m_res);
+
+    for (size_t i = 0; i < m_fn.blocks.size(); ++i)
+    {
+        IRBlock* b = m_fn.blocks[i];
+        m_next = i + 1 < m_fn.blocks.size() ? m_fn.blocks[i + 1] : nullptr;
+        if (i > 0)
+        {
+            m_res.push_back(AsInstr(m_labels[i]));
+        }
+
+        for (size_t j = 0; j < b->instrs.size(); ++j)
+        {
+            // the comparison is written by the branch
+            if (IsFused(b->instrs[j], j))
+            {
+                continue;
+            }
+            LowerInstr(b->instrs[j]);
+        }
+    }
+
+    // at least 32 bytes at the bottom, as CodeGen leaves
+    int64_t frame = m_frame + std::max<int64_t>(m_out_bytes, 32);
+    m_res[sub_at].l1 = InternSymbol(std::to_wstring((frame + 15) / 16 * 16));
+    return m_res;
+}
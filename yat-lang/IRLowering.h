@@ -0,0 +1,106 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <unordered_map>
+#include "IR.h"
+#include "AsInstr.h"
+#include "RegAlloc.h"
+
+// Writes the instructions of an IR function with the stack frame and the
+// calling convention of CodeGen: parameters passed in registers are moved to
+// the locations of their values, or stored below %rbp with the locals if they
+// stay in memory, the other ones are above the return address.
+// A value is kept in the register given by the allocator or else in a stack
+// slot of its own, instructions work on the scratch registers rax, rcx, rdx
+// and r11.
+class IRLowering
+{
+    struct Operand
+    {
+        AsInstr::Operands kind = AsInstr::Operands::Last;
+        Register reg{};
+        int64_t mem = 0;
+        Symbol sym = NoSymbol;
+        Register base = Register::rbp;
+    };
+
+    IRFunction& m_fn;
+    std::vector<std::pair<Symbol, String>>& m_strings;
+    std::vector<AsInstr> m_res;
+    // offsets of the variables in the frame
+    std::unordered_map<Var*, int64_t> m_vars;
+    // registers the parameters are passed in, by index
+    std::vector<Register> m_arg_regs;
+    // offsets of the values in the frame and their numbers of uses, by id
+    std::vector<int64_t> m_slots;
+    std::vector<size_t> m_uses;
+    // labels of the blocks, by id
+    std::vector<Symbol> m_labels;
+    RegAssignment m_regs;
+    int64_t m_frame = 0;
+    // offset of the first saved callee-saved register
+    int64_t m_saved_at = 0;
+    // bytes of the stack arguments of the calls, at the bottom of the frame
+    int64_t m_out_bytes = 0;
+    // block written after the current one
+    IRBlock* m_next = nullptr;
+
+    static Operand Reg(Register r, size_t size);
+    static Operand Stack(int64_t offset, Register base = Register::rbp);
+    static Operand Label(Symbol s);
+    static Operand Imm(int64_t v);
+    // element of the array at the label, with the index in the register
+    static Operand Elem(Symbol arr, Register idx, size_t size);
+    static AsInstr::InstrSuffix CondSuffix(TokenType cond, bool sign);
+
+    void Put(AsInstr::Instr instr, size_t size, const Operand& a);
+    void Put(AsInstr::Instr instr, size_t size, const Operand& a, const Operand& b);
+    void PutJump(AsInstr::InstrSuffix suf, IRBlock* to);
+
+    // operand of the value as it is kept
+    Operand Val(IRInstr* v);
+    Operand VarOperand(Var* v);
+    // moves the value to the scratch register
+    Operand Load(IRInstr* v, Register r);
+    // the value as a source operand of an instruction
+    Operand Src(IRInstr* v, Register r);
+    // the value as a source operand of a move, which can't be from memory to memory
+    Operand RegOrImm(IRInstr* v, Register r);
+    // register the result of the instruction is computed in
+    Register Dest(IRInstr* in);
+    // moves the value to the register extending it to the size
+    Operand Extend(IRInstr* v, Register r, size_t size);
+    // moves the index of the array element to r11
+    void LoadIndex(IRInstr* idx, Var* arr);
+    // writes the result of the instruction from the register to its location
+    void Def(IRInstr* in, Register r);
+    // compares the arguments of Cmp
+    void Compare(IRInstr* cmp);
+    void Branch(TokenType cond, bool sign, IRBlock* t, IRBlock* f);
+    // writes the arguments of the phis of the successor to their locations
+    // at the end of the block, as one parallel copy
+    void PhiCopies(IRBlock* b);
+    // TRUE if the comparison is used only by the branch which follows it
+    bool IsFused(IRInstr* cmp, size_t pos);
+
+    void LowerInstr(IRInstr* in);
+
+public:
+    IRLowering(IRFunction& fn, std::vector<std::pair<Symbol, String>>& strings,
+               const RegAssignment& regs = RegAssignment());
+    std::vector<AsInstr> Lower();
+};
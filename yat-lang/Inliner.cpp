@@ -0,0 +1,454 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "Inliner.h"
+
+// largest body, in nodes, inlined without #!(inline)!; every argument
+// makes the call dearer, so it raises the limit
+static constexpr size_t InlineSize = 12;
+static constexpr size_t ArgBonus = 3;
+
+static bool IsRet(ASTNode* node)
+{
+    return node->type == NodeType::UnOper
+        && ((UnOp*)node)->oper.type == TokenType::Keyword
+        && ((UnOp*)node)->oper.kw_type == Keyword::kw_ret;
+}
+
+// TRUE if the node has no value
+static bool IsStatement(ASTNode* node)
+{
+    switch (node->type)
+    {
+    case NodeType::Var:
+    case NodeType::StBlock:
+    case NodeType::IfSt:
+    case NodeType::WhileLoop:
+        return true;
+    case NodeType::UnOper:
+        return ((UnOp*)node)->oper.type == TokenType::Keyword;
+    }
+    return false;
+}
+
+Inliner::Inliner(AST& tree) : m_tree(tree)
+{
+}
+
+void Inliner::Run()
+{
+    for (Namespace* ns : m_tree.prog)
+    {
+        for (ASTNode* node : ns->block->children)
+        {
+            Var* v = (Var*)node;
+            if (node->type == NodeType::Var && v->var_type == Keyword::kw_fn && !v->mut
+                && v->initial && v->initial->type == NodeType::Func && CanInline((Lambda*)v->initial))
+            {
+                m_inline.insert((Lambda*)v->initial);
+            }
+        }
+    }
+
+    for (Namespace* ns : m_tree.prog)
+    {
+        for (ASTNode* node : ns->block->children)
+        {
+            Var* v = (Var*)node;
+            if (node->type == NodeType::Var && v->initial && v->initial->type == NodeType::Func)
+            {
+                Lambda* fn = (Lambda*)v->initial;
+                InlineBlock(fn->def, fn);
+            }
+        }
+    }
+}
+
+bool Inliner::Measure(ASTNode* node, Lambda* fn, bool last, size_t& size)
+{
+    if (!node)
+    {
+        return true;
+    }
+
+    ++size;
+    switch (node->type)
+    {
+    case NodeType::ConstLeaf:
+    case NodeType::String:
+    case NodeType::VarLeaf:
+        return true;
+    case NodeType::ArrayLeaf:
+        return Measure(((ArrayLeaf*)node)->idx, fn, false, size);
+    case NodeType::Cvt:
+        return Measure(((Convert*)node)->value, fn, false, size);
+    case NodeType::Var:
+    {
+        Var* v = (Var*)node;
+        return !v->is_arr && v->var_type != Keyword::kw_fn && Measure(v->initial, fn, false, size);
+    }
+    case NodeType::UnOper:
+    {
+        UnOp* op = (UnOp*)node;
+        // a copy can return only by its last statement
+        if (op->oper.type == TokenType::Keyword
+            && (op->oper.kw_type == Keyword::kw_asm || (op->oper.kw_type == Keyword::kw_ret && !last)))
+        {
+            return false;
+        }
+        return Measure(op->operand, fn, false, size);
+    }
+    case NodeType::BinOper:
+    {
+        BinOp* op = (BinOp*)node;
+        return Measure(op->l, fn, false, size) && Measure(op->r, fn, false, size);
+    }
+    case NodeType::Call:
+    {
+        FnCall* call = (FnCall*)node;
+        if (call->func == fn)
+        {
+            return false;
+        }
+        for (ASTNode* p : call->params)
+        {
+            if (!Measure(p, fn, false, size))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case NodeType::StBlock:
+    {
+        for (ASTNode* n : ((StatementBlock*)node)->children)
+        {
+            if (!Measure(n, fn, false, size))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case NodeType::IfSt:
+    {
+        IfStatement* st = (IfStatement*)node;
+        return Measure(st->condition, fn, false, size)
+            && Measure(st->then_b, fn, false, size)
+            && Measure(st->else_b, fn, false, size);
+    }
+    case NodeType::WhileLoop:
+    {
+        WhileLoop* lp = (WhileLoop*)node;
+        return Measure(lp->condition, fn, false, size) && Measure(lp->body, fn, false, size);
+    }
+    }
+
+    return false;
+}
+
+bool Inliner::CanInline(Lambda* fn)
+{
+    if (fn->inline_hint == Lambda::InlineHint::never || !fn->def)
+    {
+        return false;
+    }
+
+    for (Var* p : fn->params)
+    {
+        if (p->is_arr)
+        {
+            return false;
+        }
+    }
+
+    size_t size = 0;
+    const std::vector<ASTNode*>& body = fn->def->children;
+    for (size_t i = 0; i < body.size(); ++i)
+    {
+        if (!Measure(body[i], fn, i + 1 == body.size(), size))
+        {
+            return false;
+        }
+    }
+
+    // the value is returned by the last statement
+    if (fn->ret_type != Keyword::kw_null
+        && (body.empty() || !IsRet(body.back()) || IsStatement(((UnOp*)body.back())->operand)))
+    {
+        return false;
+    }
+
+    return fn->inline_hint == Lambda::InlineHint::always
+        || size <= InlineSize + ArgBonus * fn->params.size();
+}
+
+ASTNode* Inliner::Copy(ASTNode* node)
+{
+    if (!node)
+    {
+        return nullptr;
+    }
+
+    ASTNode* res = nullptr;
+    switch (node->type)
+    {
+    case NodeType::ConstLeaf:
+    case NodeType::String:
+        // leaves aren't changed by anything, copies can share them
+        return node;
+    case NodeType::VarLeaf:
+    {
+        Var* v = ((VarLeaf*)node)->data;
+        auto it = m_copies.find(v);
+        res = new VarLeaf(it != m_copies.end() ? it->second : v);
+        break;
+    }
+    case NodeType::ArrayLeaf:
+    {
+        ArrayLeaf* a = (ArrayLeaf*)node;
+        res = new ArrayLeaf(a->arr->data, Copy(a->idx));
+        break;
+    }
+    case NodeType::Cvt:
+    {
+        Convert* cvt = (Convert*)node;
+        res = new Convert(Copy(cvt->value), cvt->to);
+        break;
+    }
+    case NodeType::Var:
+    {
+        Var* v = (Var*)node;
+        Var* c = new Var(v->name + L".inl" + std::to_wstring(m_count), v->var_type, v->mut);
+        c->type_params = v->type_params;
+        c->initial = Copy(v->initial);
+        m_copies[v] = c;
+        m_bytes += GetTypeSize(v->var_type);
+        res = c;
+        break;
+    }
+    case NodeType::UnOper:
+    {
+        UnOp* op = (UnOp*)node;
+        UnOp* c = new UnOp();
+        c->oper = op->oper;
+        c->operand = Copy(op->operand);
+        res = c;
+        break;
+    }
+    case NodeType::BinOper:
+    {
+        BinOp* op = (BinOp*)node;
+        BinOp* c = new BinOp();
+        c->oper = op->oper;
+        c->l = Copy(op->l);
+        c->r = Copy(op->r);
+        res = c;
+        break;
+    }
+    case NodeType::Call:
+    {
+        FnCall* call = (FnCall*)node;
+        FnCall* c = new FnCall();
+        c->FnName = call->FnName;
+        c->func = call->func;
+        for (ASTNode* p : call->params)
+        {
+            c->params.push_back(Copy(p));
+        }
+        res = c;
+        break;
+    }
+    case NodeType::StBlock:
+    {
+        StatementBlock* b = (StatementBlock*)node;
+        StatementBlock* c = new StatementBlock();
+        c->bytes = b->bytes;
+        c->is_fn = b->is_fn;
+        for (ASTNode* n : b->children)
+        {
+            c->children.push_back(Copy(n));
+        }
+        res = c;
+        break;
+    }
+    case NodeType::IfSt:
+    {
+        IfStatement* st = (IfStatement*)node;
+        IfStatement* c = new IfStatement();
+        c->condition = Copy(st->condition);
+        c->then_b = (StatementBlock*)Copy(st->then_b);
+        c->else_b = (StatementBlock*)Copy(st->else_b);
+        res = c;
+        break;
+    }
+    case NodeType::WhileLoop:
+    {
+        WhileLoop* lp = (WhileLoop*)node;
+        WhileLoop* c = new WhileLoop();
+        c->condition = Copy(lp->condition);
+        c->body = (StatementBlock*)Copy(lp->body);
+        res = c;
+        break;
+    }
+    default:
+        return node;
+    }
+
+    res->res_type = node->res_type;
+    return res;
+}
+
+ASTNode** Inliner::FindCall(ASTNode** st)
+{
+    ASTNode* node = *st;
+    ASTNode** place = nullptr;
+    switch (node->type)
+    {
+    case NodeType::Call:
+        place = st;
+        break;
+    case NodeType::Var:
+        place = &((Var*)node)->initial;
+        break;
+    case NodeType::BinOper:
+    {
+        // the call must be the first thing evaluated,
+        // so only variables are assigned
+        BinOp* op = (BinOp*)node;
+        if (op->oper.type == TokenType::Assign && op->l->type == NodeType::VarLeaf)
+        {
+            place = &op->r;
+        }
+        else if (op->oper.type >= TokenType::AssignPlus && op->oper.type <= TokenType::AssignXor
+            && op->r->type == NodeType::VarLeaf)
+        {
+            place = &op->l;
+        }
+        break;
+    }
+    case NodeType::UnOper:
+        if (IsRet(node))
+        {
+            place = &((UnOp*)node)->operand;
+        }
+        break;
+    }
+
+    if (!place || !*place)
+    {
+        return nullptr;
+    }
+    if ((*place)->type == NodeType::Cvt)
+    {
+        place = &((Convert*)*place)->value;
+    }
+    if ((*place)->type != NodeType::Call || !m_inline.count(((FnCall*)*place)->func))
+    {
+        return nullptr;
+    }
+    return place;
+}
+
+bool Inliner::Expand(ASTNode** place, bool is_stmt, std::vector<ASTNode*>& res)
+{
+    FnCall* call = (FnCall*)*place;
+    Lambda* fn = call->func;
+    const std::vector<ASTNode*>& body = fn->def->children;
+    ASTNode* ret = !body.empty() && IsRet(body.back()) ? ((UnOp*)body.back())->operand : nullptr;
+    if (!is_stmt && (fn->ret_type == Keyword::kw_null || !ret || IsStatement(ret)))
+    {
+        return false;
+    }
+
+    m_copies.clear();
+    m_bytes = 0;
+    ++m_count;
+    for (size_t i = 0; i < fn->params.size(); ++i)
+    {
+        Var* p = fn->params[i];
+        Var* c = new Var(p->name + L".inl" + std::to_wstring(m_count), p->var_type);
+        c->initial = call->params[i];
+        if (GetTypeSize(c->initial->GetTypeKW()) != GetTypeSize(p->var_type))
+        {
+            c->initial = new Convert(c->initial, p->var_type);
+        }
+        m_copies[p] = c;
+        m_bytes += GetTypeSize(p->var_type);
+        res.push_back(c);
+    }
+
+    for (size_t i = 0; i + (ret ? 1 : 0) < body.size(); ++i)
+    {
+        res.push_back(Copy(body[i]));
+    }
+
+    if (!ret)
+    {
+        *place = nullptr;
+        return true;
+    }
+
+    ASTNode* v = Copy(ret);
+    if (!IsStatement(v) && fn->ret_type != Keyword::kw_null
+        && GetTypeSize(v->GetTypeKW()) != GetTypeSize(fn->ret_type))
+    {
+        v = new Convert(v, fn->ret_type);
+    }
+    *place = v;
+    return true;
+}
+
+void Inliner::InlineBlock(StatementBlock* b, Lambda* fn)
+{
+    size_t i = 0;
+    while (i < b->children.size())
+    {
+        ASTNode* st = b->children[i];
+        switch (st->type)
+        {
+        case NodeType::IfSt:
+            InlineBlock(((IfStatement*)st)->then_b, fn);
+            if (((IfStatement*)st)->else_b)
+            {
+                InlineBlock(((IfStatement*)st)->else_b, fn);
+            }
+            break;
+        case NodeType::WhileLoop:
+            InlineBlock(((WhileLoop*)st)->body, fn);
+            break;
+        }
+
+        ASTNode** place = FindCall(&b->children[i]);
+        std::vector<ASTNode*> stmts;
+        if (!place || !Expand(place, place == &b->children[i], stmts))
+        {
+            ++i;
+            continue;
+        }
+
+        // the variables of the copy live in the frame of the function
+        fn->def->bytes += m_bytes;
+        if (b->children[i])
+        {
+            stmts.push_back(b->children[i]);
+        }
+        b->children.erase(b->children.begin() + i);
+        b->children.insert(b->children.begin() + i, stmts.begin(), stmts.end());
+        // calls in the copies are left as they are
+        i += stmts.size();
+    }
+}
@@ -0,0 +1,59 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <unordered_map>
+#include <unordered_set>
+#include "AST.h"
+
+// Replaces calls of small functions bound to immutable global variables by
+// copies of their bodies. A call is inlined where it is a statement of its
+// own, the initial value of a variable, the value assigned to a variable or
+// the value returned. The arguments are copied to new immutable variables,
+// so each of them is still evaluated once and in order. Functions with
+// inline assembly, returns before the end, nested functions or local arrays
+// and recursive ones are never inlined, of the others the ones marked by
+// #!(inline)! and the small ones are, unless marked by #!(noinline)!.
+class Inliner
+{
+    AST& m_tree;
+    // functions which can be inlined
+    std::unordered_set<Lambda*> m_inline;
+    // copies of the variables of the function being inlined
+    std::unordered_map<Var*, Var*> m_copies;
+    // number of functions inlined, it makes the names of the copies unique
+    size_t m_count = 0;
+    // size of the variables of the last copy
+    size_t m_bytes = 0;
+
+    // FALSE if the subtree has something a copy can't have,
+    // size is increased by the number of its nodes
+    bool Measure(ASTNode* node, Lambda* fn, bool last, size_t& size);
+    bool CanInline(Lambda* fn);
+
+    ASTNode* Copy(ASTNode* node);
+    // place of the call to inline in the statement, nullptr if there is none
+    ASTNode** FindCall(ASTNode** st);
+    // statements which compute the call in the place, the place is
+    // replaced by the returned value; FALSE if it cannot be inlined there
+    bool Expand(ASTNode** place, bool is_stmt, std::vector<ASTNode*>& res);
+    // fn is the function the block belongs to
+    void InlineBlock(StatementBlock* b, Lambda* fn);
+
+public:
+    Inliner(AST& tree);
+    void Run();
+};
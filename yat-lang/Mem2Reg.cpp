@@ -0,0 +1,417 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "Mem2Reg.h"
+#include <algorithm>
+#include <unordered_set>
+#include "AsInstr.h"
+
+Mem2Reg::Mem2Reg(IRFunction& fn)
+    : m_fn(fn)
+{
+}
+
+void Mem2Reg::Run(IRFunction& fn)
+{
+    // the entry must not be a join point, its phis would have no value for
+    // the way from the caller
+    if (!fn.blocks[0]->preds.empty())
+    {
+        return;
+    }
+
+    // the variables inline assembly refers to must stay in memory
+    std::unordered_set<Symbol> named;
+    for (IRBlock* b : fn.blocks)
+    {
+        for (IRInstr* in : b->instrs)
+        {
+            if (in->op == IROp::Asm)
+            {
+                ExpandAsm(in->text, [&named](const String& name)
+                {
+                    named.insert(InternSymbol(name));
+                    return (int64_t)0;
+                });
+            }
+        }
+    }
+
+    Mem2Reg m(fn);
+    for (auto* vars : { &fn.params, &fn.locals })
+    {
+        for (Var* v : *vars)
+        {
+            if (!named.count(v->sym))
+            {
+                m.m_vars.emplace(v, m.m_vars.size());
+            }
+        }
+    }
+    if (m.m_vars.empty())
+    {
+        return;
+    }
+    m.m_stacks.resize(m.m_vars.size());
+    m.m_initial.resize(m.m_vars.size());
+
+    m.SplitCriticalEdges();
+    m.FindDominators();
+    m.PlacePhis();
+    m.Rename(fn.blocks[0]);
+
+    for (IRBlock* b : fn.blocks)
+    {
+        b->instrs.erase(std::remove_if(b->instrs.begin(), b->instrs.end(), [&m](IRInstr* in) {
+            return (in->op == IROp::Load || in->op == IROp::Store) && m.Promoted(in);
+        }), b->instrs.end());
+    }
+
+    // the initial values are computed before everything else
+    std::vector<IRInstr*>& entry = fn.blocks[0]->instrs;
+    for (IRInstr* in : m.m_initial)
+    {
+        if (in)
+        {
+            entry.insert(entry.begin(), in);
+        }
+    }
+    m.Prune();
+
+    fn.locals.erase(std::remove_if(fn.locals.begin(), fn.locals.end(), [&m](Var* v) {
+        return m.m_vars.count(v) != 0;
+    }), fn.locals.end());
+}
+
+void Mem2Reg::SplitCriticalEdges()
+{
+    for (size_t i = 0, n = m_fn.blocks.size(); i < n; ++i)
+    {
+        IRBlock* p = m_fn.blocks[i];
+        if (p->succs.size() < 2)
+        {
+            continue;
+        }
+        for (IRBlock*& s : p->succs)
+        {
+            if (s->preds.size() < 2)
+            {
+                continue;
+            }
+
+            IRBlock* b = m_fn.NewBlock();
+            b->id = (unsigned)m_fn.blocks.size();
+            m_fn.blocks.push_back(b);
+            IRInstr* jmp = m_fn.NewInstr(IROp::Jmp, Keyword::kw_null);
+            jmp->block = b;
+            b->instrs.push_back(jmp);
+            b->preds.push_back(p);
+            b->succs.push_back(s);
+
+            // both successors of a branch may be the same block
+            *std::find(s->preds.begin(), s->preds.end(), p) = b;
+            s = b;
+        }
+    }
+}
+
+void Mem2Reg::FindDominators()
+{
+    size_t n = m_fn.blocks.size();
+    // reverse postorder, by an explicit stack of blocks and their next successors
+    std::vector<IRBlock*> rpo;
+    std::vector<size_t> order(n, SIZE_MAX);
+    std::vector<bool> seen(n);
+    std::vector<std::pair<IRBlock*, size_t>> stack{ { m_fn.blocks[0], 0 } };
+    seen[0] = true;
+    while (!stack.empty())
+    {
+        auto& top = stack.back();
+        if (top.second < top.first->succs.size())
+        {
+            IRBlock* s = top.first->succs[top.second++];
+            if (!seen[s->id])
+            {
+                seen[s->id] = true;
+                stack.push_back({ s, 0 });
+            }
+            continue;
+        }
+        rpo.push_back(top.first);
+        stack.pop_back();
+    }
+    std::reverse(rpo.begin(), rpo.end());
+    for (size_t i = 0; i < rpo.size(); ++i)
+    {
+        order[rpo[i]->id] = i;
+    }
+
+    // the iterative algorithm of Cooper, Harvey and Kennedy
+    m_idom.assign(n, nullptr);
+    m_idom[0] = m_fn.blocks[0];
+    auto intersect = [&](IRBlock* a, IRBlock* b) {
+        while (a != b)
+        {
+            while (order[a->id] > order[b->id])
+            {
+                a = m_idom[a->id];
+            }
+            while (order[b->id] > order[a->id])
+            {
+                b = m_idom[b->id];
+            }
+        }
+        return a;
+    };
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t i = 1; i < rpo.size(); ++i)
+        {
+            IRBlock* b = rpo[i];
+            IRBlock* idom = nullptr;
+            for (IRBlock* p : b->preds)
+            {
+                if (m_idom[p->id])
+                {
+                    idom = idom ? intersect(p, idom) : p;
+                }
+            }
+            if (m_idom[b->id] != idom)
+            {
+                m_idom[b->id] = idom;
+                changed = true;
+            }
+        }
+    }
+
+    m_children.assign(n, {});
+    m_frontier.assign(n, {});
+    for (size_t i = 1; i < rpo.size(); ++i)
+    {
+        IRBlock* b = rpo[i];
+        m_children[m_idom[b->id]->id].push_back(b);
+        if (b->preds.size() < 2)
+        {
+            continue;
+        }
+        for (IRBlock* p : b->preds)
+        {
+            for (IRBlock* r = p; r != m_idom[b->id]; r = m_idom[r->id])
+            {
+                std::vector<IRBlock*>& df = m_frontier[r->id];
+                if (std::find(df.begin(), df.end(), b) == df.end())
+                {
+                    df.push_back(b);
+                }
+            }
+        }
+    }
+}
+
+void Mem2Reg::PlacePhis()
+{
+    std::vector<std::vector<IRBlock*>> defs(m_vars.size());
+    for (IRBlock* b : m_fn.blocks)
+    {
+        for (IRInstr* in : b->instrs)
+        {
+            if (in->op == IROp::Store && Promoted(in))
+            {
+                defs[m_vars[in->var]].push_back(b);
+            }
+        }
+    }
+
+    for (auto& [v, i] : m_vars)
+    {
+        // the blocks of the iterated dominance frontier of the stores
+        std::vector<bool> placed(m_fn.blocks.size()), queued(m_fn.blocks.size());
+        std::vector<IRBlock*> work = defs[i];
+        for (IRBlock* b : work)
+        {
+            queued[b->id] = true;
+        }
+        while (!work.empty())
+        {
+            IRBlock* b = work.back();
+            work.pop_back();
+            for (IRBlock* f : m_frontier[b->id])
+            {
+                if (placed[f->id])
+                {
+                    continue;
+                }
+                placed[f->id] = true;
+
+                IRInstr* phi = m_fn.NewInstr(IROp::Phi, v->var_type);
+                phi->var = v;
+                phi->block = f;
+                phi->args.resize(f->preds.size());
+                f->instrs.insert(f->instrs.begin(), phi);
+                if (!queued[f->id])
+                {
+                    queued[f->id] = true;
+                    work.push_back(f);
+                }
+            }
+        }
+    }
+}
+
+void Mem2Reg::Rename(IRBlock* b)
+{
+    std::vector<size_t> depth(m_stacks.size());
+    for (size_t i = 0; i < m_stacks.size(); ++i)
+    {
+        depth[i] = m_stacks[i].size();
+    }
+
+    for (IRInstr* in : b->instrs)
+    {
+        if (!Promoted(in))
+        {
+            continue;
+        }
+        size_t i = m_vars[in->var];
+        if (in->op == IROp::Phi)
+        {
+            m_stacks[i].push_back(in);
+        }
+        else if (in->op == IROp::Load)
+        {
+            m_repl[in] = Current(in->var);
+        }
+        else if (in->op == IROp::Store)
+        {
+            m_stacks[i].push_back(Resolve(in->args[0]));
+        }
+    }
+
+    for (IRBlock* s : b->succs)
+    {
+        size_t k = std::find(s->preds.begin(), s->preds.end(), b) - s->preds.begin();
+        for (IRInstr* in : s->instrs)
+        {
+            if (in->op == IROp::Phi && Promoted(in))
+            {
+                in->args[k] = Current(in->var);
+            }
+        }
+    }
+
+    for (IRBlock* c : m_children[b->id])
+    {
+        Rename(c);
+    }
+    for (size_t i = 0; i < m_stacks.size(); ++i)
+    {
+        m_stacks[i].resize(depth[i]);
+    }
+}
+
+void Mem2Reg::Prune()
+{
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        std::vector<size_t> uses(m_fn.InstrCount());
+        for (IRBlock* b : m_fn.blocks)
+        {
+            for (IRInstr* in : b->instrs)
+            {
+                for (IRInstr*& arg : in->args)
+                {
+                    arg = Resolve(arg);
+                    if (arg != in)
+                    {
+                        ++uses[arg->id];
+                    }
+                }
+            }
+        }
+
+        for (IRBlock* b : m_fn.blocks)
+        {
+            b->instrs.erase(std::remove_if(b->instrs.begin(), b->instrs.end(), [&](IRInstr* in) {
+                if (in->op != IROp::Phi)
+                {
+                    return false;
+                }
+                IRInstr* same = nullptr;
+                bool trivial = true;
+                for (IRInstr* arg : in->args)
+                {
+                    if (arg == in || arg == same)
+                    {
+                        continue;
+                    }
+                    if (same)
+                    {
+                        trivial = false;
+                        break;
+                    }
+                    same = arg;
+                }
+                if (!uses[in->id] || (trivial && same))
+                {
+                    if (trivial && same)
+                    {
+                        m_repl[in] = same;
+                    }
+                    changed = true;
+                    return true;
+                }
+                return false;
+            }), b->instrs.end());
+        }
+    }
+}
+
+IRInstr* Mem2Reg::Resolve(IRInstr* v)
+{
+    for (auto it = m_repl.find(v); it != m_repl.end(); it = m_repl.find(v))
+    {
+        v = it->second;
+    }
+    return v;
+}
+
+IRInstr* Mem2Reg::Current(Var* v)
+{
+    size_t i = m_vars[v];
+    if (!m_stacks[i].empty())
+    {
+        return m_stacks[i].back();
+    }
+    if (!m_initial[i])
+    {
+        auto param = std::find(m_fn.params.begin(), m_fn.params.end(), v);
+        bool is_param = param != m_fn.params.end();
+        IRInstr* in = m_fn.NewInstr(is_param ? IROp::Param : IROp::Const, v->var_type);
+        in->var = is_param ? v : nullptr;
+        in->imm = is_param ? param - m_fn.params.begin() : 0;
+        in->block = m_fn.blocks[0];
+        m_initial[i] = in;
+    }
+    return m_initial[i];
+}
+
+bool Mem2Reg::Promoted(IRInstr* in) const
+{
+    return (in->op == IROp::Load || in->op == IROp::Store || in->op == IROp::Phi)
+        && in->var && m_vars.count(in->var);
+}
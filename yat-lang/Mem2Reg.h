@@ -0,0 +1,56 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <unordered_map>
+#include "IR.h"
+
+// Promotes the parameters and local variables kept in memory to SSA values:
+// a load becomes the value stored last, phis are placed where the values
+// stored on different paths meet. Variables named by @LVAR in inline assembly
+// stay in memory. Critical edges are split first, so the copies of the phi
+// arguments can be written at the ends of the predecessors.
+class Mem2Reg
+{
+    IRFunction& m_fn;
+    // promoted variables, by their index in the stacks of the values
+    std::unordered_map<Var*, size_t> m_vars;
+    std::vector<std::vector<IRInstr*>> m_stacks;
+    // values of the variables before any store: the parameters as they are
+    // passed, the locals are zero
+    std::vector<IRInstr*> m_initial;
+    // immediate dominators, children in the dominator tree and dominance
+    // frontiers, by block id
+    std::vector<IRBlock*> m_idom;
+    std::vector<std::vector<IRBlock*>> m_children, m_frontier;
+    // loads and phis replaced by other values
+    std::unordered_map<IRInstr*, IRInstr*> m_repl;
+
+    Mem2Reg(IRFunction& fn);
+
+    void SplitCriticalEdges();
+    void FindDominators();
+    void PlacePhis();
+    void Rename(IRBlock* b);
+    // removes phis which aren't used or have one value
+    void Prune();
+    IRInstr* Resolve(IRInstr* v);
+    IRInstr* Current(Var* v);
+    bool Promoted(IRInstr* in) const;
+
+public:
+    static void Run(IRFunction& fn);
+};
@@ -0,0 +1,207 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include <filesystem>
+#include <thread>
+#include "Module.h"
+#include "ModuleCache.h"
+
+ModuleLoader::ModuleLoader(const String& lib_path, unsigned threads, ModuleCache* cache)
+{
+    m_lib_path = lib_path;
+    m_cache = cache;
+    m_threads = threads ? threads : std::thread::hardware_concurrency();
+    if (m_threads == 0)
+    {
+        m_threads = 1;
+    }
+}
+
+ModuleLoader::~ModuleLoader()
+{
+    for (auto& m : m_loaded)
+    {
+        delete m.second->tok;
+        delete m.second;
+    }
+}
+
+const std::vector<Module*>& ModuleLoader::LoadAll(const String& input)
+{
+    m_input = input;
+    Add(input);
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < m_threads; ++i)
+    {
+        workers.emplace_back(&ModuleLoader::Work, this);
+    }
+    Work();
+    for (std::thread& w : workers)
+    {
+        w.join();
+    }
+
+    std::unordered_set<Module*> visited;
+    Order(m_loaded[input], visited);
+    return m_modules;
+}
+
+void ModuleLoader::Add(const String& path)
+{
+    if (m_loaded.count(path))
+    {
+        return;
+    }
+
+    Module* m = new Module();
+    m->path = path;
+    m_loaded[path] = m;
+    m_queue.push_back(m);
+    ++m_busy;
+}
+
+void ModuleLoader::Work()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_cv.wait(lock, [this] { return !m_queue.empty() || m_busy == 0; });
+        if (m_queue.empty())
+        {
+            return;
+        }
+
+        Module* m = m_queue.front();
+        m_queue.pop_front();
+
+        lock.unlock();
+        Load(m);
+        lock.lock();
+
+        for (const String& p : m->imports)
+        {
+            Add(p);
+        }
+        --m_busy;
+        m_cv.notify_all();
+    }
+}
+
+void ModuleLoader::Load(Module* m)
+{
+    // the input file changes every time, so it isn't cached
+    if (m_cache && m->path != m_input && m_cache->Find(*m))
+    {
+        bool found = true;
+        for (const String& name : m->import_names)
+        {
+            found = found && AddImport(m, name);
+        }
+
+        if (found)
+        {
+            return;
+        }
+        // let the lexer report the missing folder
+        m->imports.clear();
+    }
+    Lex(m);
+}
+
+void ModuleLoader::Lex(Module* m)
+{
+    try
+    {
+        m->tok = new Tokenizer({ m->path });
+        m->toks = m->tok->LexAll();
+        m->import_names.clear();
+        m->imports.clear();
+
+        // import "folder"; takes all files from the folder of the standard library
+        for (uint32_t i : m->toks.imports)
+        {
+            Token t = m->toks.Get(i + 1);
+            if (t.type != TokenType::String)
+            {
+                m->tok->UnexpToken(L"invalid token in import statement\n", &t);
+            }
+
+            m->import_names.push_back(String(t.GetText()));
+            if (!AddImport(m, m->import_names.back()))
+            {
+                m->tok->UnexpToken(L"Cannot find imported folder " + m_lib_path + m->import_names.back(), &t);
+            }
+        }
+    }
+    catch (...)
+    {
+        m->imports.clear();
+        m->error = std::current_exception();
+    }
+}
+
+bool ModuleLoader::AddImport(Module* m, const String& name)
+{
+    String dir = m_lib_path + name;
+    if (!std::filesystem::is_directory(dir))
+    {
+        return false;
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator(dir))
+    {
+        m->imports.push_back(entry.path().wstring());
+    }
+    return true;
+}
+
+void ModuleLoader::LexNow(Module* m)
+{
+    if (m->tok)
+    {
+        return;
+    }
+
+    Lex(m);
+    if (m->error)
+    {
+        std::rethrow_exception(m->error);
+    }
+}
+
+void ModuleLoader::Order(Module* m, std::unordered_set<Module*>& visited)
+{
+    if (!visited.insert(m).second)
+    {
+        return;
+    }
+
+    // report the same error as loading the files one by one would
+    if (m->error)
+    {
+        std::rethrow_exception(m->error);
+    }
+
+    m->key = m->hash;
+    for (const String& p : m->imports)
+    {
+        Module* imp = m_loaded[p];
+        Order(imp, visited);
+        m->key = ModuleCache::Combine(m->key, imp->key);
+    }
+    m_modules.push_back(m);
+}
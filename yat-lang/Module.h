@@ -0,0 +1,96 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "Tokenizer.h"
+
+class ModuleCache;
+
+// a source file lexed once, it must live until the code is generated
+// since the tokens and the AST view its text
+struct Module
+{
+    String path{};
+    // NULL while the module has a cached AST and isn't lexed
+    Tokenizer* tok = nullptr;
+    TokenArray toks{};
+    // folders named by the import statements
+    std::vector<String> import_names{};
+    // paths of the files it imports in the order of the import statements
+    std::vector<String> imports{};
+    // what was thrown while loading the file, it's rethrown by LoadAll
+    std::exception_ptr error{};
+
+    // hash of the contents of the file and the compiler, 0 for the files
+    // which are not cached
+    uint64_t hash = 0;
+    // the hash combined with the keys of all the imports,
+    // a cached AST is used only if it was stored with the same key
+    uint64_t key = 0;
+    // cache entry found by the hash, empty if there is none
+    std::string cached{};
+};
+
+// Loads a file together with everything it imports, directly or not.
+// Only lexing is parallel: a worker lexes a file, then queues the files
+// it imports that haven't been seen yet. The files are parsed one by one in
+// the order of m_modules, since the parser resolves names and infers the
+// types of `let' variables from the declarations of the imports.
+class ModuleLoader
+{
+    String m_lib_path;
+    String m_input;
+    unsigned m_threads;
+    ModuleCache* m_cache;
+
+    // all the modules by path
+    std::unordered_map<String, Module*> m_loaded;
+    // modules in the order they must be parsed: imports go before the importing file
+    std::vector<Module*> m_modules;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Module*> m_queue;
+    // modules queued or being lexed
+    size_t m_busy = 0;
+
+    // must be called with m_mutex locked
+    void Add(const String& path);
+    void Load(Module* m);
+    void Lex(Module* m);
+    // adds the files of an imported folder, FALSE if there is no such folder
+    bool AddImport(Module* m, const String& name);
+    void Work();
+    void Order(Module* m, std::unordered_set<Module*>& visited);
+
+public:
+    // threads = 0 uses all the cores, without a cache every file is lexed
+    ModuleLoader(const String& lib_path, unsigned threads = 0, ModuleCache* cache = nullptr);
+    ModuleLoader(const ModuleLoader&) = delete;
+    ModuleLoader& operator=(const ModuleLoader&) = delete;
+    ~ModuleLoader();
+
+    const std::vector<Module*>& LoadAll(const String& input);
+    // lexes a module loaded from the cache, whose cached AST cannot be used
+    void LexNow(Module* m);
+};
@@ -0,0 +1,714 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <unordered_map>
+#include "ModuleCache.h"
+#include "Module.h"
+#include "Parser.h"
+#include "FileMapping.h"
+
+// Version of the cached trees. Bump it whenever the layout of the entries or
+// the nodes the parser builds for the same source change, the entries of
+// other versions are never used.
+static constexpr uint32_t FormatVersion = 3;
+// "YATC"
+static constexpr uint32_t Magic = 0x43544159;
+
+// FNV-1a
+static uint64_t Hash(const void* data, size_t n, uint64_t h = 14695981039346656037ull)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < n; ++i)
+    {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// entries are keyed by the source and the format version
+static const uint64_t CompilerHash = Hash(&FormatVersion, sizeof(FormatVersion));
+
+uint64_t ModuleCache::Combine(uint64_t h, uint64_t v)
+{
+    return h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2));
+}
+
+// Everything the AST of a module may take from a declaration of another
+// module: the types which decide the conversions and the checks.
+static uint64_t Signature(const ASTNode* n)
+{
+    uint64_t h = ModuleCache::Combine(0, (uint64_t)n->type);
+    if (n->type == NodeType::Var)
+    {
+        const Var* v = (const Var*)n;
+        h = ModuleCache::Combine(h, (uint64_t)v->var_type);
+        h = ModuleCache::Combine(h, v->mut | (v->is_arr << 1));
+        if (!v->initial || v->initial->type != NodeType::Func)
+        {
+            return h;
+        }
+        n = v->initial;
+    }
+
+    if (n->type == NodeType::Func)
+    {
+        const Lambda* f = (const Lambda*)n;
+        h = ModuleCache::Combine(h, (uint64_t)f->ret_type);
+        for (const Var* p : f->params)
+        {
+            h = ModuleCache::Combine(h, (uint64_t)p->var_type);
+        }
+    }
+    return h;
+}
+
+// thrown on a broken entry or on a declaration which has changed since the entry was written
+struct BadEntry
+{
+};
+
+class CacheWriter
+{
+    std::string& m_out;
+    // Vars and Lambdas of the module, references to them are written as their indices
+    std::unordered_map<const ASTNode*, uint32_t> m_ids;
+
+public:
+    CacheWriter(std::string& out) : m_out(out)
+    {
+    }
+
+    template<class T>
+    void Put(T v)
+    {
+        m_out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    void PutStr(std::wstring_view s)
+    {
+        Put((uint32_t)s.size());
+        m_out.append(reinterpret_cast<const char*>(s.data()), s.size() * sizeof(wchar_t));
+    }
+
+    void PutToken(const Token& t)
+    {
+        Put((uint16_t)t.type);
+        Put((uint16_t)t.kw_type);
+        PutStr(t.GetText());
+        Put(t.num.u);
+        PutStr(SymbolText(t.sym));
+    }
+
+    // a declaration of another module is written by its name and signature
+    void PutRef(const ASTNode* target, Symbol sym)
+    {
+        auto it = m_ids.find(target);
+        if (it != m_ids.end())
+        {
+            Put<uint8_t>(1);
+            Put(it->second);
+            return;
+        }
+
+        if (!target)
+        {
+            throw BadEntry();
+        }
+        Put<uint8_t>(0);
+        PutStr(SymbolText(sym));
+        Put(Signature(target));
+    }
+
+    void PutNode(const ASTNode* n);
+};
+
+void CacheWriter::PutNode(const ASTNode* n)
+{
+    if (!n)
+    {
+        Put((uint8_t)NodeType::None);
+        return;
+    }
+
+    Put((uint8_t)n->type);
+    switch (n->type)
+    {
+    case NodeType::BinOper:
+    {
+        const BinOp* v = (const BinOp*)n;
+        PutToken(v->oper);
+        PutNode(v->l);
+        PutNode(v->r);
+        break;
+    }
+    case NodeType::UnOper:
+    {
+        const UnOp* v = (const UnOp*)n;
+        PutToken(v->oper);
+        PutNode(v->operand);
+        break;
+    }
+    case NodeType::Call:
+    {
+        const FnCall* v = (const FnCall*)n;
+        PutToken(v->FnName);
+        PutRef(v->func, v->FnName.sym);
+        Put((uint32_t)v->params.size());
+        for (const ASTNode* p : v->params)
+        {
+            PutNode(p);
+        }
+        break;
+    }
+    case NodeType::Func:
+    {
+        const Lambda* v = (const Lambda*)n;
+        m_ids.emplace(v, (uint32_t)m_ids.size());
+        Put((uint16_t)v->ret_type);
+        Put((uint8_t)v->inline_hint);
+        Put((uint32_t)v->params.size());
+        for (const Var* p : v->params)
+        {
+            PutNode(p);
+        }
+        PutNode(v->def);
+        break;
+    }
+    case NodeType::ConstLeaf:
+        PutToken(((const ConstLeaf*)n)->data);
+        break;
+    case NodeType::VarLeaf:
+    {
+        const Var* v = ((const VarLeaf*)n)->data;
+        PutRef(v, v->sym);
+        break;
+    }
+    case NodeType::ArrayLeaf:
+    {
+        const ArrayLeaf* v = (const ArrayLeaf*)n;
+        PutRef(v->arr->data, v->arr->data->sym);
+        PutNode(v->idx);
+        break;
+    }
+    case NodeType::StBlock:
+    {
+        const StatementBlock* v = (const StatementBlock*)n;
+        Put((uint64_t)v->bytes);
+        Put((uint8_t)v->is_fn);
+        Put((uint32_t)v->children.size());
+        for (const ASTNode* c : v->children)
+        {
+            PutNode(c);
+        }
+        break;
+    }
+    case NodeType::Var:
+    {
+        const Var* v = (const Var*)n;
+        m_ids.emplace(v, (uint32_t)m_ids.size());
+        PutStr(v->name);
+        Put((uint16_t)v->var_type);
+        Put((uint32_t)v->type_params.size());
+        for (Keyword k : v->type_params)
+        {
+            Put((uint16_t)k);
+        }
+        Put((uint8_t)(v->mut | (v->is_arr << 1) | (v->is_param << 2)));
+        PutNode(v->arr);
+        PutNode(v->initial);
+        break;
+    }
+    case NodeType::Range:
+    {
+        const Range* v = (const Range*)n;
+        Put(v->flags);
+        PutNode(v->l);
+        PutNode(v->r);
+        break;
+    }
+    case NodeType::String:
+        PutToken(((const StrLeaf*)n)->data);
+        break;
+    case NodeType::Cvt:
+    {
+        const Convert* v = (const Convert*)n;
+        Put((uint16_t)v->to);
+        PutNode(v->value);
+        break;
+    }
+    case NodeType::IfSt:
+    {
+        const IfStatement* v = (const IfStatement*)n;
+        PutNode(v->condition);
+        PutNode(v->then_b);
+        PutNode(v->else_b);
+        break;
+    }
+    case NodeType::WhileLoop:
+    {
+        const WhileLoop* v = (const WhileLoop*)n;
+        PutNode(v->condition);
+        PutNode(v->body);
+        break;
+    }
+    default:
+        throw BadEntry();
+    }
+    Put((uint16_t)n->res_type);
+}
+
+class CacheReader
+{
+    const std::string& m_in;
+    size_t m_pos = 0;
+    // resolves the declarations of other modules, NULL while only the header is read
+    Parser* m_parser;
+    // Vars and Lambdas in the order they were written
+    std::vector<ASTNode*> m_objs;
+
+public:
+    CacheReader(const std::string& in, Parser* parser) : m_in(in), m_parser(parser)
+    {
+    }
+
+    bool AtEnd() const
+    {
+        return m_pos == m_in.size();
+    }
+
+    template<class T>
+    T Get()
+    {
+        if (m_in.size() - m_pos < sizeof(T))
+        {
+            throw BadEntry();
+        }
+
+        T v;
+        std::memcpy(&v, m_in.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return v;
+    }
+
+    String GetStr()
+    {
+        uint32_t n = Get<uint32_t>();
+        if ((m_in.size() - m_pos) / sizeof(wchar_t) < n)
+        {
+            throw BadEntry();
+        }
+
+        String s(n, L'\0');
+        std::memcpy(&s[0], m_in.data() + m_pos, n * sizeof(wchar_t));
+        m_pos += n * sizeof(wchar_t);
+        return s;
+    }
+
+    Token GetToken()
+    {
+        Token t;
+        t.type = (TokenType)Get<uint16_t>();
+        t.kw_type = (Keyword)Get<uint16_t>();
+        t.SetOwnText(GetStr());
+        t.num.u = Get<uint64_t>();
+        String sym = GetStr();
+        t.sym = sym.empty() ? NoSymbol : InternSymbol(sym);
+        return t;
+    }
+
+    ASTNode* GetRef(NodeType type);
+    ASTNode* GetNode();
+
+    // a node which must be either NULL or of the type
+    template<class T>
+    T* GetNodeOf(NodeType type)
+    {
+        ASTNode* n = GetNode();
+        if (n && n->type != type)
+        {
+            throw BadEntry();
+        }
+        return (T*)n;
+    }
+};
+
+ASTNode* CacheReader::GetRef(NodeType type)
+{
+    ASTNode* n = nullptr;
+    if (Get<uint8_t>())
+    {
+        uint32_t id = Get<uint32_t>();
+        if (id >= m_objs.size())
+        {
+            throw BadEntry();
+        }
+        n = m_objs[id];
+    }
+    else
+    {
+        Var* v = m_parser->FindGlobal(InternSymbol(GetStr()));
+        n = v && type == NodeType::Func ? v->initial : v;
+        if (!n || Signature(n) != Get<uint64_t>())
+        {
+            throw BadEntry();
+        }
+    }
+
+    if (n->type != type)
+    {
+        throw BadEntry();
+    }
+    return n;
+}
+
+ASTNode* CacheReader::GetNode()
+{
+    ASTNode* res = nullptr;
+    switch ((NodeType)Get<uint8_t>())
+    {
+    case NodeType::None:
+        return nullptr;
+    case NodeType::BinOper:
+    {
+        BinOp* v = new BinOp();
+        v->oper = GetToken();
+        v->l = GetNode();
+        v->r = GetNode();
+        res = v;
+        break;
+    }
+    case NodeType::UnOper:
+    {
+        UnOp* v = new UnOp();
+        v->oper = GetToken();
+        v->operand = GetNode();
+        res = v;
+        break;
+    }
+    case NodeType::Call:
+    {
+        FnCall* v = new FnCall();
+        v->FnName = GetToken();
+        v->func = (Lambda*)GetRef(NodeType::Func);
+        uint32_t n = Get<uint32_t>();
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            v->params.push_back(GetNode());
+        }
+        res = v;
+        break;
+    }
+    case NodeType::Func:
+    {
+        Lambda* v = new Lambda();
+        m_objs.push_back(v);
+        v->ret_type = (Keyword)Get<uint16_t>();
+        v->inline_hint = (Lambda::InlineHint)Get<uint8_t>();
+        uint32_t n = Get<uint32_t>();
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            Var* p = GetNodeOf<Var>(NodeType::Var);
+            if (!p)
+            {
+                throw BadEntry();
+            }
+            v->params.push_back(p);
+        }
+        v->def = GetNodeOf<StatementBlock>(NodeType::StBlock);
+        res = v;
+        break;
+    }
+    case NodeType::ConstLeaf:
+        res = new ConstLeaf(GetToken());
+        break;
+    case NodeType::VarLeaf:
+        res = new VarLeaf((Var*)GetRef(NodeType::Var));
+        break;
+    case NodeType::ArrayLeaf:
+    {
+        Var* arr = (Var*)GetRef(NodeType::Var);
+        res = new ArrayLeaf(arr, GetNode());
+        break;
+    }
+    case NodeType::StBlock:
+    {
+        StatementBlock* v = new StatementBlock();
+        v->bytes = (size_t)Get<uint64_t>();
+        v->is_fn = Get<uint8_t>() != 0;
+        uint32_t n = Get<uint32_t>();
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            v->children.push_back(GetNode());
+        }
+        res = v;
+        break;
+    }
+    case NodeType::Var:
+    {
+        Var* v = new Var();
+        m_objs.push_back(v);
+        v->name = GetStr();
+        v->sym = InternSymbol(v->name);
+        v->var_type = (Keyword)Get<uint16_t>();
+        uint32_t n = Get<uint32_t>();
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            v->type_params.push_back((Keyword)Get<uint16_t>());
+        }
+        uint8_t flags = Get<uint8_t>();
+        v->mut = flags & 1;
+        v->is_arr = flags & 2;
+        v->is_param = flags & 4;
+        v->arr = GetNodeOf<Range>(NodeType::Range);
+        v->initial = GetNode();
+        res = v;
+        break;
+    }
+    case NodeType::Range:
+    {
+        Range* v = new Range();
+        v->flags = Get<uint8_t>();
+        v->l = GetNodeOf<ConstLeaf>(NodeType::ConstLeaf);
+        v->r = GetNodeOf<ConstLeaf>(NodeType::ConstLeaf);
+        res = v;
+        break;
+    }
+    case NodeType::String:
+        res = new StrLeaf(GetToken());
+        break;
+    case NodeType::Cvt:
+    {
+        Keyword to = (Keyword)Get<uint16_t>();
+        res = new Convert(GetNode(), to);
+        break;
+    }
+    case NodeType::IfSt:
+    {
+        IfStatement* v = new IfStatement();
+        v->condition = GetNode();
+        v->then_b = GetNodeOf<StatementBlock>(NodeType::StBlock);
+        v->else_b = GetNodeOf<StatementBlock>(NodeType::StBlock);
+        res = v;
+        break;
+    }
+    case NodeType::WhileLoop:
+    {
+        WhileLoop* v = new WhileLoop();
+        v->condition = GetNode();
+        v->body = GetNodeOf<StatementBlock>(NodeType::StBlock);
+        res = v;
+        break;
+    }
+    default:
+        throw BadEntry();
+    }
+    res->res_type = (Keyword)Get<uint16_t>();
+    return res;
+}
+
+ModuleCache::ModuleCache(const String& dir)
+{
+    m_dir = dir;
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(m_dir), ec);
+}
+
+String ModuleCache::EntryPath(uint64_t hash) const
+{
+    wchar_t name[17];
+    for (int i = 15; i >= 0; --i)
+    {
+        name[i] = L"0123456789abcdef"[hash & 15];
+        hash >>= 4;
+    }
+    name[16] = L'\0';
+    return (std::filesystem::path(m_dir) / (String(name) + L".yatc")).wstring();
+}
+
+bool ModuleCache::Find(Module& m) const
+{
+    FileMapping src(m.path);
+    if (!src.IsOpen())
+    {
+        return false;
+    }
+    m.hash = Hash(src.Data(), src.Size(), CompilerHash);
+
+    FileMapping entry(EntryPath(m.hash));
+    if (!entry.IsOpen())
+    {
+        return false;
+    }
+    m.cached.assign(entry.Data(), entry.Size());
+
+    try
+    {
+        CacheReader r(m.cached, nullptr);
+        if (r.Get<uint32_t>() != Magic || r.Get<uint32_t>() != FormatVersion)
+        {
+            throw BadEntry();
+        }
+        r.Get<uint64_t>(); // the key, checked by Load
+
+        uint32_t n = r.Get<uint32_t>();
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            m.import_names.push_back(r.GetStr());
+        }
+    }
+    catch (const BadEntry&)
+    {
+        m.cached.clear();
+        m.import_names.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ModuleCache::Load(Module& m, Parser& parser, AST& ast) const
+{
+    if (m.cached.empty())
+    {
+        return false;
+    }
+
+    std::vector<Namespace*> nspaces;
+    try
+    {
+        CacheReader r(m.cached, &parser);
+        r.Get<uint32_t>(); // magic and version, checked by Find
+        r.Get<uint32_t>();
+        if (r.Get<uint64_t>() != m.key)
+        {
+            return false;
+        }
+
+        uint32_t n = r.Get<uint32_t>();
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            r.GetStr();
+        }
+
+        n = r.Get<uint32_t>();
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            Namespace* ns = new Namespace();
+            nspaces.push_back(ns);
+            ns->name = r.GetStr();
+            ns->sym = InternSymbol(ns->name);
+
+            uint32_t uses = r.Get<uint32_t>();
+            for (uint32_t j = 0; j < uses; ++j)
+            {
+                ns->uses.push_back(InternSymbol(r.GetStr()));
+            }
+
+            ns->block = r.GetNodeOf<StatementBlock>(NodeType::StBlock);
+            if (!ns->block)
+            {
+                throw BadEntry();
+            }
+        }
+
+        if (!r.AtEnd())
+        {
+            throw BadEntry();
+        }
+    }
+    catch (const BadEntry&)
+    {
+        // the nodes read so far stay in the arena of the AST until it's destroyed
+        for (Namespace* ns : nspaces)
+        {
+            delete ns;
+        }
+        return false;
+    }
+
+    for (Namespace* ns : nspaces)
+    {
+        parser.AddNamespace(ast, ns);
+    }
+    return true;
+}
+
+void ModuleCache::Store(const Module& m, const std::vector<Namespace*>& nspaces) const
+{
+    if (!m.hash)
+    {
+        return;
+    }
+
+    std::string out;
+    try
+    {
+        CacheWriter w(out);
+        w.Put(Magic);
+        w.Put(FormatVersion);
+        w.Put(m.key);
+        w.Put((uint32_t)m.import_names.size());
+        for (const String& name : m.import_names)
+        {
+            w.PutStr(name);
+        }
+
+        w.Put((uint32_t)nspaces.size());
+        for (const Namespace* ns : nspaces)
+        {
+            w.PutStr(ns->name);
+            w.Put((uint32_t)ns->uses.size());
+            for (Symbol s : ns->uses)
+            {
+                w.PutStr(SymbolText(s));
+            }
+            w.PutNode(ns->block);
+        }
+    }
+    catch (const BadEntry&)
+    {
+        return;
+    }
+
+    // Another compilation may be reading or writing the same entry, so it's
+    // written to a temporary file which then replaces the entry at once.
+    String path = EntryPath(m.hash);
+    uint64_t tag = std::hash<std::thread::id>()(std::this_thread::get_id())
+        ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    String tmp = path + L"." + std::to_wstring(tag);
+
+    std::error_code ec;
+    {
+        std::ofstream f(std::filesystem::path(tmp), std::ios::binary);
+        if (!f.write(out.data(), out.size()))
+        {
+            f.close();
+            std::filesystem::remove(std::filesystem::path(tmp), ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(std::filesystem::path(tmp), std::filesystem::path(path), ec);
+    if (ec)
+    {
+        std::filesystem::remove(std::filesystem::path(tmp), ec);
+    }
+}
@@ -0,0 +1,53 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Utils.h"
+
+struct Module;
+class Parser;
+class AST;
+class Namespace;
+
+// Namespaces parsed from a file, stored in a folder so the files which don't
+// change, like the standard library, are not lexed and parsed by every
+// compilation. An entry is found by the contents of its file and the build of
+// the compiler. Its AST is used only if it was stored with the same key of
+// the module, so a change in any file it imports, directly or not, makes it
+// stale. Broken or stale entries are ignored and overwritten.
+class ModuleCache
+{
+    String m_dir;
+
+    String EntryPath(uint64_t hash) const;
+
+public:
+    ModuleCache(const String& dir);
+
+    // hashes the file of the module and reads its entry with the names of
+    // the imported folders, FALSE if there is none; it is thread-safe
+    bool Find(Module& m) const;
+    // adds the cached namespaces of the module to the AST and makes their
+    // declarations visible to the parser, FALSE if the entry cannot be used
+    bool Load(Module& m, Parser& parser, AST& ast) const;
+    // writes the namespaces parsed from the module
+    void Store(const Module& m, const std::vector<Namespace*>& nspaces) const;
+
+    static uint64_t Combine(uint64_t h, uint64_t v);
+};
@@ -15,12 +15,13 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 //
 #include <sstream>
+#include <algorithm>
 #include "Parser.h"
 #include "ErrorChecking.h"
 
-#define NEXT_TOK { prev_tok = cur_tok; cur_tok = m_tok->Next(); }
+#define NEXT_TOK { prev_tok = cur_tok; cur_tok = NextToken(); }
 
-#define MATCH(_ttype, _msg) cur_tok = m_tok->Next();            \
+#define MATCH(_ttype, _msg) cur_tok = NextToken();              \
 if (cur_tok.type != TokenType:: ##_ttype) {                     \
     m_tok->UnexpToken(_msg, &cur_tok);                          \
 }
@@ -30,9 +31,41 @@ if (cur_tok.type != TokenType:: ##_ttype) {                     \
     m_tok->UnexpToken(_msg, &cur_tok);                          \
 } 
 
-Parser::Parser(Tokenizer* t)
+Parser::Parser(Tokenizer* t, const TokenArray* toks)
 {
     m_tok = t;
+    m_toks = toks;
+}
+
+void Parser::SetSource(Tokenizer* t, const TokenArray* toks)
+{
+    m_tok = t;
+    m_toks = toks;
+    m_pos = 0;
+    m_nspace = nullptr;
+    m_pp.Reset();
+    cur_tok = Token();
+    prev_tok = Token();
+}
+
+Token Parser::NextToken()
+{
+    if (!m_toks)
+    {
+        Token t = m_tok->Next();
+        if (t.type == TokenType::Name || t.type == TokenType::Keyword)
+        {
+            t.sym = InternSymbol(t.GetText());
+        }
+        return t;
+    }
+
+    if (m_pos >= m_toks->Size())
+    {
+        Token t = m_toks->Get(m_toks->Size() - 1);
+        m_tok->UnexpToken(L"End of file", &t);
+    }
+    return m_toks->Get(m_pos++);
 }
 
 void Parser::Parse(AST& ast)
@@ -46,7 +79,7 @@ void Parser::Parse(AST& ast)
             m_nspace = new Namespace();
         }
 
-        if (cur_tok.data == L"import")
+        if (cur_tok.GetText() == L"import")
         {
             NEXT_TOK;
             NEXT_TOK;
@@ -67,9 +100,10 @@ void Parser::Parse(AST& ast)
                     while (cur_tok.type == TokenType::Dot
                         || cur_tok.type == TokenType::Name)
                     {
-                        m_nspace->name += cur_tok.data;
+                        m_nspace->name += cur_tok.GetText();
                         NEXT_TOK;
                     }
+                    m_nspace->sym = InternSymbol(m_nspace->name);
                 }
                 else
                 {
@@ -108,28 +142,44 @@ void Parser::Parse(AST& ast)
     }
 }
 
-Var* Parser::GetVariable(String v, String* fname)
+Var* Parser::FindGlobal(Symbol sym) const
+{
+    return m_vars.Find(sym);
+}
+
+void Parser::AddNamespace(AST& ast, Namespace* ns)
+{
+    // the same scope as ParseBlock leaves for the namespace
+    m_vars.Push();
+    for (ASTNode* n : ns->block->children)
+    {
+        if (n->type == NodeType::Var && !m_vars.Add((Var*)n, m_vars.Size() - 1))
+        {
+            throw Error(L"Variable " + ((Var*)n)->name + L" has already been defined\n");
+        }
+    }
+    ast.prog.push_back(ns);
+}
+
+Var* Parser::GetVariable(Symbol v)
 {
     Var* res = GetVariable_(v);
     if (res)
     {
-        if (fname) *fname = res->name;
         return res; 
     }
 
-    res = GetVariable_(m_nspace->name + L"." + v);
+    res = GetVariable_(QualifySymbol(m_nspace->sym, v));
     if (res)
     {
-        if (fname) *fname = res->name;
         return res;
     }
 
-    for (String& s : m_nspace->uses)
+    for (Symbol s : m_nspace->uses)
     {
-        res = GetVariable_(s + L"." + v);
+        res = GetVariable_(QualifySymbol(s, v));
         if (res)
         {
-            if (fname) *fname = res->name;
             return res; 
         }
     }
@@ -140,13 +190,11 @@ Var* Parser::GetVariable(String v, String* fname)
         if (cur_tok.type == TokenType::Dot)
         {
             NEXT_TOK;
-            v += L".";
-            v += cur_tok.data;
+            v = QualifySymbol(v, cur_tok.sym);
         }
         res = GetVariable(v);
         if (res)
         {
-            if (fname) *fname = res->name;
             return res;
         }
     }
@@ -154,52 +202,64 @@ Var* Parser::GetVariable(String v, String* fname)
     return nullptr;
 }
 
-inline Var* Parser::GetVariable_(const String& v)
+inline Var* Parser::GetVariable_(Symbol v)
 {
-    for (auto& vec : m_vars)
+    return m_vars.Find(v);
+}
+
+inline void Parser::AddVariable(Var* var, int64_t idx)
+{
+    if (!m_vars.Add(var, idx < 0 ? m_vars.Size() - 1 : idx))
     {
-        for (Var* vv : vec)
-        {
-            if (vv->name == v)
-            {
-                return vv;
-            }
-        }
+        std::wstringstream ss;
+        ss << L"Variable " << var->name << (var->mut ? L"mut " : L"")
+            << " has already been defined";
+        m_tok->UnexpToken(ss.str(), &cur_tok);
     }
+}
 
-    return nullptr;
+void Parser::Scopes::Push(const std::vector<Var*>& vars)
+{
+    m_scopes.push_back(vars);
+    for (Var* v : vars)
+    {
+        m_table.emplace(v->sym, v);
+    }
 }
 
-inline void Parser::AddVariable(Var* var, int64_t idx)
+void Parser::Scopes::Pop()
 {
-    for (auto& vec : m_vars)
+    for (Var* v : m_scopes.back())
     {
-        for (Var* vv : vec)
+        auto it = m_table.find(v->sym);
+        if (it != m_table.end() && it->second == v)
         {
-            if (vv->name == var->name)
-            {
-                std::wstringstream ss;
-                ss << L"Variable " << var->name << (var->mut ? L"mut " : L"")
-                    << " has already been defined";
-                m_tok->UnexpToken(ss.str(), &cur_tok);
-            }
+            m_table.erase(it);
         }
     }
+    m_scopes.pop_back();
+}
 
-    if (idx < 0)
-    {
-        m_vars[m_vars.size() - 1].push_back(var);
-    }
-    else
+bool Parser::Scopes::Add(Var* var, size_t scope)
+{
+    if (!m_table.emplace(var->sym, var).second)
     {
-        m_vars[idx].push_back(var);
+        return false;
     }
+    m_scopes[scope].push_back(var);
+    return true;
+}
+
+Var* Parser::Scopes::Find(Symbol sym) const
+{
+    auto it = m_table.find(sym);
+    return it == m_table.end() ? nullptr : it->second;
 }
 
 StatementBlock* Parser::ParseBlock(bool is_fn)
 {
     StatementBlock* r = new StatementBlock();
-    m_vars.push_back({});
+    m_vars.Push();
 
     while (cur_tok.type != TokenType::RBrace
         && cur_tok.type != TokenType::EoF)
@@ -249,6 +309,7 @@ StatementBlock* Parser::ParseBlock(bool is_fn)
 
                 Keyword expr_type;
                 ret->operand = ParseExpression(false, expr_type);
+                ret->Typify();
                 // TODO: check if the type is valid (maybe not right here)
 
                 r->children.push_back(ret);
@@ -284,8 +345,8 @@ StatementBlock* Parser::ParseBlock(bool is_fn)
 
                 UnOp* res = new UnOp();
                 res->oper = top;
-                cur_tok = m_tok->ParseRawUntil(L'}');
                 res->operand = new ConstLeaf(cur_tok);
+                res->Typify();
                 r->children.push_back(res);
 
                 NEXT_TOK;
@@ -322,13 +383,13 @@ StatementBlock* Parser::ParseBlock(bool is_fn)
         }*/
     }
 
-    for (Var* v : m_vars[m_vars.size() - 1])
+    for (Var* v : m_vars.Top())
     {
         r->bytes += GetTypeSize(v->var_type) * (v->is_arr ? v->arr->GetSize() : 1);
     }
 
     m_pp.Reset();
-    if (is_fn) m_vars.pop_back();
+    if (is_fn) m_vars.Pop();
     r->is_fn = is_fn;
     NEXT_TOK;
     return r;
@@ -390,7 +451,7 @@ ASTNode* Parser::ParseExpression(bool fn, Keyword& exp_type)
         Lambda* r = new Lambda();
         r->params = ParseParamList();
 
-        m_vars.push_back(r->params); // push all parameters
+        m_vars.Push(r->params); // push all parameters
 
         MATCH_CUR(Arrow, L"Expected function return type after arrow '->'.");
         NEXT_TOK;
@@ -415,7 +476,7 @@ ASTNode* Parser::ParseExpression(bool fn, Keyword& exp_type)
                 sb->children.push_back(s);
             }
         }
-        m_vars.pop_back();
+        m_vars.Pop();
 
         r->def = sb;
         r->ret_type = ret_type;
@@ -431,7 +492,7 @@ ASTNode* Parser::ParseExpression(bool fn, Keyword& exp_type)
         return ParseRange();
     }
 
-    ASTNode* node = ShuntingYard();
+    ASTNode* node = ParseBinary(0);
 
     if (cur_tok.type == TokenType::Semi)
     {
@@ -454,7 +515,7 @@ inline IfStatement* Parser::ParseIf()
     st->condition = ParseExpression(false, et);
     if (et != Keyword::kw_bool)
     {
-        m_tok->UnexpToken(L"Expected a boolean expression", new Token(L"", ts.type, ts.start, prev_tok.end, ts.line));
+        m_tok->UnexpToken(L"Expected a boolean expression", new Token(L"", ts.type, ts.start, prev_tok.end));
     }
 
     if (cur_tok.type != TokenType::LBrace)
@@ -525,7 +586,7 @@ inline std::vector<Var*> Parser::ParseParamList()
 Var* Parser::ParseVarDecl(bool add)
 {
     Keyword var_type = Keyword::Last;
-    String name;
+    Symbol sym = NoSymbol;
     bool mut = false, is_arr = false;
     Range* array_rgn = nullptr;
     std::vector<TemplateParam> temp_params;
@@ -590,7 +651,7 @@ Var* Parser::ParseVarDecl(bool add)
                         {
                             array_rgn = new Range(
                                 new ConstLeaf(
-                                    Token(L"0", TokenType::Uint64L, 0, 0, 0)
+                                    Token(L"0", TokenType::Uint64L, 0, 0)
                                 ),
                                 (ConstLeaf*)range,
                                 Range::LeftInclusive
@@ -611,7 +672,7 @@ Var* Parser::ParseVarDecl(bool add)
         }
         else if (cur_tok.type == TokenType::Name)
         {
-            name = m_nspace->name + L"." + cur_tok.data;
+            sym = QualifySymbol(m_nspace->sym, cur_tok.sym);
         }
         else if (cur_tok.type == TokenType::OperLess)
         {
@@ -628,7 +689,8 @@ Var* Parser::ParseVarDecl(bool add)
     Var* r = new Var();
     r->mut = mut;
     r->var_type = var_type;
-    r->name = name;
+    r->sym = sym;
+    r->name = String(SymbolText(sym));
     r->arr = array_rgn;
     r->is_arr = is_arr;
 
@@ -642,9 +704,16 @@ Var* Parser::ParseVarDecl(bool add)
             Keyword ret_type;
             Lambda* init = (Lambda*)ParseExpression(true, ret_type);
             r->initial = init;
+            if (m_pp.fn_hint != PPDir::Last)
+            {
+                init->inline_hint = m_pp.fn_hint == PPDir::inline_fn
+                    ? Lambda::InlineHint::always
+                    : Lambda::InlineHint::never;
+                m_pp.fn_hint = PPDir::Last;
+            }
             r->var_type = Keyword::kw_fn;
 
-            AddVariable(r, m_vars.size() - 2); // add variable before parsing to allow recursion
+            AddVariable(r, m_vars.Size() - 2); // add variable before parsing to allow recursion
 
             StatementBlock* sb;
             if (cur_tok.type == TokenType::LBrace)
@@ -664,13 +733,14 @@ Var* Parser::ParseVarDecl(bool add)
                 if (init->GetTypeKW() != Keyword::kw_null)
                 {
                     UnOp* ret = new UnOp();
-                    ret->oper = Token(L"ret", TokenType::Keyword, 0, 0, 0, Keyword::kw_ret);
+                    ret->oper = Token(L"ret", TokenType::Keyword, 0, 0, Keyword::kw_ret);
                     ret->operand = sb->children[sb->children.size() - 1];
+                    ret->Typify();
 
                     sb->children[sb->children.size() - 1] = ret;
                 }
             }
-            m_vars.pop_back();
+            m_vars.Pop();
 
             init->def = sb;
             init->ret_type = ret_type;
@@ -698,6 +768,7 @@ Var* Parser::ParseVarDecl(bool add)
     {
         r->var_type = kw;
     }
+    r->Typify();
 
     return r;
 }
@@ -712,7 +783,7 @@ inline void Parser::ParseTypeParams(std::vector<TemplateParam>& p)
         }
         else if (cur_tok.type == TokenType::Name)
         {
-            p.push_back(cur_tok.data);
+            p.push_back(String(cur_tok.GetText()));
         }
         else
         {
@@ -726,7 +797,7 @@ inline void Parser::ParseTypeParams(std::vector<TemplateParam>& p)
     }
 }
 
-inline String Parser::ParseUsing()
+inline Symbol Parser::ParseUsing()
 {
     NEXT_TOK;
     String r = L"";
@@ -735,7 +806,7 @@ inline String Parser::ParseUsing()
     {
         if (cur_tok.type == TokenType::Name || cur_tok.type == TokenType::Dot)
         {
-            r += cur_tok.data;
+            r += cur_tok.GetText();
         }
         else
         {
@@ -745,7 +816,7 @@ inline String Parser::ParseUsing()
     }
 
     NEXT_TOK;
-    return r;
+    return InternSymbol(r);
 }
 
 inline void Parser::ParsePreProc()
@@ -753,10 +824,18 @@ inline void Parser::ParsePreProc()
     while (cur_tok.type != TokenType::PPEnd)
     {
         // TODO: add directives to some list
-        if (cur_tok.data == L"unsafe")
+        if (cur_tok.GetText() == L"unsafe")
         {
             m_pp.type = PPDir::unsafe;
         }
+        else if (cur_tok.GetText() == L"inline")
+        {
+            m_pp.fn_hint = PPDir::inline_fn;
+        }
+        else if (cur_tok.GetText() == L"noinline")
+        {
+            m_pp.fn_hint = PPDir::noinline_fn;
+        }
         NEXT_TOK;
     }
     NEXT_TOK;
@@ -808,322 +887,158 @@ inline Range* Parser::ParseRange()
     return res;
 }
 
-inline ASTNode* Parser::ShuntingYard()
+// Expressions are parsed by precedence climbing: every call parses an operand
+// and then takes the following binary operators as long as they bind tighter
+// than min_prec. The right operand of a right-associative operator takes the
+// operators of the same precedence too.
+inline ASTNode* Parser::ParseBinary(int min_prec)
 {
-    size_t LBrackets = 0;
-    size_t LParens = 0;
-    // Operator's token : Number of operands
-    std::vector<std::pair<Token, int>> operatorStack;
-    std::vector<ASTNode*> exprStack;
+    ASTNode* lhs = ParseUnary();
 
-    bool lastNumVar = false; // last token was a number or a variable
-    while (cur_tok.type != TokenType::Semi
-        && cur_tok.type != TokenType::LBrace
-        && cur_tok.type != TokenType::RBrace)
+    while (IsBinaryOp(cur_tok.type))
     {
-        if (cur_tok.type == TokenType::LParen ||
-            cur_tok.type == TokenType::LBracket)
+        int prec = GetPrecedence(cur_tok.type, false);
+        if (prec <= min_prec)
         {
-            operatorStack.push_back(std::make_pair(cur_tok, 1));
-            lastNumVar = false;
-            if (cur_tok.type == TokenType::LBracket)
-            {
-                ++LBrackets;
-            }
-            else
-            {
-                ++LParens;
-            }
-        }
-        else if (IsNumber(cur_tok.type))
-        {
-            exprStack.push_back(new ConstLeaf(cur_tok));
-            lastNumVar = true;
-        }
-        else if (cur_tok.type == TokenType::String)
-        {
-            exprStack.push_back(new StrLeaf(cur_tok));
-            lastNumVar = true;
-        }
-        else if (cur_tok.type == TokenType::Name)
-        {
-            auto te = cur_tok;
-            Var* var = GetVariable(cur_tok.data);
-
-            if (!var)
-            {
-                m_tok->UnexpToken(L"Usage of undeclared variable", &te);
-            }
-
-            cur_tok.data = var->name;
-            if (var->var_type == Keyword::kw_fn)
-            {
-                Lambda* b = (Lambda*)var->initial;
-                operatorStack.push_back(std::make_pair(cur_tok, b->params.size()));
-            }
-            else if (var->is_arr)
-            {
-                operatorStack.push_back(std::make_pair(cur_tok, 2));
-            }
-            else
-            {
-                exprStack.push_back(new VarLeaf(var));
-                lastNumVar = true;
-            }
-        }
-        else if (cur_tok.type == TokenType::Comma)
-        {
-            // ignore
+            break;
         }
-        else if (cur_tok.type == TokenType::RParen)
-        {
-            if (LParens <= 0) break;
-            std::pair<Token, int> top_op = operatorStack[operatorStack.size() - 1];
-
-            while (top_op.first.type != TokenType::LParen)
-            {
-                ASTNode* e2 = exprStack[exprStack.size() - 1];
-                exprStack.pop_back();
 
-                if (top_op.second == 2) // operator is binary
-                {
-                    ASTNode* e1 = exprStack[exprStack.size() - 1];
-                    exprStack.pop_back();
-
-                    BinOp* node = new BinOp();
-                    node->oper = top_op.first;
-
-                    // TODO: check for other right-associative operators
-                    if (node->oper.type != TokenType::Assign)
-                    {
-                        node->r = e1;
-                        node->l = e2;
-                    }
-                    else
-                    {
-                        node->l = e1;
-                        node->r = e2;
-                    }
-
-                    exprStack.push_back(node);
-                }
-                else
-                {
-                    UnOp* node = new UnOp();
-                    node->oper = top_op.first;
-                    node->operand = e2;
-
-                    exprStack.push_back(node);
-                }
-                operatorStack.pop_back();
-                top_op = operatorStack[operatorStack.size() - 1];
-            }
-
-            operatorStack.pop_back();
-
-            if (operatorStack.size() &&
-                operatorStack[operatorStack.size() - 1].first.type == TokenType::Name)
-            {
-                FnCall* fc = new FnCall();
-                fc->FnName = operatorStack[operatorStack.size() - 1].first;
-                String final_name;
-                fc->func = (Lambda*)GetVariable(fc->FnName.data, &final_name)->initial;
-                fc->FnName.data = final_name;
-
-                for (int i = 0; i < operatorStack[operatorStack.size() - 1].second; ++i)
-                {
-                    ASTNode* e0 = exprStack[exprStack.size() - 1];
-                    exprStack.pop_back();
+        Token oper = cur_tok;
+        NEXT_TOK;
+        ASTNode* rhs = ParseBinary(IsRightAssoc(oper.type) ? prec - 1 : prec);
 
-                    fc->params.push_back(e0);
-                }
-                exprStack.push_back(fc);
-                operatorStack.pop_back();
-            }
+        BinOp* node = new BinOp();
+        node->oper = oper;
 
-            lastNumVar = true;
-            --LParens;
+        if (oper.type != TokenType::Assign)
+        {
+            node->r = lhs;
+            node->l = rhs;
         }
-        else if (cur_tok.type == TokenType::RBracket)
+        else
         {
-            if (LBrackets <= 0) break;
-            std::pair<Token, int> top_op = operatorStack[operatorStack.size() - 1];
-
-            while (top_op.first.type != TokenType::LBracket)
+            if (lhs->type != NodeType::ArrayLeaf && lhs->type != NodeType::VarLeaf)
             {
-                ASTNode* e2 = exprStack[exprStack.size() - 1];
-                exprStack.pop_back();
-
-                if (top_op.second == 2) // operator is binary
-                {
-                    ASTNode* e1 = exprStack[exprStack.size() - 1];
-                    exprStack.pop_back();
-
-                    BinOp* node = new BinOp();
-                    node->oper = top_op.first;
-
-                    // TODO: check for other right-associative operators
-                    if (node->oper.type != TokenType::Assign)
-                    {
-                        node->r = e1;
-                        node->l = e2;
-                    }
-                    else
-                    {
-                        node->l = e1;
-                        node->r = e2;
-                    }
-
-                    exprStack.push_back(node);
-                }
-                else
-                {
-                    UnOp* node = new UnOp();
-                    node->oper = top_op.first;
-                    node->operand = e2;
-
-                    exprStack.push_back(node);
-                }
-                operatorStack.pop_back();
-                top_op = operatorStack[operatorStack.size() - 1];
+                m_tok->UnexpToken(L"Only variables can be assigned to.", &node->oper);
             }
 
-            operatorStack.pop_back();
-
-            if (operatorStack.size() &&
-                operatorStack[operatorStack.size() - 1].first.type == TokenType::Name)
+            Var* dest = lhs->type == NodeType::ArrayLeaf
+                ? ((ArrayLeaf*)lhs)->arr->data
+                : ((VarLeaf*)lhs)->data;
+            if (!dest->mut)
             {
-                Var* var = GetVariable(operatorStack[operatorStack.size() - 1].first.data);
-                ASTNode* e = exprStack[exprStack.size() - 1];
-                exprStack.pop_back();
-
-                ArrayLeaf* arr = new ArrayLeaf(var, e);
-
-                exprStack.push_back(arr);
-                operatorStack.pop_back();
+                m_tok->UnexpToken(L"Cannot assign to immutable variable.", &node->oper);
             }
-
-            lastNumVar = true;
-            --LBrackets;
+            node->l = lhs;
+            node->r = rhs;
         }
-        else // operator
-        {
-            if (operatorStack.size())
-            {
-                int topPrec = GetPrecedence(operatorStack[operatorStack.size() - 1].first.type,
-                    operatorStack[operatorStack.size() - 1].second == 1);
-
-                int curPrec = GetPrecedence(cur_tok.type, lastNumVar ? false : true);
+        node->Typify();
+        lhs = node;
+    }
 
-                while (topPrec >= curPrec)
-                {
-                    std::pair<Token, int> top_op = operatorStack[operatorStack.size() - 1];
+    return lhs;
+}
 
-                    ASTNode* e2 = exprStack[exprStack.size() - 1];
-                    exprStack.pop_back();
+inline ASTNode* Parser::ParseUnary()
+{
+    if (IsBinaryOp(cur_tok.type)
+        || cur_tok.type == TokenType::OperInc
+        || cur_tok.type == TokenType::OperDec)
+    {
+        UnOp* node = new UnOp();
+        node->oper = cur_tok;
+        int prec = GetPrecedence(cur_tok.type, true);
+        NEXT_TOK;
 
-                    if (top_op.second == 2) // operator is binary
-                    {
-                        ASTNode* e1 = exprStack[exprStack.size() - 1];
-                        exprStack.pop_back();
+        node->operand = ParseBinary(prec);
+        node->Typify();
+        return node;
+    }
 
-                        BinOp* node = new BinOp();
-                        node->oper = top_op.first;
+    return ParsePrimary();
+}
 
-                        // TODO: check for other right-associative operators
-                        if (node->oper.type != TokenType::Assign)
-                        {
-                            node->r = e1;
-                            node->l = e2;
-                        }
-                        else
-                        {
-                            node->l = e1;
-                            node->r = e2;
-                        }
+inline ASTNode* Parser::ParsePrimary()
+{
+    if (IsNumber(cur_tok.type))
+    {
+        ASTNode* r = new ConstLeaf(cur_tok);
+        NEXT_TOK;
+        return r;
+    }
 
-                        exprStack.push_back(node);
-                    }
-                    else
-                    {
-                        UnOp* node = new UnOp();
-                        node->oper = top_op.first;
-                        node->operand = e2;
+    if (cur_tok.type == TokenType::String)
+    {
+        ASTNode* r = new StrLeaf(cur_tok);
+        NEXT_TOK;
+        return r;
+    }
 
-                        exprStack.push_back(node);
-                    }
-                    operatorStack.pop_back();
-                    if (operatorStack.size())
-                    {
-                        topPrec = GetPrecedence(operatorStack[operatorStack.size() - 1].first.type,
-                            operatorStack[operatorStack.size() - 1].second == 1);
-                    }
-                    else break;
-                }
-            }
-            operatorStack.push_back(std::make_pair(cur_tok, lastNumVar ? 2 : 1));
- 
-            lastNumVar = false;
-        }
+    if (cur_tok.type == TokenType::LParen)
+    {
+        NEXT_TOK;
+        ASTNode* r = ParseBinary(0);
+        MATCH_CUR(RParen, L"Expected ')'");
         NEXT_TOK;
+        return r;
     }
 
-    if (operatorStack.size() <= 0)
+    if (cur_tok.type != TokenType::Name)
     {
-        return exprStack[exprStack.size() - 1];
+        m_tok->UnexpToken(L"Expected an expression", &cur_tok);
     }
 
-    std::pair<Token, int> top_op = operatorStack[operatorStack.size() - 1];
-    while (true)
+    auto te = cur_tok;
+    Var* var = GetVariable(cur_tok.sym);
+
+    if (!var)
     {
-        ASTNode* e2 = exprStack[exprStack.size() - 1];
-        exprStack.pop_back();
+        m_tok->UnexpToken(L"Usage of undeclared variable", &te);
+    }
 
-        if (top_op.second == 2) // operator is binary
-        {
-            ASTNode* e1 = exprStack[exprStack.size() - 1];
-            exprStack.pop_back();
+    cur_tok.SetText(var->name);
+    cur_tok.sym = var->sym;
 
-            BinOp* node = new BinOp();
-            node->oper = top_op.first;
+    if (var->var_type == Keyword::kw_fn)
+    {
+        FnCall* fc = new FnCall();
+        fc->FnName = cur_tok;
+        fc->func = (Lambda*)var->initial;
 
-            // TODO: check for other right-associative operators
-            if (node->oper.type != TokenType::Assign)
+        MATCH(LParen, L"Expected '(' after the function name");
+        NEXT_TOK;
+        while (cur_tok.type != TokenType::RParen)
+        {
+            fc->params.push_back(ParseBinary(0));
+            if (cur_tok.type == TokenType::Comma)
             {
-                node->r = e1;
-                node->l = e2;
+                NEXT_TOK;
             }
             else
             {
-                if (((VarLeaf*)e1)->data->mut)
-                {
-                    node->l = e1;
-                    node->r = e2;
-                }
-                else
-                {
-                    m_tok->UnexpToken(L"Cannot assign to immutable variable.", &node->oper);
-                }
+                MATCH_CUR(RParen, L"Expected ',' or ')' in the argument list");
             }
-
-            exprStack.push_back(node);
         }
-        else
-        {
-            UnOp* node = new UnOp();
-            node->oper = top_op.first;
-            node->operand = e2;
 
-            exprStack.push_back(node);
-        }
-        operatorStack.pop_back();
-        if (operatorStack.size() <= 0)
+        if (fc->params.size() != fc->func->params.size())
         {
-            break;
+            m_tok->UnexpToken(L"Wrong number of arguments", &cur_tok);
         }
-        top_op = operatorStack[operatorStack.size() - 1];
+        fc->Typify();
+        NEXT_TOK;
+        return fc;
     }
 
-    return exprStack[exprStack.size() - 1];
-}
+    if (var->is_arr)
+    {
+        MATCH(LBracket, L"Expected '[' after the array name");
+        NEXT_TOK;
+        ASTNode* idx = ParseBinary(0);
+        MATCH_CUR(RBracket, L"Expected ']'");
+        NEXT_TOK;
+        return new ArrayLeaf(var, idx);
+    }
 
+    NEXT_TOK;
+    return new VarLeaf(var);
+}
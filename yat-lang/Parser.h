@@ -15,7 +15,9 @@
 //  along with this program.  If not, see <https://www.gnu.org/licenses/>.
 //
 #pragma once
+#include <algorithm>
 #include <vector>
+#include <unordered_map>
 #include "Tokenizer.h"
 #include "AST.h"
 
@@ -28,6 +30,10 @@ class Parser
         unsafe,
         // used to define default string class
         default_str,
+        // the next function is always inlined
+        inline_fn,
+        // the next function is never inlined
+        noinline_fn,
         // last enum's element
         Last
     };
@@ -35,10 +41,13 @@ class Parser
     struct
     {
         PPDir type = PPDir::Last;
+        // inline_fn or noinline_fn until the next function takes it
+        PPDir fn_hint = PPDir::Last;
 
         void Reset()
         {
             type = PPDir::Last;
+            fn_hint = PPDir::Last;
         }
     } m_pp;
 
@@ -49,10 +58,39 @@ class Parser
 
     // tokenizer
     Tokenizer* m_tok = nullptr;
+    // tokens lexed in advance, m_tok is used only for diagnostics then
+    const TokenArray* m_toks = nullptr;
+    // index of the next token in m_toks
+    size_t m_pos = 0;
     // the current namespace
     Namespace* m_nspace = nullptr;
 
-    std::vector<std::vector<Var*>> m_vars;
+    // Variables visible at the current point, by scopes. A name can be declared
+    // only once among all the visible scopes, so all of them share one hash
+    // table and a lookup is a single probe. Popping a scope removes its
+    // variables from the table.
+    class Scopes
+    {
+        std::unordered_map<Symbol, Var*> m_table;
+        std::vector<std::vector<Var*>> m_scopes;
+
+    public:
+        void Push(const std::vector<Var*>& vars = {});
+        void Pop();
+        // FALSE if a variable with the same name is already visible
+        bool Add(Var* var, size_t scope);
+        Var* Find(Symbol sym) const;
+
+        size_t Size() const
+        {
+            return m_scopes.size();
+        }
+
+        const std::vector<Var*>& Top() const
+        {
+            return m_scopes.back();
+        }
+    } m_vars;
 
     // type of the statement
     enum class StateType
@@ -80,11 +118,31 @@ class Parser
     };
 
 public:
-    Parser(Tokenizer* t);
+    Parser(Tokenizer* t, const TokenArray* toks = nullptr);
+    // continue parsing to the same AST from another source,
+    // declarations parsed before stay visible
+    void SetSource(Tokenizer* t, const TokenArray* toks = nullptr);
     void Parse(AST& ast);
+    // global variable by its qualified name
+    Var* FindGlobal(Symbol sym) const;
+    // adds a namespace which wasn't parsed, e.g. loaded from the module cache;
+    // its variables become visible as if it was parsed
+    void AddNamespace(AST& ast, Namespace* ns);
+
+    inline Token NextToken();
+    // k-th token after the current one, the last one (EoF) past the end
+    Token PeekToken(size_t k = 0)
+    {
+        if (!m_toks)
+        {
+            throw Error(L"Lookahead requires the tokens to be lexed in advance\n");
+        }
+
+        return m_toks->Get(std::min(m_pos + k, m_toks->Size() - 1));
+    }
 
-    inline Var* GetVariable(String v, String* fname = nullptr);
-    inline Var* GetVariable_(const String& v);
+    inline Var* GetVariable(Symbol v);
+    inline Var* GetVariable_(Symbol v);
     inline void AddVariable(Var* var, int64_t idx = -1);
 
     inline ASTNode* ParseExpression(bool fn, Keyword& exp_type);
@@ -92,10 +150,15 @@ public:
     inline StatementBlock* ParseBlock(bool is_fn);
     inline ASTNode* ParseStatement();
     inline std::vector<Var*> ParseParamList();
-    inline ASTNode* ShuntingYard();
+    // binary operators which bind tighter than min_prec and their operands
+    inline ASTNode* ParseBinary(int min_prec);
+    // prefix operators and their operand
+    inline ASTNode* ParseUnary();
+    // literal, variable, function call, array element or parenthesized expression
+    inline ASTNode* ParsePrimary();
     inline Var* ParseVarDecl(bool add = true);
     inline void ParseTypeParams(std::vector<TemplateParam>& p);
-    inline String ParseUsing();
+    inline Symbol ParseUsing();
     inline void ParsePreProc();
     inline Range* ParseRange();
 };
@@ -0,0 +1,136 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "PassManager.h"
+#include "AST.h"
+#include "AsInstr.h"
+#include "ConstProp.h"
+#include "Inliner.h"
+#include "Peephole.h"
+#include <iostream>
+
+static void RunInline(AST& ast)
+{
+    Inliner(ast).Run();
+}
+
+static void RunConstProp(AST& ast)
+{
+    ConstPropagation(ast).Run();
+}
+
+static void RunPeephole(std::vector<AsInstr>& code, const std::wstring& name, bool report)
+{
+    Peephole p;
+    p.Run(code);
+    if (!report)
+    {
+        return;
+    }
+
+    const std::vector<Peephole::Rule>& rules = Peephole::Rules();
+    std::wstring fired;
+    for (size_t i = 0; i < rules.size(); ++i)
+    {
+        if (p.fired[i])
+        {
+            fired += (fired.empty() ? L"" : L", ") + std::to_wstring(p.fired[i]) + L" " + rules[i].name;
+        }
+    }
+    if (!fired.empty())
+    {
+        std::wcout << L"peephole: " << name << L": " << fired << L"\n";
+    }
+}
+
+const std::vector<PassManager::Pass>& PassManager::All()
+{
+    static const std::vector<Pass> passes = {
+        // before constant propagation, which folds the arguments in the copies
+        { "inline",     2, RunInline,    nullptr },
+        { "const-prop", 1, RunConstProp, nullptr },
+        // functions are generated by CodeGen through the IR
+        { "ssa",        2, nullptr,      nullptr },
+        // parameters and locals of IR functions become SSA values
+        { "mem2reg",    2, nullptr,      nullptr },
+        // the IR values are given registers by linear scan
+        { "regalloc",   2, nullptr,      nullptr },
+        // or by graph coloring, which takes longer
+        { "regalloc-graph", 3, nullptr,  nullptr },
+        // rewrites short sequences of the written instructions
+        { "peephole",   1, nullptr,      RunPeephole },
+    };
+    return passes;
+}
+
+PassManager::PassManager(int opt_level)
+{
+    for (const Pass& p : All())
+    {
+        m_on.push_back(p.level <= opt_level);
+    }
+}
+
+bool PassManager::Set(const std::string& name, bool on)
+{
+    const std::vector<Pass>& passes = All();
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        if (name == passes[i].name)
+        {
+            m_on[i] = on;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PassManager::IsOn(const std::string& name) const
+{
+    const std::vector<Pass>& passes = All();
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        if (name == passes[i].name)
+        {
+            return m_on[i];
+        }
+    }
+    return false;
+}
+
+void PassManager::RunTree(AST& ast) const
+{
+    const std::vector<Pass>& passes = All();
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        if (m_on[i] && passes[i].tree)
+        {
+            passes[i].tree(ast);
+        }
+    }
+}
+
+void PassManager::RunMachine(std::vector<AsInstr>& code, const std::wstring& name) const
+{
+    const std::vector<Pass>& passes = All();
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        if (m_on[i] && passes[i].machine)
+        {
+            passes[i].machine(code, name, report);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <string>
+#include <vector>
+
+class AST;
+struct AsInstr;
+
+// Optimization passes which run between parsing and writing the assembly.
+// An optimization level runs the passes made for it and for the lower levels,
+// any pass can also be switched on or off by its name whatever the level is.
+class PassManager
+{
+public:
+    // tree passes run on the whole AST before the code is generated,
+    // machine passes run on the instructions of every function and print
+    // what they have done for the function `name` if report is set
+    using TreePass = void (*)(AST& ast);
+    using MachinePass = void (*)(std::vector<AsInstr>& code, const std::wstring& name, bool report);
+
+    struct Pass
+    {
+        const char* name;
+        // the lowest optimization level which runs the pass
+        int level;
+        TreePass tree;
+        MachinePass machine;
+    };
+
+    // all passes in the order they run
+    static const std::vector<Pass>& All();
+
+    PassManager(int opt_level = 0);
+
+    // FALSE if there is no pass with the name
+    bool Set(const std::string& name, bool on);
+    bool IsOn(const std::string& name) const;
+
+    void RunTree(AST& ast) const;
+    void RunMachine(std::vector<AsInstr>& code, const std::wstring& name) const;
+
+    // passes print what they have done for every function
+    bool report = false;
+
+private:
+    // one flag for every pass of All()
+    std::vector<bool> m_on;
+};
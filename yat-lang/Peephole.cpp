@@ -0,0 +1,343 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "Peephole.h"
+#include <algorithm>
+#include <cwctype>
+#include <iterator>
+
+using Op = AsInstr::Operands;
+
+// size of the operands of a mov or lea without extension, 0 for the others
+static size_t MoveSize(const AsInstr& in)
+{
+    if ((in.instr != AsInstr::Instr::as_mov && in.instr != AsInstr::Instr::as_lea)
+        || in.suf0 != AsInstr::InstrSuffix::Last)
+    {
+        return 0;
+    }
+    switch (in.suf)
+    {
+    case AsInstr::InstrSuffix::s_b: return 1;
+    case AsInstr::InstrSuffix::s_w: return 2;
+    case AsInstr::InstrSuffix::s_l: return 4;
+    case AsInstr::InstrSuffix::s_q: return 8;
+    }
+    return 0;
+}
+
+static bool IsMemory(Op op)
+{
+    return op == Op::Stack || op == Op::Addr || op == Op::Label;
+}
+
+static bool Same(Register a, Register b)
+{
+    return CvtReg(a, 8) == CvtReg(b, 8);
+}
+
+// TRUE if the register is read to find the address of the operand
+static bool Addresses(const AsInstr& in, Op op, Register reg, Register r)
+{
+    return (op == Op::Addr && Same(reg, r)) || (op == Op::Stack && Same(in.stackReg, r));
+}
+
+// TRUE if the text mentions the register in any of its sizes
+static bool Mentions(const String& text, Register r)
+{
+    for (size_t size : { 1, 2, 4, 8 })
+    {
+        if (text.find(L"%" + RegisterStr[(size_t)CvtReg(r, size)]) != String::npos)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// TRUE if the value of the register isn't read after the position before
+// it is written again
+static bool IsDead(const std::vector<AsInstr>& code, size_t from, Register r)
+{
+    r = CvtReg(r, 8);
+    if (r == Register::rsp || r == Register::rbp)
+    {
+        return false;
+    }
+
+    for (size_t i = from; i < code.size(); ++i)
+    {
+        const AsInstr& in = code[i];
+        if (in.isLabel)
+        {
+            continue;
+        }
+
+        if (in.instr == AsInstr::Instr::Last)
+        {
+            const String& text = in.text;
+            if (text.empty() || text[0] == L'#' || text == L"leave\n")
+            {
+                continue;
+            }
+            if (text == L"leave\n\tret\n")
+            {
+                return r != Register::rax;
+            }
+            if (text == L"cqto\n")
+            {
+                if (r == Register::rax)
+                {
+                    return false;
+                }
+                if (r == Register::rdx)
+                {
+                    return true;
+                }
+                continue;
+            }
+            if (text.compare(0, 4, L"call") == 0 && !Mentions(text, r))
+            {
+                // the arguments are read, the other caller-saved registers are lost
+                if (r == Register::rax || std::find(std::begin(IntArgRegs), std::end(IntArgRegs), r) != std::end(IntArgRegs))
+                {
+                    return false;
+                }
+                if (r == Register::r10 || r == Register::r11)
+                {
+                    return true;
+                }
+                continue;
+            }
+            // inline assembly may do anything
+            return false;
+        }
+
+        if (in.instr == AsInstr::Instr::as_ret)
+        {
+            return r != Register::rax;
+        }
+        if (in.instr == AsInstr::Instr::as_jmp || in.instr == AsInstr::Instr::as_j
+            || in.instr == AsInstr::Instr::as_call)
+        {
+            return false;
+        }
+        // one-operand multiplication and division work on rax and rdx
+        if ((in.instr == AsInstr::Instr::as_mul || in.instr == AsInstr::Instr::as_imul
+            || in.instr == AsInstr::Instr::as_div || in.instr == AsInstr::Instr::as_idiv)
+            && in.oper2 == Op::Last && (r == Register::rax || r == Register::rdx))
+        {
+            return false;
+        }
+
+        if ((in.oper1 == Op::Reg && Same(in.reg1, r)) || Addresses(in, in.oper1, in.reg1, r)
+            || Addresses(in, in.oper2, in.reg2, r))
+        {
+            return false;
+        }
+        if (in.oper2 == Op::Reg && Same(in.reg2, r))
+        {
+            // writing 32 or 64 bits of a register replaces all of it
+            size_t size = MoveSize(in);
+            bool ext = in.instr == AsInstr::Instr::as_mov && (in.suf == AsInstr::InstrSuffix::x_s
+                || in.suf == AsInstr::InstrSuffix::x_z) && in.suf1 != AsInstr::InstrSuffix::s_b
+                && in.suf1 != AsInstr::InstrSuffix::s_w;
+            return size >= 4 || ext;
+        }
+    }
+    return false;
+}
+
+// leaq src, %r; movq %r, dst => leaq src, dst or movq $label, dst
+static bool LeaMove(std::vector<AsInstr>& code, size_t i)
+{
+    if (i + 1 >= code.size())
+    {
+        return false;
+    }
+    AsInstr& lea = code[i];
+    AsInstr& mov = code[i + 1];
+    if (lea.instr != AsInstr::Instr::as_lea || MoveSize(lea) != 8 || lea.oper2 != Op::Reg
+        || mov.instr != AsInstr::Instr::as_mov || MoveSize(mov) != 8
+        || mov.oper1 != Op::Reg || mov.reg1 != lea.reg2
+        || (mov.oper2 == Op::Reg && Same(mov.reg2, lea.reg2)) || Addresses(mov, mov.oper2, mov.reg2, lea.reg2)
+        || !IsDead(code, i + 2, lea.reg2))
+    {
+        return false;
+    }
+
+    if (mov.oper2 == Op::Reg)
+    {
+        lea.reg2 = mov.reg2;
+    }
+    else if (lea.oper1 == Op::Label)
+    {
+        // addresses of labels fit in 32-bit immediate operands outside of PIE
+        lea.instr = AsInstr::Instr::as_mov;
+        lea.oper1 = Op::Const;
+        lea.oper2 = mov.oper2;
+        lea.reg2 = mov.reg2;
+        lea.mem2 = mov.mem2;
+        lea.l2 = mov.l2;
+        lea.stackReg = mov.stackReg;
+    }
+    else
+    {
+        return false;
+    }
+    code.erase(code.begin() + i + 1);
+    return true;
+}
+
+// mov src, %r; mov %r, dst => mov src, dst
+static bool MoveMove(std::vector<AsInstr>& code, size_t i)
+{
+    if (i + 1 >= code.size())
+    {
+        return false;
+    }
+    AsInstr& a = code[i];
+    AsInstr& b = code[i + 1];
+    size_t size = MoveSize(a);
+    if (a.instr != AsInstr::Instr::as_mov || !size || a.oper2 != Op::Reg
+        || b.instr != AsInstr::Instr::as_mov || MoveSize(b) != size
+        || b.oper1 != Op::Reg || b.reg1 != a.reg2
+        || (b.oper2 == Op::Reg && Same(b.reg2, a.reg2)) || Addresses(b, b.oper2, b.reg2, a.reg2)
+        || (IsMemory(a.oper1) && IsMemory(b.oper2)))
+    {
+        return false;
+    }
+
+    // only a move to a register takes a 64-bit immediate operand
+    if (a.oper1 == Op::Const && IsMemory(b.oper2) && size == 8)
+    {
+        std::wstring_view text = SymbolText(a.l1);
+        bool number = !text.empty() && (iswdigit(text[0]) || text[0] == L'-');
+        if (number)
+        {
+            int64_t v = std::stoll(String(text));
+            if (v < INT32_MIN || v > INT32_MAX)
+            {
+                return false;
+            }
+        }
+    }
+    if (!IsDead(code, i + 2, a.reg2))
+    {
+        return false;
+    }
+
+    a.oper2 = b.oper2;
+    a.reg2 = b.reg2;
+    a.mem2 = b.mem2;
+    a.l2 = b.l2;
+    if (b.oper2 == Op::Stack)
+    {
+        a.stackReg = b.stackReg;
+    }
+    code.erase(code.begin() + i + 1);
+    return true;
+}
+
+// mov %r, %r
+static bool SelfMove(std::vector<AsInstr>& code, size_t i)
+{
+    AsInstr& in = code[i];
+    // a 32-bit move clears the upper half of the register
+    if (in.instr != AsInstr::Instr::as_mov || !MoveSize(in) || MoveSize(in) == 4
+        || in.oper1 != Op::Reg || in.oper2 != Op::Reg || in.reg1 != in.reg2)
+    {
+        return false;
+    }
+    code.erase(code.begin() + i);
+    return true;
+}
+
+// jmp label; label:
+static bool JumpNext(std::vector<AsInstr>& code, size_t i)
+{
+    AsInstr& jmp = code[i];
+    if (jmp.instr != AsInstr::Instr::as_jmp || jmp.oper1 != Op::Label)
+    {
+        return false;
+    }
+    for (size_t j = i + 1; j < code.size(); ++j)
+    {
+        const AsInstr& in = code[j];
+        if (in.isLabel && in.l1 == jmp.l1)
+        {
+            code.erase(code.begin() + i);
+            return true;
+        }
+        // other labels and comments may be in between
+        if (!in.isLabel && !(in.instr == AsInstr::Instr::Last && !in.text.empty() && in.text[0] == L'#'))
+        {
+            break;
+        }
+    }
+    return false;
+}
+
+// addq $0, %rsp or subq $0, %rsp
+static bool StackZero(std::vector<AsInstr>& code, size_t i)
+{
+    AsInstr& in = code[i];
+    if ((in.instr != AsInstr::Instr::as_add && in.instr != AsInstr::Instr::as_sub)
+        || in.oper1 != Op::Const || SymbolText(in.l1) != L"0"
+        || in.oper2 != Op::Reg || in.reg2 != Register::rsp)
+    {
+        return false;
+    }
+    code.erase(code.begin() + i);
+    return true;
+}
+
+const std::vector<Peephole::Rule>& Peephole::Rules()
+{
+    static const std::vector<Rule> rules = {
+        { L"lea-move",   LeaMove },
+        { L"move-move",  MoveMove },
+        { L"self-move",  SelfMove },
+        { L"jump-next",  JumpNext },
+        { L"stack-zero", StackZero },
+    };
+    return rules;
+}
+
+Peephole::Peephole()
+{
+    fired.assign(Rules().size(), 0);
+}
+
+void Peephole::Run(std::vector<AsInstr>& code)
+{
+    const std::vector<Rule>& rules = Rules();
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            for (size_t r = 0; r < rules.size() && i < code.size(); ++r)
+            {
+                if (rules[r].apply(code, i))
+                {
+                    ++fired[r];
+                    changed = true;
+                }
+            }
+        }
+    }
+}
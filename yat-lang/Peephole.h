@@ -0,0 +1,43 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <vector>
+#include "AsInstr.h"
+
+// Rewrites short sequences of instructions of a function by a table of rules
+// until none of them matches. A rule which drops the write of a register
+// checks that the register is overwritten before it is read again, looking
+// forward to the first jump. Inline assembly is never changed.
+class Peephole
+{
+public:
+    struct Rule
+    {
+        const wchar_t* name;
+        // rewrites the instructions from the position, TRUE if it has matched
+        bool (*apply)(std::vector<AsInstr>& code, size_t i);
+    };
+
+    // all rules in the order they are tried at every position
+    static const std::vector<Rule>& Rules();
+
+    // times every rule of Rules() has matched
+    std::vector<size_t> fired;
+
+    Peephole();
+    void Run(std::vector<AsInstr>& code);
+};
@@ -0,0 +1,670 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include "RegAlloc.h"
+#include "CodeGen.h"
+#include <algorithm>
+#include <iterator>
+
+const Register CalleeSaved[5]{ Register::rbx, Register::r12, Register::r13, Register::r14, Register::r15 };
+const Register CallerSaved[5]{ Register::r8, Register::r9, Register::r10, Register::rsi, Register::rdi };
+
+static bool IsCalleeSaved(Register r)
+{
+    return std::find(std::begin(CalleeSaved), std::end(CalleeSaved), r) != std::end(CalleeSaved);
+}
+
+// registers the values of the function may take, callee-saved ones are left
+// out if there is inline assembly, which may return without their restores
+static std::vector<Register> Usable(const Liveness& live)
+{
+    std::vector<Register> res(std::begin(CallerSaved), std::end(CallerSaved));
+    if (live.asms.empty())
+    {
+        res.insert(res.end(), std::begin(CalleeSaved), std::end(CalleeSaved));
+    }
+    return res;
+}
+
+// registers the parameters arrive in, by the ids of their Param values,
+// a parameter stays there if the register is free
+static std::vector<Register> Incoming(IRFunction& fn)
+{
+    std::vector<Register> res(fn.InstrCount(), Register::Last);
+    std::vector<Keyword> types;
+    for (Var* p : fn.params)
+    {
+        types.push_back(p->var_type);
+    }
+    std::vector<Register> arg_regs = CodeGen::ArgRegisters(types);
+    for (IRInstr* in : fn.blocks[0]->instrs)
+    {
+        if (in->op == IROp::Param)
+        {
+            res[in->id] = arg_regs[in->imm];
+        }
+    }
+    return res;
+}
+
+// TRUE if the callee of the call is unknown or has inline assembly, which
+// may return without restoring the callee-saved registers
+static bool IsUnsafeCall(IRInstr* in)
+{
+    return in->op == IROp::Call && (!in->callee || in->callee->HasAsm());
+}
+
+// TRUE if the instruction copies a value which may stay in the same register
+static bool IsMove(IRInstr* in)
+{
+    return (in->op == IROp::Copy
+        || (in->op == IROp::Cvt && GetTypeSize(in->type) <= GetTypeSize(in->args[0]->type)))
+        && Liveness::Allocated(in->args[0]);
+}
+
+Liveness::Liveness(IRFunction& fn)
+{
+    size_t n = fn.InstrCount();
+    size_t nb = fn.blocks.size();
+    pos.assign(n, 0);
+    block_start.assign(nb, 0);
+    block_end.assign(nb, 0);
+
+    size_t p = 0;
+    for (IRBlock* b : fn.blocks)
+    {
+        block_start[b->id] = p++;
+        for (IRInstr* in : b->instrs)
+        {
+            if (in->op == IROp::Phi)
+            {
+                pos[in->id] = block_start[b->id];
+                continue;
+            }
+
+            pos[in->id] = p;
+            if (in->op == IROp::Call)
+            {
+                calls.push_back(p);
+                if (IsUnsafeCall(in))
+                {
+                    unsafe_calls.push_back(p);
+                }
+            }
+            else if (in->op == IROp::Asm)
+            {
+                asms.push_back(p);
+            }
+            p += 2;
+        }
+        block_end[b->id] = p++;
+    }
+
+    live_in.assign(nb, std::vector<bool>(n));
+    live_out.assign(nb, std::vector<bool>(n));
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = nb; i-- > 0;)
+        {
+            IRBlock* b = fn.blocks[i];
+            std::vector<bool> live(n);
+            for (IRBlock* s : b->succs)
+            {
+                for (size_t v = 0; v < n; ++v)
+                {
+                    if (live_in[s->id][v])
+                    {
+                        live[v] = true;
+                    }
+                }
+
+                // the arguments of phis which come from this block
+                size_t k = std::find(s->preds.begin(), s->preds.end(), b) - s->preds.begin();
+                for (IRInstr* in : s->instrs)
+                {
+                    if (in->op == IROp::Phi && Allocated(in->args[k]))
+                    {
+                        live[in->args[k]->id] = true;
+                    }
+                }
+            }
+            live_out[i] = live;
+
+            for (size_t j = b->instrs.size(); j-- > 0;)
+            {
+                IRInstr* in = b->instrs[j];
+                if (in->HasValue())
+                {
+                    live[in->id] = false;
+                }
+                if (in->op == IROp::Phi)
+                {
+                    continue;
+                }
+                for (IRInstr* arg : in->args)
+                {
+                    if (Allocated(arg))
+                    {
+                        live[arg->id] = true;
+                    }
+                }
+            }
+
+            if (live != live_in[i])
+            {
+                live_in[i] = live;
+                changed = true;
+            }
+        }
+    }
+
+    start.assign(n, SIZE_MAX);
+    end.assign(n, 0);
+    auto extend = [this](unsigned id, size_t p) {
+        start[id] = std::min(start[id], p);
+        end[id] = std::max(end[id], p);
+    };
+
+    for (IRBlock* b : fn.blocks)
+    {
+        for (unsigned v = 0; v < n; ++v)
+        {
+            if (live_in[b->id][v])
+            {
+                extend(v, block_start[b->id]);
+            }
+            if (live_out[b->id][v])
+            {
+                extend(v, block_end[b->id]);
+            }
+        }
+
+        for (IRInstr* in : b->instrs)
+        {
+            if (Allocated(in))
+            {
+                extend(in->id, pos[in->id]);
+            }
+            for (size_t k = 0; k < in->args.size(); ++k)
+            {
+                if (Allocated(in->args[k]))
+                {
+                    extend(in->args[k]->id, in->op == IROp::Phi ? block_end[b->preds[k]->id] : pos[in->id]);
+                }
+            }
+        }
+    }
+}
+
+bool Liveness::Allocated(IRInstr* v)
+{
+    return v->HasValue() && v->op != IROp::Const;
+}
+
+bool Liveness::CrossesCall(IRInstr* v) const
+{
+    for (size_t c : calls)
+    {
+        if (start[v->id] < c && c < end[v->id])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Liveness::CrossesAsm(IRInstr* v) const
+{
+    for (const std::vector<size_t>* at : { &asms, &unsafe_calls })
+    {
+        for (size_t c : *at)
+        {
+            if (start[v->id] < c && c < end[v->id])
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+RegAssignment LinearScan::Run(IRFunction& fn)
+{
+    Liveness live(fn);
+    RegAssignment res;
+    res.regs.assign(fn.InstrCount(), Register::Last);
+
+    std::vector<IRInstr*> values;
+    for (IRBlock* b : fn.blocks)
+    {
+        for (IRInstr* in : b->instrs)
+        {
+            if (Liveness::Allocated(in))
+            {
+                values.push_back(in);
+            }
+        }
+    }
+    std::stable_sort(values.begin(), values.end(), [&](IRInstr* a, IRInstr* b) {
+        return live.start[a->id] < live.start[b->id];
+    });
+
+    std::vector<Register> free = Usable(live);
+    std::vector<Register> incoming = Incoming(fn);
+    std::vector<IRInstr*> active;
+
+    for (IRInstr* v : values)
+    {
+        // the registers of the ranges which have ended are free again,
+        // a value may take the register of an operand used last by its definition
+        for (size_t i = 0; i < active.size();)
+        {
+            if (live.end[active[i]->id] <= live.start[v->id])
+            {
+                free.push_back(res.regs[active[i]->id]);
+                active.erase(active.begin() + i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        if (live.CrossesAsm(v))
+        {
+            ++res.spilled;
+            continue;
+        }
+
+        // caller-saved registers are taken first, so fewer registers are saved,
+        // the one the parameter arrives in before all
+        bool call = live.CrossesCall(v);
+        auto it = free.end();
+        if (!call)
+        {
+            it = std::find(free.begin(), free.end(), incoming[v->id]);
+        }
+        if (!call && it == free.end())
+        {
+            it = std::find_if(free.begin(), free.end(), [](Register r) { return !IsCalleeSaved(r); });
+        }
+        if (it == free.end())
+        {
+            it = std::find_if(free.begin(), free.end(), IsCalleeSaved);
+        }
+
+        Register r = Register::Last;
+        if (it != free.end())
+        {
+            r = *it;
+            free.erase(it);
+        }
+        else
+        {
+            // the range which ends last goes to memory
+            auto victim = active.end();
+            for (auto a = active.begin(); a != active.end(); ++a)
+            {
+                if ((!call || IsCalleeSaved(res.regs[(*a)->id]))
+                    && (victim == active.end() || live.end[(*a)->id] > live.end[(*victim)->id]))
+                {
+                    victim = a;
+                }
+            }
+
+            ++res.spilled;
+            if (victim == active.end() || live.end[(*victim)->id] <= live.end[v->id])
+            {
+                continue;
+            }
+            r = res.regs[(*victim)->id];
+            res.regs[(*victim)->id] = Register::Last;
+            active.erase(victim);
+        }
+
+        res.regs[v->id] = r;
+        active.push_back(v);
+    }
+
+    // moves whose value happens to stay in the register
+    for (IRInstr* v : values)
+    {
+        if (IsMove(v) && res.regs[v->id] != Register::Last && res.regs[v->id] == res.regs[v->args[0]->id])
+        {
+            ++res.coalesced;
+        }
+    }
+
+    for (Register r : CalleeSaved)
+    {
+        if (std::find(res.regs.begin(), res.regs.end(), r) != res.regs.end())
+        {
+            res.saved.push_back(r);
+        }
+    }
+    return res;
+}
+
+GraphColoring::GraphColoring(IRFunction& fn)
+    : m_live(fn), m_count(fn.InstrCount()), m_regs(Usable(m_live)), m_incoming(Incoming(fn))
+{
+    m_callee = std::count_if(m_regs.begin(), m_regs.end(), IsCalleeSaved);
+}
+
+RegAssignment GraphColoring::Run(IRFunction& fn)
+{
+    GraphColoring gc(fn);
+    gc.Build(fn);
+    gc.Coalesce();
+    return gc.Color();
+}
+
+void GraphColoring::AddEdge(unsigned a, unsigned b)
+{
+    if (a == b || m_interfere[a][b])
+    {
+        return;
+    }
+    m_interfere[a][b] = m_interfere[b][a] = true;
+    m_adj[a].push_back(b);
+    m_adj[b].push_back(a);
+}
+
+void GraphColoring::Build(IRFunction& fn)
+{
+    size_t n = m_count;
+    m_interfere.assign(n, std::vector<bool>(n));
+    m_adj.assign(n, {});
+    m_call.assign(n, false);
+    m_asm.assign(n, false);
+    m_cost.assign(n, 0);
+    m_alias.resize(n);
+    for (unsigned v = 0; v < n; ++v)
+    {
+        m_alias[v] = v;
+    }
+
+    for (IRBlock* b : fn.blocks)
+    {
+        std::vector<bool> live = m_live.live_out[b->id];
+        for (size_t j = b->instrs.size(); j-- > 0;)
+        {
+            IRInstr* in = b->instrs[j];
+            if (in->op == IROp::Phi)
+            {
+                continue;
+            }
+
+            // the source of a move doesn't interfere with its result, they hold the same value
+            IRInstr* src = IsMove(in) ? in->args[0] : nullptr;
+            if (Liveness::Allocated(in))
+            {
+                m_nodes.push_back(in->id);
+                ++m_cost[in->id];
+                for (unsigned v = 0; v < n; ++v)
+                {
+                    if (live[v] && (!src || v != src->id))
+                    {
+                        AddEdge(in->id, v);
+                    }
+                }
+                live[in->id] = false;
+            }
+            if (src)
+            {
+                m_moves.emplace_back(in->id, src->id);
+            }
+
+            // the values live across an unsafe call go to memory, as across inline assembly
+            if (in->op == IROp::Call || in->op == IROp::Asm)
+            {
+                for (unsigned v = 0; v < n; ++v)
+                {
+                    if (live[v])
+                    {
+                        (in->op == IROp::Call ? m_call : m_asm)[v] = true;
+                        if (IsUnsafeCall(in))
+                        {
+                            m_asm[v] = true;
+                        }
+                    }
+                }
+            }
+
+            for (IRInstr* arg : in->args)
+            {
+                if (Liveness::Allocated(arg))
+                {
+                    live[arg->id] = true;
+                    ++m_cost[arg->id];
+                }
+            }
+        }
+
+        // phis are defined together at the start of the block
+        for (IRInstr* in : b->instrs)
+        {
+            if (in->op != IROp::Phi)
+            {
+                continue;
+            }
+            m_nodes.push_back(in->id);
+            ++m_cost[in->id];
+            for (unsigned v = 0; v < n; ++v)
+            {
+                if (live[v])
+                {
+                    AddEdge(in->id, v);
+                }
+            }
+            for (IRInstr* arg : in->args)
+            {
+                if (Liveness::Allocated(arg))
+                {
+                    ++m_cost[arg->id];
+                    m_moves.emplace_back(in->id, arg->id);
+                }
+            }
+        }
+    }
+
+    // values which cross inline assembly are kept in memory
+    for (unsigned v : m_nodes)
+    {
+        if (!m_asm[v])
+        {
+            continue;
+        }
+        for (unsigned t : m_adj[v])
+        {
+            m_interfere[t][v] = false;
+            m_adj[t].erase(std::find(m_adj[t].begin(), m_adj[t].end(), v));
+        }
+        m_interfere[v].assign(n, false);
+        m_adj[v].clear();
+    }
+}
+
+unsigned GraphColoring::Find(unsigned v)
+{
+    while (m_alias[v] != v)
+    {
+        m_alias[v] = m_alias[m_alias[v]];
+        v = m_alias[v];
+    }
+    return v;
+}
+
+size_t GraphColoring::Colors(unsigned v) const
+{
+    return m_call[v] ? m_callee : m_regs.size();
+}
+
+bool GraphColoring::Briggs(unsigned a, unsigned b)
+{
+    size_t k = m_call[a] || m_call[b] ? m_callee : m_regs.size();
+    size_t significant = 0;
+    std::vector<unsigned> adj = m_adj[a];
+    adj.insert(adj.end(), m_adj[b].begin(), m_adj[b].end());
+    std::sort(adj.begin(), adj.end());
+    adj.erase(std::unique(adj.begin(), adj.end()), adj.end());
+    for (unsigned t : adj)
+    {
+        // a neighbour of both loses one of them
+        size_t degree = m_adj[t].size() - (m_interfere[t][a] && m_interfere[t][b] ? 1 : 0);
+        if (degree >= Colors(t))
+        {
+            ++significant;
+        }
+    }
+    return significant < k;
+}
+
+void GraphColoring::Merge(unsigned a, unsigned b)
+{
+    std::vector<unsigned> adj = std::move(m_adj[b]);
+    m_adj[b].clear();
+    for (unsigned t : adj)
+    {
+        m_interfere[t][b] = m_interfere[b][t] = false;
+        m_adj[t].erase(std::find(m_adj[t].begin(), m_adj[t].end(), b));
+        AddEdge(a, t);
+    }
+    m_alias[b] = a;
+    m_call[a] = m_call[a] || m_call[b];
+    m_cost[a] += m_cost[b];
+}
+
+void GraphColoring::Coalesce()
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto& move : m_moves)
+        {
+            unsigned a = Find(move.first), b = Find(move.second);
+            if (a == b || m_asm[a] || m_asm[b] || m_interfere[a][b] || !Briggs(a, b))
+            {
+                continue;
+            }
+            Merge(a, b);
+            changed = true;
+        }
+    }
+}
+
+RegAssignment GraphColoring::Color()
+{
+    RegAssignment res;
+    res.regs.assign(m_count, Register::Last);
+
+    std::vector<unsigned> nodes;
+    for (unsigned v : m_nodes)
+    {
+        if (Find(v) == v && !m_asm[v])
+        {
+            nodes.push_back(v);
+        }
+    }
+
+    // simplify: the values are taken off the graph one by one
+    std::vector<size_t> degree(m_count);
+    for (unsigned v : nodes)
+    {
+        degree[v] = m_adj[v].size();
+    }
+    std::vector<unsigned> stack;
+    while (!nodes.empty())
+    {
+        auto it = std::find_if(nodes.begin(), nodes.end(), [&](unsigned v) {
+            return degree[v] < Colors(v);
+        });
+        if (it == nodes.end())
+        {
+            // may not be colored, the one whose spill costs least per neighbour is chosen
+            it = std::min_element(nodes.begin(), nodes.end(), [&](unsigned a, unsigned b) {
+                return (double)m_cost[a] / degree[a] < (double)m_cost[b] / degree[b];
+            });
+        }
+
+        unsigned v = *it;
+        nodes.erase(it);
+        stack.push_back(v);
+        for (unsigned t : m_adj[v])
+        {
+            --degree[t];
+        }
+    }
+
+    // select: the values are put back and take a register none of their neighbours has
+    while (!stack.empty())
+    {
+        unsigned v = stack.back();
+        stack.pop_back();
+        // a parameter tries the register it arrives in first
+        std::vector<Register> order = m_regs;
+        auto in = std::find(order.begin(), order.end(), m_incoming[v]);
+        if (in != order.end())
+        {
+            std::rotate(order.begin(), in, in + 1);
+        }
+        for (Register r : order)
+        {
+            if (m_call[v] && !IsCalleeSaved(r))
+            {
+                continue;
+            }
+            bool used = false;
+            for (unsigned t : m_adj[v])
+            {
+                used = used || res.regs[t] == r;
+            }
+            if (!used)
+            {
+                res.regs[v] = r;
+                break;
+            }
+        }
+    }
+
+    for (unsigned v : m_nodes)
+    {
+        res.regs[v] = res.regs[Find(v)];
+        if (res.regs[v] == Register::Last)
+        {
+            ++res.spilled;
+        }
+    }
+    for (auto& move : m_moves)
+    {
+        if (res.regs[move.first] != Register::Last && res.regs[move.first] == res.regs[move.second])
+        {
+            ++res.coalesced;
+        }
+    }
+
+    for (Register r : CalleeSaved)
+    {
+        if (std::find(res.regs.begin(), res.regs.end(), r) != res.regs.end())
+        {
+            res.saved.push_back(r);
+        }
+    }
+    return res;
+}
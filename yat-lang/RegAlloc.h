@@ -0,0 +1,124 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <vector>
+#include "IR.h"
+#include "Register.h"
+
+// Numbers the instructions of a function in the order they are written and
+// finds the values live at the borders of its blocks. A phi is placed at the
+// start of its block, its arguments are used at the ends of the predecessors.
+class Liveness
+{
+public:
+    // positions of the instructions by id, and of the blocks by id
+    std::vector<size_t> pos;
+    std::vector<size_t> block_start, block_end;
+    // values live at the start and at the end of every block, by block id
+    std::vector<std::vector<bool>> live_in, live_out;
+    // positions of calls and of inline assembly, which may change any register
+    std::vector<size_t> calls, asms;
+    // calls whose callee is unknown or has inline assembly, which may return
+    // without restoring the callee-saved registers
+    std::vector<size_t> unsafe_calls;
+    // first and last position where every value is live, by id
+    std::vector<size_t> start, end;
+
+    Liveness(IRFunction& fn);
+
+    // TRUE if the value is given a location, constants are written as immediates
+    static bool Allocated(IRInstr* v);
+    // TRUE if a call or inline assembly lies inside the live range of the value,
+    // a call of unsafe_calls counts as both
+    bool CrossesCall(IRInstr* v) const;
+    bool CrossesAsm(IRInstr* v) const;
+};
+
+// registers of the values of a function
+struct RegAssignment
+{
+    // by value id, Register::Last for the values kept in memory
+    std::vector<Register> regs;
+    // callee-saved registers the function changes, it restores them on return
+    std::vector<Register> saved;
+    // for the report of the allocator
+    size_t coalesced = 0, spilled = 0;
+};
+
+// Registers values may be kept in. rax, rcx, rdx and r11 aren't among them,
+// instructions use them as scratch registers. Functions with inline assembly
+// don't use the callee-saved ones.
+extern const Register CalleeSaved[5];
+extern const Register CallerSaved[5];
+
+// Linear scan allocation: the live ranges are visited by their starts, a
+// range takes a free register or, if there is none, the one of the active
+// range which ends last, which then goes to memory. A parameter takes the
+// register it arrives in when that one is free. Ranges which cross a call
+// may take only callee-saved registers, the ones which cross inline assembly
+// or an unsafe call are kept in memory.
+class LinearScan
+{
+public:
+    static RegAssignment Run(IRFunction& fn);
+};
+
+// Chaitin-Briggs graph coloring: values live at the same time interfere and
+// get different registers. Copies and conversions which keep the register
+// are coalesced when the merged value passes the Briggs test. Values are
+// taken off the graph while it has one with fewer neighbours than registers,
+// otherwise the cheapest one per neighbour is taken off optimistically, and
+// the ones left without a color go to memory.
+class GraphColoring
+{
+    Liveness m_live;
+    size_t m_count;
+    // registers the values may take, the number of callee-saved ones among them
+    std::vector<Register> m_regs;
+    size_t m_callee = 0;
+    // registers the parameters arrive in, by id
+    std::vector<Register> m_incoming;
+    // ids of the values given a location
+    std::vector<unsigned> m_nodes;
+    // interference matrix and lists, by value id
+    std::vector<std::vector<bool>> m_interfere;
+    std::vector<std::vector<unsigned>> m_adj;
+    // values which cross a call or inline assembly (or an unsafe call)
+    std::vector<bool> m_call, m_asm;
+    // number of uses and definitions of the values
+    std::vector<size_t> m_cost;
+    // pairs of values which may share a register, the first is defined by a move
+    std::vector<std::pair<unsigned, unsigned>> m_moves;
+    // value a coalesced value is merged into, by id
+    std::vector<unsigned> m_alias;
+
+    GraphColoring(IRFunction& fn);
+
+    void AddEdge(unsigned a, unsigned b);
+    void Build(IRFunction& fn);
+    unsigned Find(unsigned v);
+    // number of registers the value may take
+    size_t Colors(unsigned v) const;
+    // TRUE if the merged value has fewer significant neighbours than registers
+    bool Briggs(unsigned a, unsigned b);
+    void Merge(unsigned a, unsigned b);
+    void Coalesce();
+    RegAssignment Color();
+
+public:
+    static RegAssignment Run(IRFunction& fn);
+};
@@ -17,6 +17,12 @@
 #include "Utils.h"
 #include "Register.h"
 
+const Register IntArgRegs[6]{ Register::rdi, Register::rsi, Register::rdx, Register::rcx, Register::r8, Register::r9 };
+const Register FloatArgRegs[8]{
+    Register::xmm0, Register::xmm1, Register::xmm2, Register::xmm3,
+    Register::xmm4, Register::xmm5, Register::xmm6, Register::xmm7
+};
+
 const String RegisterStr[]{
     L"al",
     L"bl",
@@ -42,6 +48,12 @@ const String RegisterStr[]{
     L"rsp",
     L"rsi",
     L"rdi",
+    L"esi",
+    L"edi",
+    L"si",
+    L"di",
+    L"sil",
+    L"dil",
     L"r8",
     L"r9",
     L"r10",
@@ -145,6 +157,30 @@ Register CvtReg(Register r, size_t ns)
         case 8: return Register::rdx;
         }
         break;
+    case Register::rsi:
+    case Register::esi:
+    case Register::si:
+    case Register::sil:
+        switch (ns)
+        {
+        case 1: return Register::sil;
+        case 2: return Register::si;
+        case 4: return Register::esi;
+        case 8: return Register::rsi;
+        }
+        break;
+    case Register::rdi:
+    case Register::edi:
+    case Register::di:
+    case Register::dil:
+        switch (ns)
+        {
+        case 1: return Register::dil;
+        case 2: return Register::di;
+        case 4: return Register::edi;
+        case 8: return Register::rdi;
+        }
+        break;
     case Register::r8:
     case Register::r8b:
     case Register::r8w:
@@ -242,5 +278,7 @@ Register CvtReg(Register r, size_t ns)
         }
         break;
     }
+    // there are no other sizes of the register
+    return r;
 }
 
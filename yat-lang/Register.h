@@ -59,6 +59,13 @@ enum class Register
     rsi, // source index
     rdi, // destination index
 
+    esi,  // source index (x32)
+    edi,  // destination index (x32)
+    si,   // source index (x16)
+    di,   // destination index (x16)
+    sil,  // source index (x8)
+    dil,  // destination index (x8)
+
     r8,    // register 8  (x64)
     r9,    // register 9  (x64)
     r10,   // register 10 (x64)
@@ -117,5 +124,10 @@ enum class Register
 
 extern const String RegisterStr[];
 
+// registers of the first integer and floating-point arguments of a call
+// (System V AMD64 ABI), the rest is passed on the stack
+extern const Register IntArgRegs[6];
+extern const Register FloatArgRegs[8];
+
 Register CvtReg(Register r, size_t ns);
 
@@ -0,0 +1,84 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include "Symbols.h"
+
+namespace
+{
+    std::mutex SymMutex;
+    // texts by symbol, deque keeps them in place when it grows
+    std::deque<String> SymTexts;
+    std::unordered_map<std::wstring_view, Symbol> SymIds;
+    // qualified names by the pair of symbols they are made of
+    std::unordered_map<uint64_t, Symbol> SymQualified;
+
+    Symbol InternLocked(std::wstring_view s)
+    {
+        auto it = SymIds.find(s);
+        if (it != SymIds.end())
+        {
+            return it->second;
+        }
+
+        Symbol id = (Symbol)SymTexts.size();
+        SymTexts.emplace_back(s);
+        SymIds.emplace(SymTexts.back(), id);
+        return id;
+    }
+}
+
+Symbol InternSymbol(std::wstring_view s)
+{
+    std::lock_guard<std::mutex> lock(SymMutex);
+    return InternLocked(s);
+}
+
+std::wstring_view SymbolText(Symbol s)
+{
+    if (s == NoSymbol)
+    {
+        return std::wstring_view();
+    }
+
+    std::lock_guard<std::mutex> lock(SymMutex);
+    return SymTexts[s];
+}
+
+Symbol QualifySymbol(Symbol left, Symbol right)
+{
+    if (left == NoSymbol || right == NoSymbol)
+    {
+        return NoSymbol;
+    }
+
+    std::lock_guard<std::mutex> lock(SymMutex);
+    uint64_t key = ((uint64_t)left << 32) | right;
+    auto it = SymQualified.find(key);
+    if (it != SymQualified.end())
+    {
+        return it->second;
+    }
+
+    String name = SymTexts[left];
+    name += L'.';
+    name += SymTexts[right];
+    Symbol id = InternLocked(name);
+    SymQualified.emplace(key, id);
+    return id;
+}
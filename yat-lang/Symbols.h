@@ -0,0 +1,33 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include "Utils.h"
+
+// Id of an interned identifier, qualified name or assembly label. Every
+// distinct string gets one id for the whole run, so names are compared as
+// integers and hashed as integers once they are interned.
+using Symbol = uint32_t;
+constexpr Symbol NoSymbol = UINT32_MAX;
+
+// Interning is thread-safe, texts of the symbols live until the program ends.
+Symbol InternSymbol(std::wstring_view s);
+// the text of NoSymbol is empty
+std::wstring_view SymbolText(Symbol s);
+// symbol of "left.right", NoSymbol if any of them is NoSymbol
+Symbol QualifySymbol(Symbol left, Symbol right);
@@ -16,107 +16,342 @@
 //
 #include "Tokenizer.h"
 #include "ErrorChecking.h"
-
-bool EofReturned = false;
+#include "FileMapping.h"
+#include <cwchar>
+#include <cfloat>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define YAT_SSE2
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define YAT_AVX2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 wchar_t Tokenizer::GetChar()
 {
-    if (m_code[m_offset] == '\n')
+    return m_code[m_offset++];
+}
+
+void Tokenizer::EatChars(size_t n)
+{
+    m_offset += n;
+}
+
+// Block scanning of the source. White space, line comments and bodies of
+// block comments are skipped 16 or 32 bytes at a time.
+
+static inline uint32_t LowBit(uint32_t m)
+{
+#ifdef _MSC_VER
+    unsigned long r;
+    _BitScanForward(&r, m);
+    return r;
+#else
+    return __builtin_ctz(m);
+#endif
+}
+
+static inline bool IsWhiteASCII(wchar_t c)
+{
+    return c == L' ' || c == 0 || (c >= L'\t' && c <= L'\r');
+}
+
+#ifdef YAT_SSE2
+static inline __m128i Set128(wchar_t c)
+{
+    if constexpr (sizeof(wchar_t) == 2) return _mm_set1_epi16((short)c);
+    else return _mm_set1_epi32((int)c);
+}
+
+static inline __m128i CmpEq128(__m128i a, __m128i b)
+{
+    if constexpr (sizeof(wchar_t) == 2) return _mm_cmpeq_epi16(a, b);
+    else return _mm_cmpeq_epi32(a, b);
+}
+
+static inline __m128i CmpGt128(__m128i a, __m128i b)
+{
+    if constexpr (sizeof(wchar_t) == 2) return _mm_cmpgt_epi16(a, b);
+    else return _mm_cmpgt_epi32(a, b);
+}
+
+// ' ', '\0' and '\t'...'\r'
+// 16-bit characters above 0x7FFF compare as negative and are never white space
+static inline __m128i White128(__m128i v)
+{
+    __m128i r = _mm_or_si128(CmpEq128(v, Set128(L' ')), CmpEq128(v, _mm_setzero_si128()));
+    __m128i range = _mm_and_si128(CmpGt128(v, Set128(L'\t' - 1)), CmpGt128(Set128(L'\r' + 1), v));
+    return _mm_or_si128(r, range);
+}
+#endif
+
+#ifdef YAT_AVX2
+static inline __m256i Set256(wchar_t c)
+{
+    if constexpr (sizeof(wchar_t) == 2) return _mm256_set1_epi16((short)c);
+    else return _mm256_set1_epi32((int)c);
+}
+
+static inline __m256i CmpEq256(__m256i a, __m256i b)
+{
+    if constexpr (sizeof(wchar_t) == 2) return _mm256_cmpeq_epi16(a, b);
+    else return _mm256_cmpeq_epi32(a, b);
+}
+
+static inline __m256i CmpGt256(__m256i a, __m256i b)
+{
+    if constexpr (sizeof(wchar_t) == 2) return _mm256_cmpgt_epi16(a, b);
+    else return _mm256_cmpgt_epi32(a, b);
+}
+
+static inline __m256i White256(__m256i v)
+{
+    __m256i r = _mm256_or_si256(CmpEq256(v, Set256(L' ')), CmpEq256(v, _mm256_setzero_si256()));
+    __m256i range = _mm256_and_si256(CmpGt256(v, Set256(L'\t' - 1)), CmpGt256(Set256(L'\r' + 1), v));
+    return _mm256_or_si256(r, range);
+}
+#endif
+
+// length of the ASCII white space run at the start of s[0..n)
+static size_t SpanWhite(const wchar_t* s, size_t n)
+{
+    size_t i = 0;
+#ifdef YAT_AVX2
+    for (constexpr size_t L = 32 / sizeof(wchar_t); i + L <= n; i += L)
     {
-        ++line;
-        col = 1;
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t ws = (uint32_t)_mm256_movemask_epi8(White256(v));
+        if (ws != 0xFFFFFFFF)
+        {
+            return i + LowBit(~ws) / sizeof(wchar_t);
+        }
     }
-    else
+#endif
+#ifdef YAT_SSE2
+    for (constexpr size_t L = 16 / sizeof(wchar_t); i + L <= n; i += L)
     {
-        ++col;
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        uint32_t ws = (uint32_t)_mm_movemask_epi8(White128(v));
+        if (ws != 0xFFFF)
+        {
+            return i + LowBit(~ws) / sizeof(wchar_t);
+        }
     }
-
-    return m_code[m_offset++];
+#endif
+    while (i < n && IsWhiteASCII(s[i])) ++i;
+    return i;
 }
 
-void Tokenizer::EatChars(size_t n)
+// index of the first c in s[0..n) or n if there is none
+static size_t FindChar(const wchar_t* s, size_t n, wchar_t c)
 {
-    for (size_t i = 0; i < n; ++i)
+    size_t i = 0;
+#ifdef YAT_AVX2
+    for (constexpr size_t L = 32 / sizeof(wchar_t); i + L <= n; i += L)
     {
-        GetChar();
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(CmpEq256(v, Set256(c)));
+        if (m)
+        {
+            return i + LowBit(m) / sizeof(wchar_t);
+        }
     }
+#endif
+#ifdef YAT_SSE2
+    for (constexpr size_t L = 16 / sizeof(wchar_t); i + L <= n; i += L)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        uint32_t m = (uint32_t)_mm_movemask_epi8(CmpEq128(v, Set128(c)));
+        if (m)
+        {
+            return i + LowBit(m) / sizeof(wchar_t);
+        }
+    }
+#endif
+    while (i < n && s[i] != c) ++i;
+    return i;
 }
 
 void Tokenizer::SkipWhite()
 {
-    wchar_t c = m_code[m_offset];
-    while (iswspace(c) || iswblank(c) || c == L'\t' || c == 0)
+    while (m_offset < m_code.size())
     {
-        GetChar();
+        m_offset += SpanWhite(&m_code[m_offset], m_code.size() - m_offset);
         if (m_offset == m_code.size()) break;
-        c = m_code[m_offset];
+
+        // the block scan only knows ASCII white space
+        wchar_t c = m_code[m_offset];
+        if (c < 0x80 || !(iswspace(c) || iswblank(c))) break;
+        GetChar();
     }
 }
 
-// check if given number token is valid, i.e. specified number of bits is enough
-bool Tokenizer::IsNumValid(const Token& t)
+// Keywords are found by a perfect hash built at compile time over KeywordStr.
+// A name is hashed by its length and three of its characters. Every slot of
+// the table holds at most one keyword, so a single compare confirms the match.
+namespace KwHash
 {
-    switch (t.type)
+    constexpr size_t Bits = 7;
+    constexpr size_t Size = (size_t)1 << Bits;
+    constexpr size_t Count = (size_t)Keyword::Last;
+
+    static_assert(sizeof(KeywordStr) / sizeof(KeywordStr[0]) == Count + 1,
+        "KeywordStr must have a string for every keyword");
+
+    constexpr size_t Length(const wchar_t* s)
     {
-    case TokenType::Int8L:
-        return IntToString(StringToNum<int8_t>(t.data)) == t.data;
-    case TokenType::Int16L:
-        return IntToString(StringToNum<int16_t>(t.data)) == t.data;
-    case TokenType::Int32L:
-        return IntToString(StringToNum<int32_t>(t.data)) == t.data;
-    case TokenType::Int64L:
-        return IntToString(StringToNum<int64_t>(t.data)) == t.data;
+        size_t n = 0;
+        while (s[n]) ++n;
+        return n;
+    }
 
-    case TokenType::Uint8L:
-        return IntToString(StringToNum<uint8_t>(t.data)) == t.data;
-    case TokenType::Uint16L:
-        return IntToString(StringToNum<uint16_t>(t.data)) == t.data;
-    case TokenType::Uint32L:
-        return IntToString(StringToNum<uint32_t>(t.data)) == t.data;
-    case TokenType::Uint64L:
-        return IntToString(StringToNum<uint64_t>(t.data)) == t.data;
+    // names shorter or longer than any keyword are rejected without hashing
+    constexpr size_t MinLen()
+    {
+        size_t r = Length(KeywordStr[0]);
+        for (size_t i = 1; i < Count; ++i)
+        {
+            if (Length(KeywordStr[i]) < r) r = Length(KeywordStr[i]);
+        }
+        return r;
+    }
 
-    case TokenType::Float32L:
-        return IntToString(StringToNum<float>(t.data)) == t.data;
-    case TokenType::Float64L:
-        return IntToString(StringToNum<double>(t.data)) == t.data;
+    constexpr size_t MaxLen()
+    {
+        size_t r = 0;
+        for (size_t i = 0; i < Count; ++i)
+        {
+            if (Length(KeywordStr[i]) > r) r = Length(KeywordStr[i]);
+        }
+        return r;
+    }
 
-    default:
-        return false;
+    static_assert(MinLen() >= 2, "the hash reads the second character of a name");
+
+    // n must be at least 2
+    constexpr size_t Hash(const wchar_t* s, size_t n, uint64_t seed)
+    {
+        uint64_t x = (uint64_t)n
+            | ((uint64_t)(uint16_t)s[0] << 8)
+            | ((uint64_t)(uint16_t)s[1] << 24)
+            | ((uint64_t)(uint16_t)s[n - 1] << 40);
+        x *= 0x9E3779B97F4A7C15ull;
+        x ^= seed;
+        x *= 0xFF51AFD7ED558CCDull;
+        return (size_t)(x >> (64 - Bits));
     }
-}
 
-Keyword Tokenizer::IsKeyword(const String& str)
-{
-    for (int i = 0; i < (int)Keyword::Last; ++i)
+    struct Table
+    {
+        uint64_t seed = ~0ull;
+        // index of the keyword in the slot or -1
+        int8_t kw[Size]{};
+        uint8_t len[Size]{};
+    };
+
+    // look for the first seed that gives no collisions
+    constexpr Table Build()
     {
-        if (str == KeywordStr[i])
+        for (uint64_t seed = 0; seed < 1024; ++seed)
         {
-            return (Keyword)i;
+            Table t{};
+            for (size_t i = 0; i < Size; ++i)
+            {
+                t.kw[i] = -1;
+            }
+
+            bool ok = true;
+            for (size_t i = 0; i < Count && ok; ++i)
+            {
+                size_t n = Length(KeywordStr[i]);
+                size_t h = Hash(KeywordStr[i], n, seed);
+                if (t.kw[h] != -1)
+                {
+                    ok = false;
+                }
+                t.kw[h] = (int8_t)i;
+                t.len[h] = (uint8_t)n;
+            }
+
+            if (ok)
+            {
+                t.seed = seed;
+                return t;
+            }
         }
+        return Table{};
+    }
+
+    constexpr Table table = Build();
+    static_assert(table.seed != ~0ull, "no perfect hash seed for keywords, increase Bits");
+}
+
+Keyword Tokenizer::IsKeyword(const wchar_t* str, size_t n)
+{
+    if (n < KwHash::MinLen() || n > KwHash::MaxLen())
+    {
+        return Keyword::Last;
     }
 
-    return Keyword::Last;
+    size_t h = KwHash::Hash(str, n, KwHash::table.seed);
+    int8_t i = KwHash::table.kw[h];
+    if (i < 0 || KwHash::table.len[h] != n || wmemcmp(KeywordStr[i], str, n) != 0)
+    {
+        return Keyword::Last;
+    }
+
+    return (Keyword)i;
 }
 
 Tokenizer::Tokenizer(const std::vector<String>& str, bool path)
 {
-    EofReturned = false;
     m_code = L"";
     if (path)
     {
-        uint64_t st_line = 0;
+        // map all files first to know the size of the whole buffer
+        // (UTF-8 text never has less bytes than decoded characters)
+        std::vector<FileMapping> maps;
+        maps.reserve(str.size());
+        size_t size = 0;
         for (const String& s : str)
         {
-            if (!ReadFile(s, m_code))
+            maps.emplace_back(s);
+            if (!maps.back().IsOpen())
             {
                 throw Error(L"file " + s + L" not found\n");
             }
+            size += maps.back().Size() + 1;
+        }
 
-            uint64_t lines = std::count(m_code.cbegin(), m_code.cend(), L'\n');
-            files.push_back(FileInfo(st_line, st_line + lines, s));
-            st_line += lines;
+        m_code.resize(size);
+        size_t len = 0;
+        for (size_t i = 0; i < maps.size(); ++i)
+        {
+            wchar_t* start = &m_code[len];
+            size_t n = DecodeUTF8(maps[i].Data(), maps[i].Size(), start);
+
+            // the last line of a file must not continue in the next one
+            if (n == 0 || start[n - 1] != L'\n')
+            {
+                start[n++] = L'\n';
+            }
+
+            uint64_t st_line = m_lines.size();
+            IndexLines(start, n, len);
+            files.push_back(FileInfo(st_line, m_lines.size(), str[i]));
+            len += n;
         }
+        m_code.resize(len);
     }
     else
     {
@@ -124,150 +359,242 @@ Tokenizer::Tokenizer(const std::vector<String>& str, bool path)
         {
             m_code += s;
         }
+        IndexLines(m_code.data(), m_code.size(), 0);
     }
     m_code += L" \n \n "; // adding a bit of garbage to prevent overflow
     m_offset = 0;
 }
 
+void Tokenizer::IndexLines(const wchar_t* s, size_t n, uint64_t offset)
+{
+    m_lines.push_back(offset);
+    for (size_t i = FindChar(s, n, L'\n') + 1; i < n; i += FindChar(s + i, n - i, L'\n') + 1)
+    {
+        m_lines.push_back(offset + i);
+    }
+}
+
+uint64_t Tokenizer::GetLineNum(uint64_t offset) const
+{
+    return std::upper_bound(m_lines.begin(), m_lines.end(), offset) - m_lines.begin();
+}
+
+uint64_t Tokenizer::GetColNum(uint64_t offset) const
+{
+    uint64_t l = GetLineNum(offset);
+    return l ? offset - m_lines[l - 1] + 1 : offset + 1;
+}
+
+size_t Tokenizer::GetFile(uint64_t line) const
+{
+    auto f = std::lower_bound(files.begin(), files.end(), line,
+        [](const FileInfo& fi, uint64_t l) { return fi.EndLine < l; });
+    return f == files.end() ? files.size() - 1 : f - files.begin();
+}
+
 void Tokenizer::UnexpToken(const String& msg)
 {
     size_t _0{};
     String r = GetLine(m_offset, m_offset, _0);
-    throw UnexpectedToken(prevLine - files[m_cfile].StartLine, msg, r, 0, 0, files[m_cfile].Name);
+    uint64_t line = GetLineNum(m_offset);
+    const FileInfo& f = files[GetFile(line)];
+    throw UnexpectedToken(line - f.StartLine, msg, r, 0, 0, f.Name);
 }
 
 void Tokenizer::UnexpToken(const String& msg, Token* t)
 {
     size_t s{};
     String r = GetLine(t->start, t->end, s);
-    throw UnexpectedToken(t->line - files[m_cfile].StartLine, msg, r, t->start - s, t->end - s, files[m_cfile].Name);
+    uint64_t line = GetLineNum(t->start);
+    const FileInfo& f = files[GetFile(line)];
+    throw UnexpectedToken(line - f.StartLine, msg, r, t->start - s, t->end - s, f.Name);
 }
 
 Token Tokenizer::ParseName()
 {
-    String r = L"";
-
     uint64_t s_offset = m_offset;
 
     wchar_t c = m_code[m_offset];
 
     while (IsAlpha(c) || IsNumber(c) || c == L'_')
     {
-        r += c;
         GetChar();
         c = m_code[m_offset];
     }
 
-    Keyword kw = IsKeyword(r);
+    std::wstring_view r(&m_code[s_offset], m_offset - s_offset);
+    Keyword kw = IsKeyword(r.data(), r.length());
 
-    auto t = Token(r, TokenType::Name, s_offset, m_offset, line, kw);
+    auto t = Token(r, TokenType::Name, s_offset, m_offset, kw);
     SkipWhite();
     return t;
 }
 
-String Tokenizer::ParseNumber()
+std::wstring_view Tokenizer::ParseNumber()
 {
-    String r = L"";
+    uint64_t s_offset = m_offset;
 
     wchar_t c = m_code[m_offset];
 
     while (IsNumber(c) || c == L'_' || c == L'.')
     {
-        if (c != L'_') r += c;
         GetChar();
         c = m_code[m_offset];
     }
 
-    return r;
+    return std::wstring_view(&m_code[s_offset], m_offset - s_offset);
 }
 
-Token Tokenizer::ParseNumberLiteral()
+// Number literal token viewing the source, or owning a copy without '_' separators
+static Token NumberToken(std::wstring_view r, TokenType type, uint64_t start, uint64_t end)
 {
-    String r = ParseNumber();
-    auto s_offset = m_offset;
+    auto t = Token(r, type, start, end);
+    if (r.find(L'_') != std::wstring_view::npos)
+    {
+        String d;
+        d.reserve(r.length());
+        for (wchar_t c : r)
+            if (c != L'_') d += c;
+        t.SetOwnText(d);
+    }
+    return t;
+}
 
-    if (m_code[m_offset] == L'i')
+// type of a literal with suffix sfx and number of bits, EoF if there is no such type
+static TokenType LiteralType(wchar_t sfx, std::wstring_view bits)
+{
+    constexpr struct
     {
-        GetChar();
-        String bits = ParseNumber();
-        if (bits == L"8")
-        {
-            auto t = Token(r, TokenType::Int8L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
-        }
-        if (bits == L"16")
+        wchar_t sfx;
+        const wchar_t* bits;
+        TokenType type;
+    } types[]{
+        { L'i', L"8", TokenType::Int8L }, { L'i', L"16", TokenType::Int16L },
+        { L'i', L"32", TokenType::Int32L }, { L'i', L"64", TokenType::Int64L },
+        { L'u', L"8", TokenType::Uint8L }, { L'u', L"16", TokenType::Uint16L },
+        { L'u', L"32", TokenType::Uint32L }, { L'u', L"64", TokenType::Uint64L },
+        { L'f', L"32", TokenType::Float32L }, { L'f', L"64", TokenType::Float64L },
+    };
+
+    for (const auto& t : types)
+    {
+        if (t.sfx == sfx && bits == t.bits)
         {
-            auto t = Token(r, TokenType::Int16L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
+            return t.type;
         }
-        if (bits == L"32")
+    }
+    return TokenType::EoF;
+}
+
+static uint64_t MaxValue(TokenType type)
+{
+    switch (type)
+    {
+    case TokenType::Int8L: return INT8_MAX;
+    case TokenType::Int16L: return INT16_MAX;
+    case TokenType::Int32L: return INT32_MAX;
+    case TokenType::Int64L: return INT64_MAX;
+    case TokenType::Uint8L: return UINT8_MAX;
+    case TokenType::Uint16L: return UINT16_MAX;
+    case TokenType::Uint32L: return UINT32_MAX;
+    default: return UINT64_MAX;
+    }
+}
+
+// The literal is parsed while it's scanned: digits are accumulated into a
+// 64-bit integer with overflow check, then the value is checked against the
+// range of the type given by the suffix and stored in the token.
+Token Tokenizer::ParseNumberLiteral()
+{
+    uint64_t s_offset = m_offset;
+    uint64_t mant = 0;
+    bool overflow = false;
+    // number of digits after the point, -1 if there is no point
+    int64_t frac = -1;
+
+    wchar_t c = m_code[m_offset];
+    while (IsNumber(c) || c == L'_' || c == L'.')
+    {
+        if (c == L'.')
         {
-            auto t = Token(r, TokenType::Int32L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
+            if (frac >= 0)
+            {
+                UnexpToken(L"Invalid number literal. It has more than one decimal point.");
+            }
+            frac = 0;
         }
-        if (bits == L"64")
+        else if (c != L'_')
         {
-            auto t = Token(r, TokenType::Int64L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
+            uint64_t d = (uint64_t)(c - L'0');
+            if (mant > (UINT64_MAX - d) / 10)
+            {
+                overflow = true;
+            }
+            mant = mant * 10 + d;
+            if (frac >= 0) ++frac;
         }
-        UnexpToken(L"\"i\" after a number literal must be followed by number of bits (8, 16, 32 or 64).");
+        GetChar();
+        c = m_code[m_offset];
     }
 
-    if (m_code[m_offset] == L'u')
+    std::wstring_view r(&m_code[s_offset], m_offset - s_offset);
+    TokenType type = frac < 0 ? TokenType::Int32L : TokenType::Float64L;
+
+    wchar_t sfx = m_code[m_offset];
+    if (sfx == L'i' || sfx == L'u' || sfx == L'f')
     {
-        ++m_offset;
-        String bits = ParseNumber();
-        if (bits == L"8")
-        {
-            auto t = Token(r, TokenType::Uint8L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
-        }
-        if (bits == L"16")
+        GetChar();
+        type = LiteralType(sfx, ParseNumber());
+        if (type == TokenType::EoF)
         {
-            auto t = Token(r, TokenType::Uint16L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
+            if (sfx == L'f')
+            {
+                UnexpToken(L"\"f\" after a floating-point number literal must be followed by number of bits (32 or 64).");
+            }
+            UnexpToken(String(L"\"") + sfx + L"\" after a number literal must be followed by number of bits (8, 16, 32 or 64).");
         }
-        if (bits == L"32")
+    }
+
+    auto t = NumberToken(r, type, s_offset, m_offset);
+
+    if (IsNumber(type))
+    {
+        if (frac >= 0)
         {
-            auto t = Token(r, TokenType::Uint32L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
+            UnexpToken(L"Invalid number literal. Integer literal cannot have a fractional part.", &t);
         }
-        if (bits == L"64")
+        if (overflow || mant > MaxValue(type))
         {
-            auto t = Token(r, TokenType::Uint64L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
+            UnexpToken(L"Invalid number literal. It doesn't fit the given number of bits.", &t);
         }
-        UnexpToken(L"\"u\" after a number literal must be followed by number of bits (8, 16, 32 or 64).");
+        t.num.u = mant;
     }
-    if (m_code[m_offset] == L'f')
+    else
     {
-        ++m_offset;
-        String bits = ParseNumber();
-        if (bits == L"32")
+        // powers of ten that are exact in double
+        static constexpr double pow10[]{
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        // the division is correctly rounded if both numbers are exact,
+        // only long literals need the library conversion
+        if (frac < 0) frac = 0;
+        if (!overflow && mant <= (1ull << 53) && frac <= 22)
         {
-            auto t = Token(r, TokenType::Float32L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
+            t.num.f = (double)mant / pow10[frac];
         }
-        if (bits == L"64")
+        else
+        {
+            t.num.f = std::wcstod(String(t.GetText()).c_str(), nullptr);
+        }
+
+        if (t.num.f > (type == TokenType::Float32L ? FLT_MAX : DBL_MAX))
         {
-            auto t = Token(r, TokenType::Float64L, s_offset, m_offset, line);
-            SkipWhite();
-            return t;
+            UnexpToken(L"Invalid number literal. It doesn't fit the given number of bits.", &t);
         }
-        UnexpToken(L"\"f\" after a floating-point number literal must be followed by number of bits (32 or 64).");
     }
-    auto t = Token(r, 
-        r.find_first_of(L'.') == String::npos ? TokenType::Int32L : TokenType::Float64L,
-        s_offset, m_offset, line);
+
     SkipWhite();
     return t;
 }
@@ -329,60 +656,55 @@ String Tokenizer::GetLine(uint64_t offs, uint64_t offe, size_t& s)
 
 void Tokenizer::NextLine()
 {
-    while (m_code[m_offset] != L'\n')
+    m_offset += FindChar(&m_code[m_offset], m_code.size() - m_offset, L'\n');
+    if (m_offset < m_code.size())
     {
-        GetChar();
+        GetChar(); // skip \n
     }
-    GetChar();
 }
 
 void Tokenizer::SkipComments()
 {
-    while (true)
+    SkipWhite();
+    while (m_offset + 1 < m_code.size() && m_code[m_offset] == L'/')
     {
-        if (m_code[m_offset] == L'/')
+        if (m_code[m_offset + 1] == L'/')
         {
-            if (m_code[m_offset + 1] == L'/')
+            NextLine();
+        }
+        else if (m_code[m_offset + 1] == L'*')
+        {
+            EatChars(2); // skip /*
+            while (true)
             {
-                while (m_code[m_offset] == L'/' && m_code[m_offset + 1] == L'/')
+                m_offset += FindChar(&m_code[m_offset], m_code.size() - m_offset, L'*');
+                if (m_offset + 1 >= m_code.size())
                 {
-                    NextLine();
-                    SkipWhite();
+                    UnexpToken(L"End of file inside a comment. Did you forget to close it with `*/'?");
                 }
-            }
-            else if (m_code[m_offset + 1] == L'*')
-            {
-                GetChar(); // skip /
                 GetChar(); // skip *
-                while (true)
+                if (m_code[m_offset] == L'/')
                 {
-                    if (m_code[m_offset] == L'*' && m_code[m_offset + 1] == L'/')
-                    {
-                        GetChar(); // skip *
-                        GetChar(); // skip /
-                        break;
-                    }
-                    GetChar();
+                    GetChar(); // skip /
+                    break;
                 }
             }
-            else
-            {
-                SkipWhite();
-                return;
-            }
         }
         else
         {
-            SkipWhite();
-            return;
+            break;
         }
+        SkipWhite();
     }
 }
 
 template<>
 Token Tokenizer::ParseStringLiteral<Tokenizer::StringType::Regular>()
 {
+    // the literal is a view into the source until the first escape sequence,
+    // after that it's unescaped into r
     String r = L"";
+    bool escaped = false;
     auto s_offset = m_offset;
 
     while (m_offset < m_code.length())
@@ -392,7 +714,10 @@ Token Tokenizer::ParseStringLiteral<Tokenizer::StringType::Regular>()
         case L'"':
         {
             GetChar();
-            return Token(r, TokenType::String, s_offset, m_offset, line);
+            if (escaped)
+                return Token(r, TokenType::String, s_offset, m_offset);
+            return Token(std::wstring_view(&m_code[s_offset], m_offset - 1 - s_offset),
+                TokenType::String, s_offset, m_offset);
         }
         case L'\n':
         {
@@ -400,6 +725,11 @@ Token Tokenizer::ParseStringLiteral<Tokenizer::StringType::Regular>()
         }
         case L'\\': // escape character
         {
+            if (!escaped)
+            {
+                r.assign(&m_code[s_offset], m_offset - s_offset);
+                escaped = true;
+            }
             GetChar();
             r += ParseEscapeChar();
             GetChar();
@@ -407,7 +737,7 @@ Token Tokenizer::ParseStringLiteral<Tokenizer::StringType::Regular>()
         }
         }
 
-        r += m_code[m_offset];
+        if (escaped) r += m_code[m_offset];
         GetChar();
     }
     UnexpToken(L"End of file while parsing a string literal. Did you forget to close a quote (\")?");
@@ -416,7 +746,6 @@ Token Tokenizer::ParseStringLiteral<Tokenizer::StringType::Regular>()
 template<>
 Token Tokenizer::ParseStringLiteral<Tokenizer::StringType::Raw>()
 {
-    String r = L"";
     auto s_offset = m_offset;
 
     while (m_offset < m_code.length())
@@ -425,10 +754,10 @@ Token Tokenizer::ParseStringLiteral<Tokenizer::StringType::Raw>()
         {
             GetChar();
             GetChar();
-            return Token(r, TokenType::String, s_offset, m_offset, line);
+            return Token(std::wstring_view(&m_code[s_offset], m_offset - 2 - s_offset),
+                TokenType::String, s_offset, m_offset);
         }
 
-        r += m_code[m_offset];
         GetChar();
     }
 
@@ -438,13 +767,14 @@ Token Tokenizer::ParseStringLiteral<Tokenizer::StringType::Raw>()
 Token Tokenizer::ParseRawUntil(wchar_t tt)
 {
     auto s_offset = m_offset;
-    size_t off = m_code.find_first_of(tt, m_offset) - m_offset;
-    String str = m_code.substr(m_offset - 2, off);
-    EatChars(off);
-    prevCol = col;
-    prevLine = line;
-    prevOffset = m_offset;
-    return Token(str, TokenType::String, s_offset, m_offset, line);
+    size_t end = m_code.find_first_of(tt, m_offset);
+    if (end == String::npos)
+    {
+        UnexpToken(String(L"End of file while looking for '") + tt + L"'");
+    }
+    std::wstring_view str(&m_code[m_offset], end - m_offset);
+    EatChars(end - m_offset);
+    return Token(str, TokenType::String, s_offset, m_offset);
 }
 
 Token Tokenizer::ParseOperator()
@@ -457,40 +787,40 @@ Token Tokenizer::ParseOperator()
         if (m_code[m_offset] == L'+')
         {
             GetChar();
-            return Token(L"++", TokenType::OperInc, s_offset, m_offset, line);
+            return Token(L"++", TokenType::OperInc, s_offset, m_offset);
         }
         else if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"+=", TokenType::AssignPlus, s_offset, m_offset, line);
+            return Token(L"+=", TokenType::AssignPlus, s_offset, m_offset);
         }
-        return Token(L"+", TokenType::OperPlus, s_offset, m_offset, line);
+        return Token(L"+", TokenType::OperPlus, s_offset, m_offset);
 
     case L'-':
         GetChar();
         if (m_code[m_offset] == L'-')
         {
             GetChar();
-            return Token(L"--", TokenType::OperDec, s_offset, m_offset, line);
+            return Token(L"--", TokenType::OperDec, s_offset, m_offset);
         }
         else if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"-=", TokenType::AssignMin, s_offset, m_offset, line);
+            return Token(L"-=", TokenType::AssignMin, s_offset, m_offset);
         }
         else if (m_code[m_offset] == L'>')
         {
             GetChar();
-            return Token(L"->", TokenType::Arrow, s_offset, m_offset, line);
+            return Token(L"->", TokenType::Arrow, s_offset, m_offset);
         }
-        return Token(L"-", TokenType::OperMin, s_offset, m_offset, line);
+        return Token(L"-", TokenType::OperMin, s_offset, m_offset);
 
     case L'*':
         GetChar();
         if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"*=", TokenType::AssignMul, s_offset, m_offset, line);
+            return Token(L"*=", TokenType::AssignMul, s_offset, m_offset);
         }
         else if (m_code[m_offset] == L'*')
         {
@@ -498,35 +828,35 @@ Token Tokenizer::ParseOperator()
             if (m_code[m_offset] == L'=')
             {
                 GetChar();
-                return Token(L"**=", TokenType::AssignPow, s_offset, m_offset, line);
+                return Token(L"**=", TokenType::AssignPow, s_offset, m_offset);
             }
-            return Token(L"**", TokenType::OperPow, s_offset, m_offset, line);
+            return Token(L"**", TokenType::OperPow, s_offset, m_offset);
         }
-        return Token(L"*", TokenType::OperMul, s_offset, m_offset, line);
+        return Token(L"*", TokenType::OperMul, s_offset, m_offset);
     case L'/':
         GetChar();
         if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"/=", TokenType::AssignDiv, s_offset, m_offset, line);
+            return Token(L"/=", TokenType::AssignDiv, s_offset, m_offset);
         }
-        return Token(L"/", TokenType::OperDiv, s_offset, m_offset, line);
+        return Token(L"/", TokenType::OperDiv, s_offset, m_offset);
     case L'%':
         GetChar();
         if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"%=", TokenType::AssignPCent, s_offset, m_offset, line);
+            return Token(L"%=", TokenType::AssignPCent, s_offset, m_offset);
         }
-        return Token(L"%", TokenType::OperPCent, s_offset, m_offset, line);
+        return Token(L"%", TokenType::OperPCent, s_offset, m_offset);
     case L'^':
         GetChar();
         if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"^=", TokenType::AssignXor, s_offset, m_offset, line);
+            return Token(L"^=", TokenType::AssignXor, s_offset, m_offset);
         }
-        return Token(L"^", TokenType::OperXor, s_offset, m_offset, line);
+        return Token(L"^", TokenType::OperXor, s_offset, m_offset);
     case L'<':
         GetChar();
         if (m_code[m_offset] == L'<')
@@ -535,16 +865,16 @@ Token Tokenizer::ParseOperator()
             if (m_code[m_offset] == L'=')
             {
                 GetChar();
-                return Token(L"<<=", TokenType::AssignLShift, s_offset, m_offset, line);
+                return Token(L"<<=", TokenType::AssignLShift, s_offset, m_offset);
             }
-            return Token(L"<<", TokenType::OperLShift, s_offset, m_offset, line);
+            return Token(L"<<", TokenType::OperLShift, s_offset, m_offset);
         }
         else if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"<=", TokenType::OperLEqual, s_offset, m_offset, line);
+            return Token(L"<=", TokenType::OperLEqual, s_offset, m_offset);
         }
-        return Token(L"<", TokenType::OperLess, s_offset, m_offset, line);
+        return Token(L"<", TokenType::OperLess, s_offset, m_offset);
     case L'>':
         GetChar();
         if (m_code[m_offset] == L'>')
@@ -553,103 +883,103 @@ Token Tokenizer::ParseOperator()
             if (m_code[m_offset] == L'=')
             {
                 GetChar();
-                return Token(L">>=", TokenType::AssignRShift, s_offset, m_offset, line);
+                return Token(L">>=", TokenType::AssignRShift, s_offset, m_offset);
             }
-            return Token(L">>", TokenType::OperRShift, s_offset, m_offset, line);
+            return Token(L">>", TokenType::OperRShift, s_offset, m_offset);
         }
         else if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L">=", TokenType::OperGEqual, s_offset, m_offset, line);
+            return Token(L">=", TokenType::OperGEqual, s_offset, m_offset);
         }
-        return Token(L">", TokenType::OperGreater, s_offset, m_offset, line);
+        return Token(L">", TokenType::OperGreater, s_offset, m_offset);
     case L'&':
         GetChar();
         if (m_code[m_offset] == L'&')
         {
             GetChar();
-            return Token(L"&&", TokenType::OperLAnd, s_offset, m_offset, line);
+            return Token(L"&&", TokenType::OperLAnd, s_offset, m_offset);
         }
         else if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"&=", TokenType::AssignBWAnd, s_offset, m_offset, line);
+            return Token(L"&=", TokenType::AssignBWAnd, s_offset, m_offset);
         }
-        return Token(L"&", TokenType::OperBWAnd, s_offset, m_offset, line);
+        return Token(L"&", TokenType::OperBWAnd, s_offset, m_offset);
     case L'|':
         GetChar();
         if (m_code[m_offset] == L'|')
         {
             GetChar();
-            return Token(L"||", TokenType::OperLOr, s_offset, m_offset, line);
+            return Token(L"||", TokenType::OperLOr, s_offset, m_offset);
         }
         else if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"|=", TokenType::AssignBWOr, s_offset, m_offset, line);
+            return Token(L"|=", TokenType::AssignBWOr, s_offset, m_offset);
         }
-        return Token(L"|", TokenType::OperBWOr, s_offset, m_offset, line);
+        return Token(L"|", TokenType::OperBWOr, s_offset, m_offset);
     case L'~':
         GetChar();
-        return Token(L"~", TokenType::OperNot, s_offset, m_offset, line);
+        return Token(L"~", TokenType::OperNot, s_offset, m_offset);
     case L'!':
         GetChar();
         if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"!=", TokenType::OperNEqual, s_offset, m_offset, line);
+            return Token(L"!=", TokenType::OperNEqual, s_offset, m_offset);
         }
-        return Token(L"!", TokenType::OperLNot, s_offset, m_offset, line);
+        return Token(L"!", TokenType::OperLNot, s_offset, m_offset);
     case L';':
         GetChar();
-        return Token(L";", TokenType::Semi, s_offset, m_offset, line);
+        return Token(L";", TokenType::Semi, s_offset, m_offset);
     case L'=':
         GetChar();
         if (m_code[m_offset] == L'=')
         {
             GetChar();
-            return Token(L"==", TokenType::OperEqual, s_offset, m_offset, line);
+            return Token(L"==", TokenType::OperEqual, s_offset, m_offset);
         }
-        return Token(L"=", TokenType::Assign, s_offset, m_offset, line);
+        return Token(L"=", TokenType::Assign, s_offset, m_offset);
 
     case L'{':
         GetChar();
-        return Token(L"{", TokenType::LBrace, s_offset, m_offset, line);
+        return Token(L"{", TokenType::LBrace, s_offset, m_offset);
     case L'}':
         GetChar();
-        return Token(L"}", TokenType::RBrace, s_offset, m_offset, line);
+        return Token(L"}", TokenType::RBrace, s_offset, m_offset);
 
     case L'(':
         GetChar();
-        return Token(L"(", TokenType::LParen, s_offset, m_offset, line);
+        return Token(L"(", TokenType::LParen, s_offset, m_offset);
     case L')':
         GetChar();
         if (m_code[m_offset] == L'!')
         {
             GetChar();
-            return Token(L")!", TokenType::PPEnd, s_offset, m_offset, line);
+            return Token(L")!", TokenType::PPEnd, s_offset, m_offset);
         }
-        return Token(L")", TokenType::RParen, s_offset, m_offset, line);
+        return Token(L")", TokenType::RParen, s_offset, m_offset);
 
     case L'[':
         GetChar();
-        return Token(L"[", TokenType::LBracket, s_offset, m_offset, line);
+        return Token(L"[", TokenType::LBracket, s_offset, m_offset);
     case L']':
         GetChar();
-        return Token(L"]", TokenType::RBracket, s_offset, m_offset, line);
+        return Token(L"]", TokenType::RBracket, s_offset, m_offset);
 
     case L'.':
         GetChar();
-        return Token(L".", TokenType::Dot, s_offset, m_offset, line);
+        return Token(L".", TokenType::Dot, s_offset, m_offset);
     case L',':
         GetChar();
-        return Token(L",", TokenType::Comma, s_offset, m_offset, line);
+        return Token(L",", TokenType::Comma, s_offset, m_offset);
     case L':':
         GetChar();
-        return Token(L":", TokenType::Colon, s_offset, m_offset, line);
+        return Token(L":", TokenType::Colon, s_offset, m_offset);
     case L'?':
         GetChar();
-        return Token(L"?", TokenType::Quest, s_offset, m_offset, line);
+        return Token(L"?", TokenType::Quest, s_offset, m_offset);
         // #!( PREPROCESSOR )!
     case L'#':
         GetChar();
@@ -659,7 +989,7 @@ Token Tokenizer::ParseOperator()
             if (m_code[m_offset == '('])
             {
                 GetChar();
-                return Token(L"#!(", TokenType::PPBegin, s_offset, m_offset, line);
+                return Token(L"#!(", TokenType::PPBegin, s_offset, m_offset);
             }
         }
         UnexpToken(L"Invalid preprocessor directive.");
@@ -672,47 +1002,47 @@ Token Tokenizer::ParseOperator()
 
 Token Tokenizer::Next()
 {
-    if (SkipNext)
+    // _asm { raw text }
+    if (m_asm_body)
     {
-        SkipNext = false;
-        return SkipToken;
+        m_asm_body = false;
+        Token r = ParseRawUntil(L'}');
+        // drop the indentation of the closing brace
+        std::wstring_view body = r.GetText();
+        while (body.length() && (body.back() == L' ' || body.back() == L'\t'))
+        {
+            body.remove_suffix(1);
+        }
+        r.SetText(body);
+        return r;
     }
 
     if (m_offset >= m_code.size())
     {
-        if (EofReturned) UnexpToken(L"End of file");
-        EofReturned = true;
-        prevCol = col;
-        prevLine = line;
-        prevOffset = m_offset;
+        if (m_eof) UnexpToken(L"End of file");
+        m_eof = true;
 
-        return Token(L"EoF", TokenType::EoF, m_offset, m_offset, line);
+        return Token(L"EoF", TokenType::EoF, m_offset, m_offset);
     }
 
     SkipWhite();
 
     if (m_offset >= m_code.size())
     {
-        if (EofReturned) UnexpToken(L"End of file");
-        EofReturned = true;
-        prevCol = col;
-        prevLine = line;
-        prevOffset = m_offset;
+        if (m_eof) UnexpToken(L"End of file");
+        m_eof = true;
 
-        return Token(L"EoF", TokenType::EoF, m_offset, m_offset, line);
+        return Token(L"EoF", TokenType::EoF, m_offset, m_offset);
     }
 
     SkipComments();
 
     if (m_offset >= m_code.size())
     {
-        if (EofReturned) UnexpToken(L"End of file");
-        EofReturned = true;
-        prevCol = col;
-        prevLine = line;
-        prevOffset = m_offset;
+        if (m_eof) UnexpToken(L"End of file");
+        m_eof = true;
 
-        return Token(L"EoF", TokenType::EoF, m_offset, m_offset, line);
+        return Token(L"EoF", TokenType::EoF, m_offset, m_offset);
     }
 
     wchar_t s = m_code[m_offset];
@@ -723,13 +1053,6 @@ Token Tokenizer::Next()
     {
         GetChar(); // remove "
         auto r = ParseStringLiteral<StringType::Regular>();
-        prevCol = col;
-        prevLine = line;
-        prevOffset = m_offset;
-        if (line > files[m_cfile].EndLine)
-        {
-            ++m_cfile;
-        }
         return r;
     }
 
@@ -742,13 +1065,6 @@ Token Tokenizer::Next()
             GetChar(); // remove "
             GetChar(); // remove (
             auto r = ParseStringLiteral<StringType::Raw>();
-            prevCol = col;
-            prevLine = line;
-            prevOffset = m_offset;
-            if (line > files[m_cfile].EndLine)
-            {
-                ++m_cfile;
-            }
             return r;
         }
         else
@@ -760,43 +1076,49 @@ Token Tokenizer::Next()
     if (IsAlpha(s) || s == L'_')
     {
         auto r = ParseName();
-        prevCol = col;
-        prevLine = line;
-        prevOffset = m_offset;
-        if (line > files[m_cfile].EndLine)
-        {
-            ++m_cfile;
-        }
+        m_asm = r.kw_type == Keyword::kw_asm;
         return r;
     }
 
     if (IsNumber(s))
     {
         auto r = ParseNumberLiteral();
-        if (!IsNumValid(r))
-        {
-            throw Error(L"Invalid number literal. It doesn't fit the given number of bits.\n");
-        }
-        SkipWhite();
-        prevCol = col;
-        prevLine = line;
-        prevOffset = m_offset;
-        if (line > files[m_cfile].EndLine)
-        {
-            ++m_cfile;
-        }
         return r;
     }
 
     auto r = ParseOperator();
-    SkipWhite();
-    prevCol = col;
-    prevLine = line;
-    prevOffset = m_offset;
-    if (line > files[m_cfile].EndLine)
+    if (m_asm && r.type == TokenType::LBrace)
     {
-        ++m_cfile;
+        // the block is taken as it is, starting right after the brace
+        m_asm = false;
+        m_asm_body = true;
+        return r;
     }
+    m_asm = false;
+    SkipWhite();
+    return r;
+}
+
+TokenArray Tokenizer::LexAll()
+{
+    TokenArray r;
+    // a rough guess to avoid most of the reallocations
+    r.Reserve((m_code.size() - m_offset) / 4 + 1);
+
+    Token t;
+    int64_t depth = 0;
+    do
+    {
+        t = Next();
+        if (t.type == TokenType::LBrace) ++depth;
+        else if (t.type == TokenType::RBrace) --depth;
+        else if (depth == 0 && t.type == TokenType::Name && t.GetText() == L"import")
+        {
+            r.imports.push_back((uint32_t)r.Size());
+        }
+        r.Push(t);
+    } while (t.type != TokenType::EoF);
+
     return r;
 }
 
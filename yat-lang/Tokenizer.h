@@ -30,19 +30,24 @@ class Tokenizer
     };
 
     String m_code;
-    uint64_t m_offset = 0, line = 1, col = 1, prevLine = 1, prevCol = 1, prevOffset = 0;
+    uint64_t m_offset = 0;
+    // the last token was _asm, so the next '{' starts an assembly block
+    bool m_asm = false;
+    // the next token is the raw text of an assembly block
+    bool m_asm_body = false;
+    // EoF token has already been returned
+    bool m_eof = false;
+    // offsets of the first characters of all lines
+    std::vector<uint64_t> m_lines;
+    void IndexLines(const wchar_t* s, size_t n, uint64_t offset);
     wchar_t GetChar();
     void EatChars(size_t n);
     void SkipWhite();
     void NextLine();
     void SkipComments();
-    bool IsNumValid(const Token& t);
-    Keyword IsKeyword(const String& str);
     wchar_t ParseEscapeChar();
     String GetLine(uint64_t offs, uint64_t offe, size_t& s);
 
-    // index of the current file
-    uint64_t m_cfile = 0;
     void UnexpToken(const String& msg);
 
 public:
@@ -55,15 +60,22 @@ public:
 
     std::vector<FileInfo> files{};
 
-    bool SkipNext = false;
-    Token SkipToken{};
+    // line and column numbers are not tracked while lexing,
+    // they are looked up by offset only for diagnostics
+    uint64_t GetLineNum(uint64_t offset) const;
+    uint64_t GetColNum(uint64_t offset) const;
+    // index of the file the line belongs to
+    size_t GetFile(uint64_t line) const;
 
     Tokenizer(const std::vector<String>& str, bool path = true);
 
+    // the keyword the name is, Keyword::Last if it is none
+    static Keyword IsKeyword(const wchar_t* str, size_t n);
+
     void UnexpToken(const String& msg, Token* t);
 
     Token ParseName();
-    String ParseNumber();
+    std::wstring_view ParseNumber();
     Token ParseNumberLiteral();
 
     template<StringType T>
@@ -75,5 +87,8 @@ public:
 
     Token ParseOperator();
     Token Next();
+    // lex the rest of the source, the last token is EoF
+    // top-level imports are noted on the way, so they can be loaded without another pass
+    TokenArray LexAll();
 };
 
@@ -16,50 +16,6 @@
 //
 #include "Tokens.h"
 
-const wchar_t* KeywordStr[]{
-    L"using",
-    L"nspace",
-    L"fn",
-    L"i8",
-    L"i16",
-    L"i32",
-    L"i64",
-    L"u8",
-    L"u16",
-    L"u32",
-    L"u64",
-    L"f32",
-    L"f64",
-    L"ch16",
-    L"str16",
-    L"bool",
-    L"ret",
-    L"mut",
-    L"true",
-    L"false",
-    L"break",
-    L"continue",
-    L"if",
-    L"else",
-    L"while",
-    L"for",
-    L"do",
-    L"let",
-    L"null",
-    L"class",
-    L"pub",
-    L"prv",
-    L"prt",
-    L"vrt",
-    L"base",
-    L"new",
-    L"_asm",
-    L"rng",
-    L"in",
-    L"as",
-    L"Last"
-};
-
 int GetPrecedence(TokenType oper, bool unary)
 {
     switch (oper)
@@ -137,6 +93,11 @@ int GetPrecedence(TokenType oper, bool unary)
     return 0;
 }
 
+bool IsRightAssoc(TokenType oper)
+{
+    return oper == TokenType::OperPow || GetPrecedence(oper, false) == GetPrecedence(TokenType::Assign, false);
+}
+
 bool IsNumber(TokenType type)
 {
     return (type == TokenType::Uint8L)
@@ -340,3 +301,56 @@ bool IsSigned(Keyword type)
     return false;
 }
 
+
+void TokenArray::Reserve(size_t n)
+{
+    type.reserve(n);
+    kw_type.reserve(n);
+    start.reserve(n);
+    length.reserve(n);
+    text.reserve(n);
+}
+
+void TokenArray::Push(const Token& t)
+{
+    std::wstring_view d = t.GetText();
+    if (t.IsOwned())
+    {
+        m_own.push_back(String(d));
+        d = m_own.back();
+    }
+
+    uint32_t id = (uint32_t)texts.size();
+    if (t.type == TokenType::Name || t.type == TokenType::Keyword)
+    {
+        auto res = m_names.emplace(d, id);
+        id = res.first->second;
+        if (res.second)
+        {
+            texts.push_back(d);
+            values.push_back(NumValue());
+            syms.push_back(InternSymbol(d));
+        }
+    }
+    else
+    {
+        texts.push_back(d);
+        values.push_back(t.num);
+        syms.push_back(NoSymbol);
+    }
+
+    type.push_back(t.type);
+    kw_type.push_back(t.kw_type);
+    start.push_back(t.start);
+    length.push_back((uint32_t)(t.end - t.start));
+    text.push_back(id);
+}
+
+Token TokenArray::Get(size_t i) const
+{
+    Token t(texts[text[i]], type[i], start[i], start[i] + length[i]);
+    t.kw_type = kw_type[i];
+    t.num = values[text[i]];
+    t.sym = syms[text[i]];
+    return t;
+}
@@ -16,7 +16,12 @@
 //
 #pragma once
 #include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
 #include "Utils.h"
+#include "Symbols.h"
 
 enum class TokenType
 {
@@ -226,13 +231,75 @@ enum class Keyword
     Last
 };
 
-extern const wchar_t* KeywordStr[];
+inline constexpr const wchar_t* KeywordStr[]{
+    L"using",
+    L"nspace",
+    L"fn",
+    L"i8",
+    L"i16",
+    L"i32",
+    L"i64",
+    L"u8",
+    L"u16",
+    L"u32",
+    L"u64",
+    L"f32",
+    L"f64",
+    L"ch16",
+    L"str16",
+    L"bool",
+    L"ret",
+    L"mut",
+    L"true",
+    L"false",
+    L"break",
+    L"continue",
+    L"if",
+    L"else",
+    L"while",
+    L"for",
+    L"do",
+    L"let",
+    L"null",
+    L"class",
+    L"pub",
+    L"prv",
+    L"prt",
+    L"vrt",
+    L"base",
+    L"new",
+    L"_asm",
+    L"rng",
+    L"in",
+    L"as",
+    L"Last"
+};
+
+// binary value of a number literal
+union NumValue
+{
+    int64_t i;
+    uint64_t u = 0;
+    double f;
+};
 
+// Text of a token is a view into the source buffer (or into a string that
+// lives as long as the AST, e.g. a literal or Var::name), so copying tokens
+// doesn't allocate. Only the text that isn't in the source as it is (strings
+// with escape sequences, numbers with '_', tokens made by the compiler) is
+// owned by the token.
 class Token
 {
+    String m_own{};
+    const wchar_t* m_text = nullptr;
+    size_t m_len = 0;
+    bool m_owned = false;
+
 public:
     Token() = default;
-    Token(const String& d, TokenType t, uint64_t start, uint64_t end, uint64_t line, Keyword kw = Keyword::Last)
+
+    // the text isn't copied and must outlive the token
+    Token(std::wstring_view d, TokenType t, uint64_t start, uint64_t end, Keyword kw = Keyword::Last)
     {
         if (kw != Keyword::Last)
         {
@@ -244,22 +311,106 @@ public:
         }
 
         kw_type = kw;
-        data = d;
+        SetText(d);
         this->start = start;
-        this->line = line;
         this->end = end;
     }
 
-    String data{};
+    Token(const wchar_t* d, TokenType t, uint64_t start, uint64_t end, Keyword kw = Keyword::Last)
+        : Token(std::wstring_view(d), t, start, end, kw)
+    {
+    }
+
+    // the text is copied to the token
+    Token(const String& d, TokenType t, uint64_t start, uint64_t end, Keyword kw = Keyword::Last)
+        : Token(std::wstring_view(), t, start, end, kw)
+    {
+        SetOwnText(d);
+    }
+
+    std::wstring_view GetText() const
+    {
+        return m_owned ? std::wstring_view(m_own) : std::wstring_view(m_text, m_len);
+    }
+
+    // the text isn't copied and must outlive the token
+    void SetText(std::wstring_view d)
+    {
+        m_own.clear();
+        m_owned = false;
+        m_text = d.data();
+        m_len = d.length();
+    }
+
+    void SetOwnText(const String& d)
+    {
+        m_own = d;
+        m_owned = true;
+        m_text = nullptr;
+        m_len = 0;
+    }
+
+    bool IsOwned() const
+    {
+        return m_owned;
+    }
+
     TokenType type{};
     Keyword kw_type{};
-    uint64_t start{}, end{}, line{};
+    // offsets in the source buffer
+    uint64_t start{}, end{};
+    // value of a number literal, parsed by the tokenizer
+    NumValue num{};
+    // symbol of a name
+    Symbol sym = NoSymbol;
+};
+
+// Tokens of a whole source lexed in advance (see Tokenizer::LexAll),
+// stored as a structure of arrays. The lexer fills it in one loop and
+// the parser walks it by index, so it can look any number of tokens ahead.
+class TokenArray
+{
+    // ids of the names pushed so far
+    std::unordered_map<std::wstring_view, uint32_t> m_names;
+    // texts that aren't in the source as they are
+    std::deque<String> m_own;
+
+public:
+    std::vector<TokenType> type;
+    std::vector<Keyword> kw_type;
+    std::vector<uint64_t> start;
+    // end - start of the token
+    std::vector<uint32_t> length;
+    // index in texts, names have the same id wherever they appear
+    std::vector<uint32_t> text;
+
+    std::vector<std::wstring_view> texts;
+    // values of the number literals by text id
+    std::vector<NumValue> values;
+    // symbols of the names by text id, a name is interned
+    // the first time it appears in the array
+    std::vector<Symbol> syms;
+
+    // indices of the `import' names outside of any braces
+    std::vector<uint32_t> imports;
+
+    size_t Size() const
+    {
+        return type.size();
+    }
+
+    void Reserve(size_t n);
+    void Push(const Token& t);
+    // the token viewing the text stored in the array
+    Token Get(size_t i) const;
 };
 
 int GetPrecedence(TokenType oper, bool unary);
 bool IsNumber(TokenType type);
 bool IsNumber(Keyword kw);
 bool IsBinaryOp(TokenType type);
+// assignments and '**' group from the right
+bool IsRightAssoc(TokenType oper);
 Keyword TTypeToKeyword(TokenType t);
 size_t GetTypeSize(Keyword kw);
 // returns EoF if invalid token type has been passed
@@ -16,6 +16,7 @@
 //
 #pragma once
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <fstream>
 #include <codecvt>
@@ -55,7 +56,7 @@ public:
 };
 
 template<class T>
-inline T _StringToNumHelper(const String& str)
+inline T _StringToNumHelper(std::wstring_view str)
 {
     T buf = 0;
     int i = 0;
@@ -75,7 +76,7 @@ inline T _StringToNumHelper(const String& str)
 }
 
 template<class T>
-inline T StringToNum(const String& str)
+inline T StringToNum(std::wstring_view str)
 {
     // As I tested this algorithm is 4-5 times faster than std::stoi (stof, stod, etc.)
     // for float and up to 9 times faster for long double and long long. (g++ -Ofast)
@@ -93,7 +94,7 @@ inline T StringToNum(const String& str)
         if (str[i] == L'.')
         {
             ++i;
-            String f = str.substr(i); // string with all digits after point
+            std::wstring_view f = str.substr(i); // string with all digits after point
             T n = (T)_StringToNumHelper<uint64_t>(f);
             // if str = "123.45"
             // buf before '.' is 123
@@ -131,18 +132,10 @@ inline void S2W(const std::string& narrow, std::wstring& wide)
     wide = converter.from_bytes(narrow);
 }
 
-// add file contents to the buffer
-inline bool ReadFile(const String& path, String& buffer)
+inline void W2S(const std::wstring& wide, std::string& narrow)
 {
-    std::wifstream wif(path);
-    if (!wif.is_open()) return false;
-
-    auto _ = wif.imbue(std::locale(std::locale::empty(), new std::codecvt_utf8<wchar_t>));
-    std::wstringstream wss;
-    wss << buffer << wif.rdbuf();
-    buffer = wss.str();
-
-    return true;
+    std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    narrow = converter.to_bytes(wide);
 }
 
 inline bool IsAlpha(wchar_t c)
@@ -0,0 +1,112 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Writes the input of the parse throughput benchmark (see parse_bench.cpp):
+// functions made of random expression statements, each function calls the
+// one before it. Not part of the MSVC build. Build and run from yat-lang/:
+//
+//   g++ -std=c++17 -O2 bench/gen_exprs.cpp -o gen_exprs
+//   ./gen_exprs exprs.yat [functions] [statements per function] [depth] [binary only]
+//
+// The defaults give 1500 functions with 18000 statements of depth 4. With
+// binary only set to 1 there are no calls and no prefix operators, which the
+// shunting-yard parser did not handle.
+//
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+static std::mt19937 gen(1234);
+static bool binary_only = false;
+
+static const char* Pick(std::initializer_list<const char*> l)
+{
+    return l.begin()[gen() % l.size()];
+}
+
+// call is the function that may be called, or -1
+static std::string Expr(int depth, int call)
+{
+    if (depth == 0)
+    {
+        switch (gen() % 3)
+        {
+        case 0:
+            return std::to_string(gen() % 100);
+        default:
+            return Pick({ "a", "b", "x", "y" });
+        }
+    }
+
+    switch (gen() % 8)
+    {
+    case 0:
+        return std::string("(") + Expr(depth - 1, call) + ")";
+    case 1:
+        if (binary_only)
+        {
+            break;
+        }
+        return std::string(Pick({ "-", "~", "!" })) + Expr(depth - 1, call);
+    case 2:
+        if (call >= 0 && !binary_only)
+        {
+            return "calc" + std::to_string(call) + "(" + Expr(depth - 1, call) + ", " + Expr(depth - 1, call) + ")";
+        }
+        break;
+    }
+
+    return Expr(depth - 1, call) + " "
+        + Pick({ "+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "<", "==", "&&", "||" })
+        + " " + Expr(depth - 1, call);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: gen_exprs out.yat [functions] [statements] [depth] [binary only]\n");
+        return 1;
+    }
+
+    int fns = argc > 2 ? atoi(argv[2]) : 1500;
+    int stmts = argc > 3 ? atoi(argv[3]) : 12;
+    int depth = argc > 4 ? atoi(argv[4]) : 4;
+    binary_only = argc > 5 && atoi(argv[5]) != 0;
+
+    FILE* f = fopen(argv[1], "w");
+    if (!f)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fprintf(f, "nspace program\n{\n");
+    for (int i = 0; i < fns; ++i)
+    {
+        fprintf(f, "    fn calc%d = (i32 mut a, i32 mut b) -> i32 {\n", i);
+        fprintf(f, "        i32 mut x = a;\n        i32 mut y = b;\n");
+        for (int s = 0; s < stmts; ++s)
+        {
+            fprintf(f, "        %s = %s;\n", s % 2 ? "y" : "x", Expr(depth, i - 1).c_str());
+        }
+        fprintf(f, "        ret x + y\n    };\n\n");
+    }
+    fprintf(f, "    fn main = () -> i32 {\n        ret calc%d(1, 2)\n    };\n}\n", fns - 1);
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,126 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Keyword lookup microbenchmark, not part of the MSVC build. It times the
+// linear scan over KeywordStr that IsKeyword used to do against
+// Tokenizer::IsKeyword, over identifier-heavy names, and checks that both
+// give the same keyword for every name. Build and run from yat-lang/ (the
+// -include flags stand in for headers MSVC brings in by itself):
+//
+//   g++ -std=c++17 -O2 -include cmath -include locale -include codecvt bench/kwhash_bench.cpp Tokenizer.cpp FileMapping.cpp Tokens.cpp Symbols.cpp -o kwhash_bench
+//   ./kwhash_bench [names]
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cwchar>
+#include <random>
+#include "../Tokenizer.h"
+
+// what IsKeyword did before, it took the name as a String
+static Keyword LinearLookup(const wchar_t* str, size_t n)
+{
+    String name(str, n);
+    for (int i = 0; i < (int)Keyword::Last; ++i)
+    {
+        if (name == KeywordStr[i])
+        {
+            return (Keyword)i;
+        }
+    }
+    return Keyword::Last;
+}
+
+// one name in eight is a keyword, the rest look like the identifiers of a program
+static std::vector<String> MakeNames(size_t count)
+{
+    static const wchar_t* parts[]{
+        L"i", L"n", L"idx", L"len", L"buf", L"tmp", L"node", L"value", L"count",
+        L"result", L"offset", L"parse", L"token", L"get", L"set", L"next", L"size"
+    };
+    std::mt19937 gen(42);
+    std::vector<String> names;
+    names.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (gen() % 8 == 0)
+        {
+            names.push_back(KeywordStr[gen() % (size_t)Keyword::Last]);
+            continue;
+        }
+
+        String s = parts[gen() % (sizeof(parts) / sizeof(parts[0]))];
+        if (gen() % 2)
+        {
+            s += L"_";
+            s += parts[gen() % (sizeof(parts) / sizeof(parts[0]))];
+        }
+        if (gen() % 3 == 0)
+        {
+            s += (wchar_t)(L'0' + gen() % 10);
+        }
+        names.push_back(s);
+    }
+
+    // near misses of keywords
+    for (const wchar_t* s : { L"i9", L"u65", L"continuee", L"Last", L"fnn", L"re" })
+    {
+        names.push_back(s);
+    }
+    return names;
+}
+
+template<typename F>
+static double NsPerName(const std::vector<String>& names, F lookup, size_t& found)
+{
+    double best = 1e300;
+    for (int run = 0; run < 5; ++run)
+    {
+        found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const String& s : names)
+        {
+            found += lookup(s.data(), s.length()) != Keyword::Last;
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / names.size();
+        best = ns < best ? ns : best;
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+    std::vector<String> names = MakeNames(count);
+
+    for (const String& s : names)
+    {
+        if (LinearLookup(s.data(), s.length()) != Tokenizer::IsKeyword(s.data(), s.length()))
+        {
+            fwprintf(stderr, L"mismatch on %ls\n", s.c_str());
+            return 1;
+        }
+    }
+
+    size_t linear_found = 0, hash_found = 0;
+    double linear = NsPerName(names, LinearLookup, linear_found);
+    double hash = NsPerName(names, Tokenizer::IsKeyword, hash_found);
+    printf("%zu names, %zu keywords\n", names.size(), hash_found);
+    printf("linear scan: %.1f ns/name\n", linear);
+    printf("perfect hash: %.1f ns/name\n", hash);
+    return linear_found == hash_found ? 0 : 1;
+}
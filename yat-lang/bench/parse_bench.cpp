@@ -0,0 +1,105 @@
+//  Yat programming language
+//  Copyright (C) 2019  Nikita Dubovikov
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+// Parse throughput benchmark, not part of the MSVC build. The file is lexed
+// once, then only Parser::Parse is timed, best of 5 runs, and the heap
+// allocations made while parsing are counted by the operator new below. The
+// input comes from gen_exprs.cpp. Build and run from yat-lang/ in a developer
+// command prompt (Parser.cpp needs the MSVC preprocessor):
+//
+//   cl /std:c++17 /O2 /EHsc bench\parse_bench.cpp Parser.cpp AST.cpp Tokenizer.cpp Tokens.cpp Symbols.cpp FileMapping.cpp
+//   parse_bench exprs.yat
+//
+// The driver only uses the Tokenizer, TokenArray, NodeArena and Parser
+// interfaces, so it builds unchanged against the tree before expressions were
+// parsed by precedence climbing, which gives the shunting-yard numbers:
+//
+//   git worktree add ..\old <commit before "Parse expressions by precedence climbing">
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "../Parser.h"
+
+static size_t allocs = 0;
+
+void* operator new(size_t n)
+{
+    ++allocs;
+    if (void* p = malloc(n ? n : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: parse_bench file.yat\n");
+        return 1;
+    }
+
+    try
+    {
+        String path(argv[1], argv[1] + strlen(argv[1]));
+        Tokenizer tok({ path });
+        TokenArray toks = tok.LexAll();
+
+        double best = 1e300;
+        size_t decls = 0;
+        size_t parse_allocs = 0;
+        for (int run = 0; run < 5; ++run)
+        {
+            AST tree;
+            NodeArena::Use use_nodes(tree.nodes);
+
+            size_t allocs_before = allocs;
+            auto start = std::chrono::steady_clock::now();
+            Parser parser(&tok, &toks);
+            parser.Parse(tree);
+            auto end = std::chrono::steady_clock::now();
+            parse_allocs = allocs - allocs_before;
+
+            double ms = std::chrono::duration<double, std::milli>(end - start).count();
+            best = ms < best ? ms : best;
+            decls = tree.prog.empty() ? 0 : tree.prog[0]->block->children.size();
+        }
+
+        printf("%zu tokens, %zu declarations\n", toks.Size(), decls);
+        printf("parse: %.1f ms, %.2fM tokens/s\n", best, toks.Size() / best / 1000.0);
+        printf("allocations while parsing: %zu\n", parse_allocs);
+    }
+    catch (const Error& ex)
+    {
+        fwprintf(stderr, L"%ls\n", ex.what().c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstdlib>
 #include "Compiler.h"
 
 constexpr const char* HelpMsg = R"(
@@ -28,6 +29,23 @@ Options:
     -o <path>                           output file (without extension)
     -S                                  compile program, but do not assemble and link
     -O[0-3]                             level of optimization
+    -f<pass>                            run the optimization pass whatever the level is
+    -fno-<pass>                         do not run the optimization pass
+    -report                             print what the optimization passes did for every function
+    -j <n>                              number of threads lexing source files (all cores by default)
+
+Optimization passes (the lowest level which runs them):
+    inline                              -O2  inline calls of small immutable functions
+    const-prop                          -O1  propagate and fold constants
+    ssa                                 -O2  generate functions through the SSA intermediate form
+    mem2reg                             -O2  keep parameters and local variables in SSA values
+    regalloc                            -O2  keep IR values in registers (linear scan)
+    regalloc-graph                      -O3  keep IR values in registers (graph coloring, coalesces moves)
+    peephole                            -O1  rewrite short sequences of instructions (redundant moves and jumps)
+
+Environment variables:
+    YatLibDir                           folder of the standard library
+    YatCacheDir                         folder to keep parsed imported files in (not cached if unset)
 )";
 
 int main(int argc, char** argv)
@@ -36,6 +54,10 @@ int main(int argc, char** argv)
     std::wstring output = L"a", input;
     bool assembly = false;
     int opt_level = 0;
+    unsigned jobs = 0;
+    bool report = false;
+    // passes switched on or off, applied after the level is known
+    std::vector<std::pair<std::string, bool>> pass_flags;
 
     if (argc <= 1)
     {
@@ -67,6 +89,13 @@ int main(int argc, char** argv)
                 continue;
             }
 
+            if (args[i] == "-j")
+            {
+                jobs = (unsigned)std::atoi(args[i + (size_t)1].c_str());
+                ++i;
+                continue;
+            }
+
             if (args[i] == "-S")
             {
                 assembly = true;
@@ -97,6 +126,24 @@ int main(int argc, char** argv)
                 continue;
             }
 
+            if (args[i] == "-report")
+            {
+                report = true;
+                continue;
+            }
+
+            if (args[i].rfind("-fno-", 0) == 0)
+            {
+                pass_flags.emplace_back(args[i].substr(5), false);
+                continue;
+            }
+
+            if (args[i].rfind("-f", 0) == 0)
+            {
+                pass_flags.emplace_back(args[i].substr(2), true);
+                continue;
+            }
+
             if (args[i][0] == '-')
             {
                 std::wcout << L"WARNING: unrecognized compiler option `";
@@ -109,7 +156,19 @@ int main(int argc, char** argv)
         }
     }
 
-    Compiler comp(input, output, assembly, opt_level);
+    PassManager passes(opt_level);
+    passes.report = report;
+    for (auto& flag : pass_flags)
+    {
+        if (!passes.Set(flag.first, flag.second))
+        {
+            std::wcout << L"WARNING: unknown optimization pass `";
+            std::cout << flag.first;
+            std::wcout << L"' ignored. Use `-h' for list of all passes.\n";
+        }
+    }
+
+    Compiler comp(input, output, assembly, passes, jobs);
     if (comp.Run())
     {
         return 0;